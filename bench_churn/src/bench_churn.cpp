@@ -0,0 +1,391 @@
+//Connection scaling benchmark for "netserver" and "netclient"
+//  Opens more and more idle connections over loopback, from several source
+//  addresses, and for each step reports the accept rate, memory per
+//  connection, the cost of one server loop, and how fast connections can
+//  be closed and reopened.  Stops at the first step that can't be opened,
+//  and says why: that is where the select() or open file limit is.
+
+#include "netserver.h"
+#include "netclient.h"
+#include "nethistogram.h"
+#include <cstdio>
+#include <cstdlib>
+#include <set>
+#include <string>
+
+#ifdef _WIN32
+    #include <psapi.h>
+#else
+    #include <unistd.h>
+    #include <sys/resource.h>
+#endif
+
+//STL namespace
+using namespace std;
+
+//net-- namespace
+using net__::netbase;
+using net__::netclient;
+using net__::nethistogram;
+using net__::netserver;
+using net__::netstats;
+
+//Constants
+const size_t defaultConnections = 20000;
+const unsigned int defaultSources = 8;
+const unsigned int defaultSeconds = 2;
+const uint16_t defaultPort = 23457;
+const size_t connectWindow = 128;          //Connects in flight at once
+const unsigned int stallTime = 10000;      //ms without progress = stuck
+const unsigned int loopTime = 200;         //ms to time the idle loop
+
+//Connection counts to stop at.  The last step is the requested count.
+const size_t steps[] = { 100, 300, 1000, 3000, 10000, 30000, 100000 };
+
+//Types
+typedef struct {
+    netclient *client;
+    netserver *server;
+    set<sock_t> open;           //Connected client sockets
+    size_t opened;              //doConnect calls that returned a socket
+    size_t connected;
+    size_t failed;
+    size_t accepted;            //Open on the server side
+    unsigned int sources;
+    string cliff;               //Why connections stopped opening
+} churnData;
+
+//Callbacks
+size_t client_connect( int c, void *cb_data);
+size_t client_failed( int c, void *cb_data);
+size_t client_disconnect( int c, void *cb_data);
+size_t server_connect( int c, void *cb_data);
+size_t server_disconnect( int c, void *cb_data);
+
+//Start one connection from the next source address.  False if it failed.
+bool open_one( churnData& data, uint16_t port);
+
+//Number of connects still in flight
+size_t in_flight( const churnData& data);
+
+//Run both loops until *total* connections are open and accepted, or it
+//  gets stuck
+double open_to( churnData& data, uint16_t port, size_t total);
+
+//Time the server loop with every connection idle
+void time_loop( churnData& data, nethistogram& loop);
+
+//Close and reopen connections for *seconds*, return reconnects/second
+double churn( churnData& data, uint16_t port, unsigned int seconds);
+
+//Resident memory of this process in bytes, 0 if unknown
+uint64_t get_memory();
+
+//MAIN
+int main (int argc, char *argv[])
+{
+    size_t connections = (argc > 1 ? atoi(argv[1]) : defaultConnections);
+    unsigned int sources = (argc > 2 ? atoi(argv[2]) : defaultSources);
+    unsigned int seconds = (argc > 3 ? atoi(argv[3]) : defaultSeconds);
+    uint16_t port = (argc > 4 ? atoi(argv[4]) : defaultPort);
+    size_t index, total, accepts;
+    uint64_t memory_start, memory;
+    double open_time, churn_rate;
+    nethistogram loop;
+    netstats stats;
+    churnData data;
+
+    if (sources < 1 || sources > 254) {
+        sources = defaultSources;
+    }
+
+#ifndef _WIN32
+    //Both ends of every connection live in this process
+    struct rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0) {
+        limit.rlim_cur = limit.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &limit);
+        getrlimit(RLIMIT_NOFILE, &limit);
+        printf("# open file limit %lu\n", (unsigned long)limit.rlim_cur);
+    }
+#endif
+#ifdef NETMM_USE_POLL
+    printf("# poll()\n");
+#else
+    printf("# select(), FD_SETSIZE %u\n", (unsigned int)FD_SETSIZE);
+#endif
+
+    data.server = new netserver(connections + connectWindow);
+    data.client = new netclient(connections + connectWindow);
+    data.opened = data.connected = data.failed = data.accepted = 0;
+    data.sources = sources;
+
+    data.client->setConnectCB( client_connect, &data);
+    data.client->setConnectFailCB( client_failed, &data);
+    data.client->setDisconnectCB( client_disconnect, &data);
+    data.server->setConnectCB( server_connect, &data);
+    data.server->setDisconnectCB( server_disconnect, &data);
+    if (data.server->openPort(port) == (sock_t)INVALID_SOCKET) {
+        fprintf(stderr, "Cannot listen on port %u\n", port);
+        return 1;
+    }
+    data.server->setTiming(true);
+    memory_start = get_memory();
+
+    printf("%8s %8s %10s %9s %9s %9s %9s %9s %10s\n", "conns", "open(s)",
+        "accepts/s", "KB/conn", "bufKB/c", "loop p50", "loop p99",
+        "sel p50", "churn/s");
+
+    for (index = 0; index <= sizeof(steps) / sizeof(size_t); index++) {
+        total = (index < sizeof(steps) / sizeof(size_t) ?
+                 steps[index] : connections);
+        if (total > connections) {
+            total = connections;
+        }
+        if (total <= data.open.size() && index > 0) {
+            continue;
+        }
+
+        //Open up to this step
+        data.server->resetStats();
+        open_time = open_to( data, port, total);
+        stats = data.server->getStats();
+        accepts = (size_t)stats.accepts;
+
+        //Both ends of a connection are counted as one
+        memory = get_memory();
+        total = data.open.size();
+        if (total == 0) {
+            break;
+        }
+
+        time_loop( data, loop);
+        churn_rate = churn( data, port, seconds);
+
+        printf("%8u %8.2f %10.0f %9.1f %9.1f %9.1f %9.1f %9.1f %10.0f\n",
+            (unsigned int)total, open_time,
+            (open_time > 0 ? accepts / open_time : 0.0),
+            (memory > memory_start ?
+                (double)(memory - memory_start) / total / 1024 : 0.0),
+            (double)stats.bufferMemory / total / 1024,
+            loop.percentile(50.0) / 1e3, loop.percentile(99.0) / 1e3,
+            data.server->getHistogram(netbase::TIME_SELECT).percentile(50.0)
+                / 1e3,
+            churn_rate);
+        fflush(stdout);
+
+        if (!data.cliff.empty()) {
+            printf("# stopped at %u connections: %s\n",
+                (unsigned int)data.open.size(), data.cliff.c_str());
+            break;
+        }
+        if (total >= connections) {
+            break;
+        }
+    }
+
+    delete data.client;
+    delete data.server;
+
+    return 0;
+}
+
+//Start one connection from the next source address
+bool open_one( churnData& data, uint16_t port)
+{
+    char source[16];
+    sock_t sd;
+
+    snprintf(source, sizeof(source), "127.0.0.%u",
+        (unsigned int)(1 + data.opened % data.sources));
+
+    sd = data.client->doConnect("127.0.0.1", port, 0, source);
+    if (sd == (sock_t)INVALID_SOCKET) {
+        data.cliff = "client: " + data.client->lastError;
+        return false;
+    }
+
+    data.opened++;
+    return true;
+}
+
+//Connects started, but not finished either way
+size_t in_flight( const churnData& data)
+{
+    return data.opened - data.connected - data.failed;
+}
+
+//Keep connectWindow connects in flight until *total* are open.  The kernel
+//  finishes connects before the server accepts them, so wait for both.
+double open_to( churnData& data, uint16_t port, size_t total)
+{
+    uint64_t started, progress;
+    size_t last_open = data.open.size(), last_accepted = data.accepted;
+    netstats stats;
+
+    started = netbase::getNanoTime();
+    progress = netbase::getTime();
+    while (data.open.size() < total || data.accepted < data.open.size()) {
+
+        //Top up connects in flight, unless something already failed
+        while (data.cliff.empty() && in_flight(data) < connectWindow &&
+               data.open.size() + in_flight(data) < total)
+        {
+            if (!open_one( data, port)) {
+                break;
+            }
+        }
+
+        data.client->run();
+        data.server->run();
+
+        //Refused by the server, or timed out connecting
+        stats = data.server->getStats();
+        if (data.cliff.empty() && stats.acceptRejects > 0) {
+            data.cliff = "server: connection refused, socket out of range";
+        }
+        if (data.cliff.empty() && data.failed > 0) {
+            data.cliff = "client: connect failed or timed out";
+        }
+
+        if (data.open.size() != last_open || data.accepted != last_accepted) {
+            last_open = data.open.size();
+            last_accepted = data.accepted;
+            progress = netbase::getTime();
+        }
+        if (!data.cliff.empty() && in_flight(data) == 0 &&
+            data.accepted >= data.open.size())
+        {
+            break;
+        }
+        if (netbase::getTime() - progress > stallTime) {
+            if (data.cliff.empty()) {
+                data.cliff = "stuck: no connections finished for 10s";
+            }
+            break;
+        }
+    }
+
+    return (double)(netbase::getNanoTime() - started) / 1e9;
+}
+
+//Time whole server loops, nothing to read on any connection
+void time_loop( churnData& data, nethistogram& loop)
+{
+    uint64_t started, stopped, before;
+
+    loop.clear();
+    data.server->resetStats();
+
+    started = netbase::getTime();
+    do {
+        before = netbase::getNanoTime();
+        data.server->run();
+        stopped = netbase::getNanoTime();
+        loop.record(stopped - before);
+    } while (netbase::getTime() - started < loopTime);
+}
+
+//Close the lowest client socket and open a new one, for *seconds*
+double churn( churnData& data, uint16_t port, unsigned int seconds)
+{
+    uint64_t started, stopped;
+    size_t reconnects = data.connected;
+    sock_t sd;
+
+    if (!data.cliff.empty()) {
+        return 0.0;
+    }
+
+    started = netbase::getNanoTime();
+    stopped = started + (uint64_t)seconds * 1000000000;
+    while (netbase::getNanoTime() < stopped) {
+        while (in_flight(data) < connectWindow && !data.open.empty()) {
+            sd = *data.open.begin();
+            data.open.erase(data.open.begin());
+            data.client->disconnect(sd);
+            if (!open_one( data, port)) {
+                break;
+            }
+        }
+
+        data.client->run();
+        data.server->run();
+    }
+    stopped = netbase::getNanoTime();
+
+    //Let connects in flight finish, so the next step starts clean
+    while ((in_flight(data) > 0 || data.accepted != data.open.size()) &&
+           data.failed == 0 && netbase::getNanoTime() - stopped <
+           (uint64_t)stallTime * 1000000)
+    {
+        data.client->run();
+        data.server->run();
+    }
+
+    return (data.connected - reconnects) / ((double)(stopped - started) / 1e9);
+}
+
+//Resident memory of this process in bytes
+uint64_t get_memory()
+{
+#ifdef _WIN32
+    PROCESS_MEMORY_COUNTERS counters;
+    if (GetProcessMemoryInfo(GetCurrentProcess(), &counters,
+            sizeof(counters)))
+    {
+        return counters.WorkingSetSize;
+    }
+    return 0;
+#else
+    unsigned long pages = 0, resident = 0;
+    FILE *statm = fopen("/proc/self/statm", "r");
+
+    if (statm == NULL) {
+        return 0;
+    }
+    if (fscanf(statm, "%lu %lu", &pages, &resident) != 2) {
+        resident = 0;
+    }
+    fclose(statm);
+
+    return (uint64_t)resident * sysconf(_SC_PAGESIZE);
+#endif
+}
+
+//Client connection callback
+size_t client_connect( int c, void *cb_data)
+{
+    churnData *data = (churnData*)cb_data;
+    data->open.insert(c);
+    data->connected++;
+    return c;
+}
+
+//Client connect failed
+size_t client_failed( int c, void *cb_data)
+{
+    ((churnData*)cb_data)->failed++;
+    return c;
+}
+
+//Server closed a client connection
+size_t client_disconnect( int c, void *cb_data)
+{
+    ((churnData*)cb_data)->open.erase(c);
+    return c;
+}
+
+//Server accepted a connection
+size_t server_connect( int c, void *cb_data)
+{
+    ((churnData*)cb_data)->accepted++;
+    return c;
+}
+
+//Client closed its end
+size_t server_disconnect( int c, void *cb_data)
+{
+    ((churnData*)cb_data)->accepted--;
+    return c;
+}
@@ -0,0 +1,144 @@
+//Datagram throughput benchmark for "netdgram"
+//  One socket sends fixed size datagrams to another over loopback, both in
+//  one loop, keeping a window of datagrams in flight so the receive buffer
+//  doesn't overflow.  Runs with segmentation offload off and on, and
+//  reports datagrams/s, MB/s, datagrams per system call and losses.
+
+#include "netdgram.h"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+//STL namespace
+using namespace std;
+
+//net-- namespace
+using net__::netbase;
+using net__::netdgram;
+using net__::netpacket;
+using net__::netstats;
+
+//Constants
+const size_t defaultSize = 1200;
+const unsigned int defaultSeconds = 3;
+const uint16_t defaultPort = 23458;
+const size_t window = 256;              //Datagrams in flight at once
+const unsigned int stallTime = 200;     //ms without a datagram = lost
+
+//Types
+typedef struct {
+    size_t received;
+    size_t bytes;
+} dgramData;
+
+//Callbacks
+void receive( netpacket* pkt, const struct sockaddr_storage* from,
+              void *cb_data);
+
+//Send for *seconds*, print one line of results
+bool bench( bool offload, size_t size, unsigned int seconds, uint16_t port);
+
+//MAIN
+int main (int argc, char *argv[])
+{
+    size_t size = (argc > 1 ? atoi(argv[1]) : defaultSize);
+    unsigned int seconds = (argc > 2 ? atoi(argv[2]) : defaultSeconds);
+    uint16_t port = (argc > 3 ? atoi(argv[3]) : defaultPort);
+
+    if (size < 1 || size > 0xffdc) {
+        size = defaultSize;
+    }
+
+#ifdef NETMM_USE_MMSG
+    printf("# recvmmsg()/sendmmsg(), %u bytes\n", (unsigned int)size);
+#else
+    printf("# recvfrom()/sendto(), %u bytes\n", (unsigned int)size);
+#endif
+    printf("%8s %12s %9s %9s %9s %9s\n", "offload", "dgrams/s", "MB/s",
+           "dg/send", "dg/recv", "lost");
+
+    if (!bench( false, size, seconds, port) ||
+        !bench( true, size, seconds, port))
+    {
+        return 1;
+    }
+
+    return 0;
+}
+
+//Count datagrams
+void receive( netpacket* pkt, const struct sockaddr_storage* from,
+              void *cb_data)
+{
+    dgramData *data = (dgramData*)cb_data;
+
+    data->received++;
+    data->bytes += pkt->get_maxsize();
+}
+
+//Send for *seconds*, print one line of results
+bool bench( bool offload, size_t size, unsigned int seconds, uint16_t port)
+{
+    netdgram net(4);
+    dgramData data;
+    vector<uint8_t> payload(size, 'x');
+    netpacket pkt( size);
+    netstats stats;
+    sock_t sdSend, sdReceive;
+    size_t sent = 0, lost = 0;
+    uint64_t started, now, waited;
+    double elapsed;
+
+    data.received = data.bytes = 0;
+    pkt.append( &payload[0], size);
+
+    net.setOffload( offload);
+    net.setMaxDatagram( size);
+    sdReceive = net.openPort( port, receive, &data, "127.0.0.1");
+    sdSend = net.openPort( 0, receive, &data, "127.0.0.1");
+    if (sdReceive == (sock_t)INVALID_SOCKET ||
+        sdSend == (sock_t)INVALID_SOCKET)
+    {
+        fprintf(stderr, "Cannot open UDP port %u\n", port);
+        return false;
+    }
+
+    //Keep *window* datagrams in flight, not counting lost ones.  A lost
+    //  one can still arrive late, so add to the window instead of taking
+    //  them off what is in flight.
+    started = now = waited = netbase::getNanoTime();
+    while (now - started < seconds * 1000000000ULL) {
+        if (sent - data.received < window + lost) {
+            while (sent - data.received < window + lost) {
+                net.sendTo( sdSend, pkt, "127.0.0.1", port);
+                sent++;
+            }
+            waited = now;
+        } else if (now - waited > stallTime * 1000000ULL) {
+            //What's still missing was dropped
+            lost = sent - data.received;
+            waited = now;
+        }
+        net.run();
+        now = netbase::getNanoTime();
+    }
+    elapsed = (now - started) / 1e9;
+
+    //Collect the last window
+    waited = now;
+    while (data.received < sent && now - waited < stallTime * 1000000ULL) {
+        net.run();
+        now = netbase::getNanoTime();
+    }
+    lost = sent - data.received;
+
+    stats = net.getStats();
+    printf("%8s %12.0f %9.1f %9.1f %9.1f %9u\n", (offload ? "on" : "off"),
+        data.received / elapsed, data.bytes / elapsed / 1e6,
+        (double)stats.messagesOut / (stats.sendCalls ? stats.sendCalls : 1),
+        (double)stats.messagesIn / (stats.recvCalls ? stats.recvCalls : 1),
+        (unsigned int)lost);
+
+    return true;
+}
@@ -0,0 +1,267 @@
+//Loopback echo benchmark for "netserver" and "netclient"
+//  Every client connection sends a message, waits for the echo and sends
+//  again.  Reports messages/s, bytes/s and round trip percentiles for each
+//  message size and connection count.
+
+#include "netserver.h"
+#include "netclient.h"
+#include "nethistogram.h"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+//STL namespace
+using namespace std;
+
+//net-- namespace
+using net__::netbase;
+using net__::netclient;
+using net__::nethistogram;
+using net__::netpacket;
+using net__::netserver;
+
+//Constants
+const uint16_t defaultPort = 23456;
+const unsigned int defaultSeconds = 2;
+const unsigned int warmupTime = 200;       //ms before measuring
+const size_t headerSize = 4 + 8;           //length, send time
+
+//Message sizes and connection counts to try
+const size_t messageSizes[] = { 16, 256, 4096, 32768 };
+const size_t connectionCounts[] = { 1, 10, 100 };
+
+//Types
+typedef struct {
+    netserver *server;
+} echoServer;
+
+typedef struct {
+    netclient *client;
+    vector<uint8_t> message;    //Length, time, padding
+    nethistogram rtt;           //Round trip nanoseconds
+    uint64_t messages;
+    uint64_t bytes;
+    size_t connected;
+    size_t failed;
+} echoClient;
+
+//Callbacks
+size_t echo_connect( int c, void *cb_data);
+size_t echo_message( netpacket* pkt, void *cb_data);
+size_t client_connect( int c, void *cb_data);
+size_t client_failed( int c, void *cb_data);
+size_t client_message( netpacket* pkt, void *cb_data);
+
+//Send one timestamped message on connection c
+int send_message( echoClient *data, int c);
+
+//Run one size/connection pair, print a result line.  A non-empty *path*
+//  is a Unix socket to connect to instead of *port*.
+bool run_case( netserver& server, uint16_t port, const string& path,
+               size_t size, size_t connections, unsigned int seconds);
+
+//MAIN
+int main (int argc, char *argv[])
+{
+    unsigned int seconds = (argc > 1 ? atoi(argv[1]) : defaultSeconds);
+    uint16_t port = (argc > 2 ? atoi(argv[2]) : defaultPort);
+    string path = (argc > 3 ? argv[3] : "");
+    size_t size_index, count_index;
+
+    //Server echoes everything back, on every connection
+    netserver Server(1000);
+    echoServer server_data = { &Server };
+    Server.setConnectCB( echo_connect, &server_data);
+    if (!path.empty()) {
+        if (Server.openUnix(path) == (sock_t)INVALID_SOCKET) {
+            fprintf(stderr, "Cannot listen on %s\n", path.c_str());
+            return 1;
+        }
+    } else if (Server.openPort(port) == (sock_t)INVALID_SOCKET) {
+        fprintf(stderr, "Cannot listen on port %u\n", port);
+        return 1;
+    }
+
+    printf("%8s %6s %12s %12s %10s %10s %10s %10s\n", "size", "conns",
+        "msgs/s", "MB/s", "p50(us)", "p99(us)", "p999(us)", "max(us)");
+
+    for (size_index = 0;
+         size_index < sizeof(messageSizes) / sizeof(messageSizes[0]);
+         size_index++)
+    {
+        for (count_index = 0;
+             count_index < sizeof(connectionCounts) / sizeof(size_t);
+             count_index++)
+        {
+            if (!run_case( Server, port, path, messageSizes[size_index],
+                           connectionCounts[count_index], seconds))
+            {
+                return 1;
+            }
+        }
+    }
+
+    return 0;
+}
+
+//Connect, warm up, measure, disconnect
+bool run_case( netserver& server, uint16_t port, const string& path,
+               size_t size, size_t connections, unsigned int seconds)
+{
+    netclient Client(connections);
+    echoClient data;
+    vector<sock_t> sockets;
+    vector<sock_t>::const_iterator iter;
+    uint64_t started, stopped;
+    uint32_t length;
+    size_t index;
+
+    data.client = &Client;
+    data.message.resize(size < headerSize ? headerSize : size, 'x');
+    length = (uint32_t)(data.message.size() - 4);
+    memcpy(&data.message[0], &length, sizeof(length));
+    data.messages = data.bytes = 0;
+    data.connected = data.failed = 0;
+
+    Client.setConnectCB( client_connect, &data);
+    Client.setConnectFailCB( client_failed, &data);
+
+    //Open every connection before sending anything
+    for (index = 0; index < connections; index++) {
+        sockets.push_back( path.empty() ?
+                           Client.doConnect("127.0.0.1", port) :
+                           Client.doConnectUnix(path));
+    }
+    while (data.connected + data.failed < connections) {
+        Client.run();
+        server.run();
+    }
+    if (data.failed > 0) {
+        fprintf(stderr, "%u connections failed\n", (unsigned int)data.failed);
+        return false;
+    }
+
+    //Prime each connection with one message
+    for (iter = sockets.begin(); iter != sockets.end(); iter++) {
+        send_message( &data, *iter);
+    }
+
+    //Warm up, then measure
+    started = netbase::getTime();
+    while (netbase::getTime() - started < warmupTime) {
+        Client.run();
+        server.run();
+    }
+    data.rtt.clear();
+    data.messages = data.bytes = 0;
+
+    started = netbase::getNanoTime();
+    stopped = started + (uint64_t)seconds * 1000000000;
+    while (netbase::getNanoTime() < stopped) {
+        Client.run();
+        server.run();
+    }
+    stopped = netbase::getNanoTime();
+
+    double elapsed = (double)(stopped - started) / 1e9;
+    printf("%8u %6u %12.0f %12.2f %10.1f %10.1f %10.1f %10.1f\n",
+        (unsigned int)data.message.size(), (unsigned int)connections,
+        data.messages / elapsed, data.bytes / elapsed / 1e6,
+        data.rtt.percentile(50.0) / 1e3, data.rtt.percentile(99.0) / 1e3,
+        data.rtt.percentile(99.9) / 1e3, data.rtt.getMax() / 1e3);
+    fflush(stdout);
+
+    //Disconnect, and let the server notice
+    for (iter = sockets.begin(); iter != sockets.end(); iter++) {
+        Client.disconnect( *iter);
+    }
+    started = netbase::getTime();
+    while (netbase::getTime() - started < warmupTime) {
+        server.run();
+    }
+
+    return true;
+}
+
+//Send message with the current time in it
+int send_message( echoClient *data, int c)
+{
+    uint64_t now = netbase::getNanoTime();
+    memcpy(&data->message[4], &now, sizeof(now));
+
+    netpacket pkt( data->message.size(), &data->message[0]);
+    pkt.ID = c;
+    return data->client->sendPacket( c, pkt);
+}
+
+//Server side: echo each complete message
+size_t echo_message( netpacket* pkt, void *cb_data)
+{
+    echoServer *data = (echoServer*)cb_data;
+    uint32_t length;
+
+    if (pkt->get_unread() < sizeof(length)) {
+        return 0;
+    }
+    memcpy(&length, pkt->get_read_ptr(), sizeof(length));
+    if (pkt->get_unread() < length + sizeof(length)) {
+        return 0;
+    }
+
+    //Send the same bytes back
+    netpacket echo( length + sizeof(length), (uint8_t*)pkt->get_read_ptr());
+    echo.ID = pkt->ID;
+    data->server->sendPacket( pkt->ID, echo);
+
+    return length + sizeof(length);
+}
+
+//Client side: time the echo, send the next message
+size_t client_message( netpacket* pkt, void *cb_data)
+{
+    echoClient *data = (echoClient*)cb_data;
+    uint32_t length;
+    uint64_t sent;
+
+    if (pkt->get_unread() < headerSize) {
+        return 0;
+    }
+    memcpy(&length, pkt->get_read_ptr(), sizeof(length));
+    if (pkt->get_unread() < length + sizeof(length)) {
+        return 0;
+    }
+    memcpy(&sent, pkt->get_read_ptr() + sizeof(length), sizeof(sent));
+
+    data->rtt.record( netbase::getNanoTime() - sent);
+    data->messages++;
+    data->bytes += length + sizeof(length);
+
+    send_message( data, pkt->ID);
+    return length + sizeof(length);
+}
+
+//Server connection callback
+size_t echo_connect( int c, void *cb_data)
+{
+    echoServer *data = (echoServer*)cb_data;
+    data->server->setConPktCB( c, echo_message, cb_data);
+    return c;
+}
+
+//Client connection callback
+size_t client_connect( int c, void *cb_data)
+{
+    echoClient *data = (echoClient*)cb_data;
+    data->client->setConPktCB( c, client_message, cb_data);
+    data->connected++;
+    return c;
+}
+
+//Client connect failed
+size_t client_failed( int c, void *cb_data)
+{
+    ((echoClient*)cb_data)->failed++;
+    return c;
+}
@@ -0,0 +1,234 @@
+//Microbenchmark for "netpacket" serialization
+//  Times append() and read() for each type, the array versions, and
+//  read_view(), by filling (or reading) a 64KB packet over and over.
+//  Reports ns/op and MB/s for each.
+
+#include "netbase.h"
+#include "netpacket.h"
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+//STL namespace
+using namespace std;
+
+//net-- namespace
+using net__::netbase;
+using net__::netpacket;
+
+//Constants
+const size_t packetSize = 0x10000;         //64KB
+const unsigned int defaultTime = 200;      //ms per case
+
+//Array lengths to try, in elements
+const size_t arrayLengths[] = { 16, 256, 4096 };
+
+//Measure each case for this long
+uint64_t caseTime;
+
+//Keep results live, so the compiler can't drop the loops
+volatile uint64_t sink;
+
+//Print one result line
+void report( const char *op, const char *type, uint64_t ops,
+             uint64_t bytes, uint64_t nanoseconds)
+{
+    printf("%-8s %-16s %10.2f %12.1f\n", op, type,
+        (double)nanoseconds / ops, bytes * 1e3 / nanoseconds);
+}
+
+//Fill the packet with 0x01 bytes, so reads see defined values: true,
+//  small integers, tiny finite floats
+void fill( netpacket& pkt)
+{
+    size_t n;
+
+    pkt.set_write(0);
+    for (n = 0; n < packetSize; n++) {
+        pkt.append((uint8_t)1);
+    }
+}
+
+//Append *value* until the packet is full, repeat until caseTime passes
+template <class T> void bench_append( const char *type, T value)
+{
+    netpacket pkt(packetSize);
+    const size_t count = packetSize / sizeof(T);
+    uint64_t started, elapsed, passes = 0;
+    size_t n;
+
+    started = netbase::getNanoTime();
+    do {
+        pkt.set_write(0);
+        for (n = 0; n < count; n++) {
+            pkt.append(value);
+        }
+        passes++;
+        elapsed = netbase::getNanoTime() - started;
+    } while (elapsed < caseTime);
+    sink += pkt.get_write();
+
+    report("append", type, passes * count, passes * count * sizeof(T),
+        elapsed);
+}
+
+//Read values until the packet is used up, repeat until caseTime passes
+template <class T> void bench_read( const char *type)
+{
+    netpacket pkt(packetSize);
+    const size_t count = packetSize / sizeof(T);
+    uint64_t started, elapsed, passes = 0;
+    uint64_t total = 0;
+    size_t n;
+    T value;
+
+    fill(pkt);
+    started = netbase::getNanoTime();
+    do {
+        pkt.set_read(0);
+        for (n = 0; n < count; n++) {
+            pkt.read(value);
+            total += (uint64_t)value;
+        }
+        passes++;
+        elapsed = netbase::getNanoTime() - started;
+    } while (elapsed < caseTime);
+    sink += total;
+
+    report("read", type, passes * count, passes * count * sizeof(T),
+        elapsed);
+}
+
+//Append arrays of *length* elements until the packet is full
+template <class T> void bench_append_array( const char *type, size_t length)
+{
+    netpacket pkt(packetSize);
+    vector<T> values(length, (T)1);
+    const size_t count = packetSize / (length * sizeof(T));
+    uint64_t started, elapsed, passes = 0;
+    size_t n;
+    char name[32];
+
+    started = netbase::getNanoTime();
+    do {
+        pkt.set_write(0);
+        for (n = 0; n < count; n++) {
+            pkt.append(&values[0], length);
+        }
+        passes++;
+        elapsed = netbase::getNanoTime() - started;
+    } while (elapsed < caseTime);
+    sink += pkt.get_write();
+
+    snprintf(name, sizeof(name), "%s[%u]", type, (unsigned int)length);
+    report("append", name, passes * count,
+        passes * count * length * sizeof(T), elapsed);
+}
+
+//Read arrays of *length* elements until the packet is used up
+template <class T> void bench_read_array( const char *type, size_t length)
+{
+    netpacket pkt(packetSize);
+    vector<T> values(length);
+    const size_t count = packetSize / (length * sizeof(T));
+    uint64_t started, elapsed, passes = 0;
+    uint64_t total = 0;
+    size_t n;
+    char name[32];
+
+    fill(pkt);
+    started = netbase::getNanoTime();
+    do {
+        pkt.set_read(0);
+        for (n = 0; n < count; n++) {
+            pkt.read(&values[0], length);
+            total += (uint64_t)values[0];
+        }
+        passes++;
+        elapsed = netbase::getNanoTime() - started;
+    } while (elapsed < caseTime);
+    sink += total;
+
+    snprintf(name, sizeof(name), "%s[%u]", type, (unsigned int)length);
+    report("read", name, passes * count,
+        passes * count * length * sizeof(T), elapsed);
+}
+
+//Point at arrays of *length* bytes in the packet, with no copy
+void bench_read_view( size_t length)
+{
+    netpacket pkt(packetSize);
+    const uint8_t *view;
+    const size_t count = packetSize / length;
+    uint64_t started, elapsed, passes = 0;
+    uint64_t total = 0;
+    size_t n;
+    char name[32];
+
+    fill(pkt);
+    started = netbase::getNanoTime();
+    do {
+        pkt.set_read(0);
+        for (n = 0; n < count; n++) {
+            pkt.read_view(view, length);
+            total += view[0];
+        }
+        passes++;
+        elapsed = netbase::getNanoTime() - started;
+    } while (elapsed < caseTime);
+    sink += total;
+
+    snprintf(name, sizeof(name), "view[%u]", (unsigned int)length);
+    report("read", name, passes * count, passes * count * length, elapsed);
+}
+
+//MAIN
+int main (int argc, char *argv[])
+{
+    size_t index, length;
+
+    caseTime = (uint64_t)(argc > 1 ? atoi(argv[1]) : defaultTime) * 1000000;
+
+    printf("%-8s %-16s %10s %12s\n", "op", "type", "ns/op", "MB/s");
+
+    //Single values.  int64_t, float and double use the generic templates.
+    bench_append<bool>("bool", true);
+    bench_append<uint8_t>("uint8_t", 1);
+    bench_append<int8_t>("int8_t", -1);
+    bench_append<char>("char", 'x');
+    bench_append<uint16_t>("uint16_t", 1);
+    bench_append<int16_t>("int16_t", -1);
+    bench_append<uint32_t>("uint32_t", 1);
+    bench_append<int32_t>("int32_t", -1);
+    bench_append<int64_t>("int64_t", -1);
+    bench_append<float>("float", 1.5f);
+    bench_append<double>("double", 1.5);
+
+    bench_read<bool>("bool");
+    bench_read<uint8_t>("uint8_t");
+    bench_read<int8_t>("int8_t");
+    bench_read<char>("char");
+    bench_read<uint16_t>("uint16_t");
+    bench_read<int16_t>("int16_t");
+    bench_read<uint32_t>("uint32_t");
+    bench_read<int32_t>("int32_t");
+    bench_read<int64_t>("int64_t");
+    bench_read<float>("float");
+    bench_read<double>("double");
+
+    //Arrays.  uint32_t uses the generic templates, view reads in place.
+    for (index = 0; index < sizeof(arrayLengths) / sizeof(size_t); index++) {
+        length = arrayLengths[index];
+        bench_append_array<char>("char", length);
+        bench_append_array<uint8_t>("uint8_t", length);
+        bench_append_array<uint16_t>("uint16_t", length);
+        bench_append_array<uint32_t>("uint32_t", length);
+        bench_read_array<char>("char", length);
+        bench_read_array<uint8_t>("uint8_t", length);
+        bench_read_array<uint16_t>("uint16_t", length);
+        bench_read_array<uint32_t>("uint32_t", length);
+        bench_read_view( length);
+    }
+
+    return (int)(sink & 0);
+}
@@ -0,0 +1,236 @@
+//Round trip benchmark for "netshm"
+//  A child process connects to its parent through shared memory and sends
+//  a message, waits for the echo and sends again.  Runs spinning and with
+//  eventfd sleeps, and reports round trips/s and round trip percentiles
+//  for each message size.
+
+#include "netshm.h"
+#include "nethistogram.h"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <sys/wait.h>
+
+//STL namespace
+using namespace std;
+
+//net-- namespace
+using net__::netbase;
+using net__::nethistogram;
+using net__::netpacket;
+using net__::netshm;
+
+//Constants
+const char defaultPath[] = "@bench_shm";
+const unsigned int defaultSeconds = 2;
+const unsigned int warmupTime = 200;       //ms before measuring
+const unsigned int sleepTime = 100;        //run() timeout when sleeping
+const size_t headerSize = 4 + 8;           //length, send time
+
+//Message sizes to try
+const size_t messageSizes[] = { 16, 256, 4096, 32768 };
+
+//Types
+typedef struct {
+    netshm *net;
+    vector<uint8_t> message;    //Length, time, padding
+    nethistogram rtt;           //Round trip nanoseconds
+    uint64_t messages;
+    size_t connects;
+    size_t disconnects;
+    bool echo;                  //Parent echoes, child times
+} shmPeer;
+
+//Callbacks
+size_t peer_connect( int c, void *cb_data);
+size_t peer_disconnect( int c, void *cb_data);
+size_t peer_message( netpacket* pkt, void *cb_data);
+
+//Send one timestamped message on connection c
+int send_message( shmPeer *data, int c);
+
+//Child: time round trips of each size, print a line each
+int client( const string& path, unsigned int timeout, unsigned int seconds);
+
+//MAIN
+int main (int argc, char *argv[])
+{
+    unsigned int seconds = (argc > 1 ? atoi(argv[1]) : defaultSeconds);
+    string path = (argc > 2 ? argv[2] : defaultPath);
+    unsigned int timeouts[] = { 0, sleepTime };
+    size_t mode;
+    int status;
+    pid_t pid;
+
+    printf("%6s %8s %12s %10s %10s %10s %10s\n", "mode", "bytes", "trips/s",
+           "p50 us", "p99 us", "p99.9 us", "max us");
+    fflush(stdout);
+
+    for (mode = 0; mode < sizeof(timeouts) / sizeof(timeouts[0]); mode++) {
+        netshm server(4);
+        shmPeer data;
+
+        data.net = &server;
+        data.messages = data.connects = data.disconnects = 0;
+        data.echo = true;
+        server.setConnectCB( peer_connect, &data);
+        server.setDisconnectCB( peer_disconnect, &data);
+        server.setTimeout( timeouts[mode]);
+        if (server.openUnix( path) == (sock_t)INVALID_SOCKET) {
+            fprintf(stderr, "Cannot offer %s: %s\n", path.c_str(),
+                server.lastError.c_str());
+            return 1;
+        }
+
+        pid = fork();
+        if (pid == 0) {
+            _exit(client( path, timeouts[mode], seconds));
+        }
+        if (pid == -1) {
+            fprintf(stderr, "Cannot fork\n");
+            return 1;
+        }
+
+        //Echo until the child is done
+        while (data.disconnects == 0) {
+            server.run();
+        }
+        waitpid(pid, &status, 0);
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+//Both sides read their connection's messages
+size_t peer_connect( int c, void *cb_data)
+{
+    shmPeer *data = (shmPeer*)cb_data;
+
+    data->net->setConPktCB( c, peer_message, cb_data);
+    data->connects++;
+    return c;
+}
+
+//Parent stops when the child goes, child when it cannot connect
+size_t peer_disconnect( int c, void *cb_data)
+{
+    shmPeer *data = (shmPeer*)cb_data;
+
+    data->disconnects++;
+    return c;
+}
+
+//Echo, or record the round trip and send again
+size_t peer_message( netpacket* pkt, void *cb_data)
+{
+    shmPeer *data = (shmPeer*)cb_data;
+    uint32_t length;
+    uint64_t sent;
+
+    if (pkt->get_maxsize() < headerSize) {
+        return 0;
+    }
+    memcpy(&length, pkt->get_ptr(), 4);
+    if (pkt->get_maxsize() < length) {
+        return 0;
+    }
+
+    if (data->echo) {
+        netpacket out( length, (uint8_t*)pkt->get_ptr(), 0);
+        out.set_write(length);
+        data->net->sendPacket( pkt->ID, out);
+    } else {
+        memcpy(&sent, pkt->get_ptr() + 4, 8);
+        data->rtt.record(netbase::getNanoTime() - sent);
+        data->messages++;
+        send_message( data, pkt->ID);
+    }
+
+    return length;
+}
+
+//Stamp the message with the time, send it
+int send_message( shmPeer *data, int c)
+{
+    uint64_t now = netbase::getNanoTime();
+    netpacket pkt( data->message.size(), &data->message[0], 0);
+
+    memcpy(&data->message[4], &now, 8);
+    pkt.set_write(data->message.size());
+    return data->net->sendPacket( (sock_t)c, pkt);
+}
+
+//Child: time round trips of each size, print a line each
+int client( const string& path, unsigned int timeout, unsigned int seconds)
+{
+    netshm net(4);
+    shmPeer data;
+    uint64_t started, stopped;
+    uint32_t length;
+    size_t index;
+    sock_t sd;
+
+    data.net = &net;
+    data.messages = data.connects = data.disconnects = 0;
+    data.echo = false;
+    net.setConnectCB( peer_connect, &data);
+    net.setDisconnectCB( peer_disconnect, &data);
+    net.setConnectFailCB( peer_disconnect, &data);
+    net.setTimeout( timeout);
+
+    //Connected, or failed, once the parent's run() answers
+    sd = net.doConnect( path, 2000);
+    while (sd != (sock_t)INVALID_SOCKET && data.connects == 0 &&
+           data.disconnects == 0)
+    {
+        net.run();
+    }
+    if (data.connects == 0) {
+        fprintf(stderr, "Cannot connect to %s: %s\n", path.c_str(),
+            net.lastError.c_str());
+        return 1;
+    }
+
+    for (index = 0; index < sizeof(messageSizes) / sizeof(messageSizes[0]);
+         index++)
+    {
+        length = (uint32_t)messageSizes[index];
+        data.message.assign(length, 'x');
+        memcpy(&data.message[0], &length, 4);
+
+        //The echo of the last size sends the first of this one
+        if (index == 0) {
+            send_message( &data, sd);
+        }
+
+        //Warm up, then measure
+        started = netbase::getTime();
+        while (netbase::getTime() - started < warmupTime) {
+            net.run();
+        }
+        data.rtt.clear();
+        data.messages = 0;
+
+        started = netbase::getNanoTime();
+        stopped = started + (uint64_t)seconds * 1000000000;
+        while (netbase::getNanoTime() < stopped) {
+            net.run();
+        }
+        stopped = netbase::getNanoTime();
+
+        double elapsed = (double)(stopped - started) / 1e9;
+        printf("%6s %8u %12.0f %10.2f %10.2f %10.2f %10.2f\n",
+            (timeout ? "sleep" : "spin"), (unsigned int)length,
+            data.messages / elapsed,
+            data.rtt.percentile(50.0) / 1e3, data.rtt.percentile(99.0) / 1e3,
+            data.rtt.percentile(99.9) / 1e3, data.rtt.getMax() / 1e3);
+        fflush(stdout);
+    }
+
+    return 0;
+}
@@ -0,0 +1,80 @@
+############################
+# Makefile for Linux (and other POSIX systems with GNU make)
+############################
+# GNU C++ Compiler
+CC=g++
+
+SRCDIR=src
+BUILD=build
+
+#   Your makefile that includes bin.Linux.mak must define these:
+# BIN           binary name
+# SRCFILES      .cpp source file names
+# LIBS          -L(lib path) and -l(library name) for all paths and lib names
+# INCLUDES      -I(include path) for all include paths
+# INSTALL_BIN   What path to install to for "make install"
+#   Optional:
+# LOGFILES      names of log files to clean up with make clean
+# DEBUG         "on" to turn on debugging
+# MOREFLAGS     Add custom flags to object compile phase
+
+LDFLAGS=-lpthread
+
+CPPFLAGS=-D_REENTRANT $(MOREFLAGS) -Wno-deprecated
+
+#Write the headers each object includes to a .d file next to it
+DEPFLAGS=-MMD -MP
+
+#SRC files in SRCDIR directory
+SRC=$(addprefix $(SRCDIR)/, $(SRCFILES))
+
+# Choose object file names from source file names
+OBJFILES=$(SRCFILES:.cpp=.o)
+OBJ=$(addprefix $(BUILD)/, $(OBJFILES))
+DEP=$(OBJ:.o=.d)
+
+# Debug, or optimize
+ifeq ($(DEBUG),on)
+  CFLAGS=-Wall -g -DDEBUG
+else
+  # All warnings, optimization level 3, link time optimization
+  CFLAGS=-Wall -O3 -DNDEBUG -flto
+endif
+
+
+# Default target of make is "all"
+.all: all      
+all: $(BUILD) $(BIN)
+
+#Create build directories if needed
+$(BUILD): 
+	@[ -d $@ ] || mkdir -p $@
+
+# Build object files with chosen options.  Objects are rebuilt when any
+#   header they include changes (from the .d files of the last build).
+$(BUILD)/%.o: $(SRCDIR)/%.cpp
+	$(CC) $(CFLAGS) $(CPPFLAGS) $(DEPFLAGS) $(INCLUDES) -o $@ -c $<
+
+-include $(DEP)
+
+# Build executable from objects and libraries to current directory
+$(BIN): $(OBJ)
+	$(CC) $^ $(CFLAGS) $(LIBS) $(LDFLAGS) -o $@
+
+
+#Create install directories if needed
+$(INSTALL_BIN): 
+	@[ -d $@ ] || mkdir -p $@
+
+install: $(INSTALL_BIN)
+	cp $(BIN) $(INSTALL_BIN)/
+
+#How to uninstall
+uninstall:
+	-rm $(INSTALL_BIN)/$(BIN)
+
+# Remove object files and core files with "clean" (- prevents errors from exiting)
+RM=rm -f
+.clean: clean
+clean:
+	-$(RM) $(BIN) $(OBJ) $(DEP) core $(LOGFILES)
@@ -28,12 +28,16 @@ LDFLAGS=-Wl,--enable-auto-import -mwindows
 #CPPFLAGS=-D_WIN32_WINNT=0x0500 -DWINVER=0x0500 -D_WIN32_IE=0x0601 $(MOREFLAGS)
 CPPFLAGS=$(MOREFLAGS) -Wno-deprecated
 
+#Write the headers each object includes to a .d file next to it
+DEPFLAGS=-MMD -MP
+
 #SRC files in SRCDIR directory
 SRC=$(addprefix $(SRCDIR)/, $(SRCFILES))
 
 # Choose object file names from source file names
 OBJFILES=$(SRCFILES:.cpp=.o)
 OBJ=$(addprefix $(BUILD)/, $(OBJFILES))
+DEP=$(OBJ:.o=.d)
 
 # Debug, or optimize
 ifeq ($(DEBUG),on)
@@ -52,9 +56,12 @@ all: $(BUILD) $(BIN)
 $(BUILD): 
 	@[ -d $@ ] || mkdir -p $@
 
-# Build object files with chosen options
+# Build object files with chosen options.  Objects are rebuilt when any
+#   header they include changes (from the .d files of the last build).
 $(BUILD)/%.o: $(SRCDIR)/%.cpp
-	$(CC) $(CFLAGS) $(CPPFLAGS) $(INCLUDES) -o $@ -c $<
+	$(CC) $(CFLAGS) $(CPPFLAGS) $(DEPFLAGS) $(INCLUDES) -o $@ -c $<
+
+-include $(DEP)
 
 # Build executable from objects and libraries to current directory
 $(BIN): $(OBJ)
@@ -76,4 +83,4 @@ uninstall:
 RM=rm -f
 .clean: clean
 clean:
-	-$(RM) $(BIN) $(OBJ) core $(LOGFILES)
+	-$(RM) $(BIN) $(OBJ) $(DEP) core $(LOGFILES)
@@ -12,3 +12,15 @@ cd ..
 cd test_http
 make $@
 cd ..
+cd bench_echo
+make $@
+cd ..
+cd bench_packet
+make $@
+cd ..
+cd bench_churn
+make $@
+cd ..
+cd bench_dgram
+make $@
+cd ..
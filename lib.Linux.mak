@@ -0,0 +1,114 @@
+############################
+# Makefile for Linux (and other POSIX systems with GNU make)
+############################
+# GNU C++ Compiler
+CC=g++
+
+SRCDIR=src
+BUILD=build
+
+#   Your makefile that includes lib.Linux.mak must define these:
+# BIN           static library name (lib<name>.a)
+# SRCFILES      .cpp source file names
+# HEADERS       .h file names to install
+#   Optional:
+# INCLUDES      -I(include path) for all include paths
+# LOGFILES      names of log files to clean up with make clean
+# DEBUG         "on" to turn on debugging
+# MOREFLAGS     Add custom flags to object compile phase
+
+#Shared library: same name, .so instead of .a
+SONAME=$(BIN:.a=.so)
+
+LDFLAGS=-shared -Wl,-soname,$(SONAME)
+LIBS=-lpthread
+
+CPPFLAGS=-D_REENTRANT $(MOREFLAGS)
+
+#Write the headers each object includes to a .d file next to it
+DEPFLAGS=-MMD -MP
+
+#SRC files in SRCDIR directory
+SRC=$(addprefix $(SRCDIR)/, $(SRCFILES))
+HPP=$(addprefix $(SRCDIR)/, $(HEADERS))
+
+# Choose object file names from source file names.  Shared library objects
+#   are position independent, and built separately.
+OBJFILES=$(SRCFILES:.cpp=.o)
+OBJ=$(addprefix $(BUILD)/, $(OBJFILES))
+PIC=$(addprefix $(BUILD)/pic/, $(OBJFILES))
+DEP=$(OBJ:.o=.d) $(PIC:.o=.d)
+BBIN=$(addprefix $(BUILD)/, $(BIN))
+BSO=$(addprefix $(BUILD)/, $(SONAME))
+
+# Debug, or optimize.  Release objects carry both LTO and regular code, so
+#   programs built without -flto can still link the static library.
+ifeq ($(DEBUG),on)
+  CFLAGS=-Wall -g -DDEBUG
+  AR=ar
+  RANLIB=ranlib
+else
+  # All warnings, optimization level 3, link time optimization
+  CFLAGS=-Wall -O3 -DNDEBUG -flto -ffat-lto-objects
+  AR=gcc-ar
+  RANLIB=gcc-ranlib
+endif
+
+
+# Default target of make is "all"
+.all: all      
+all: $(BUILD)/pic $(BBIN) $(BSO)
+
+#Optimized build, from scratch
+release:
+	$(MAKE) clean
+	$(MAKE) DEBUG=off all
+
+#Create build directories if needed
+$(BUILD)/pic:
+	@[ -d $@ ] || mkdir -p $@
+
+# Build object files with chosen options.  Objects are rebuilt when any
+#   header they include changes (from the .d files of the last build).
+$(BUILD)/%.o: $(SRCDIR)/%.cpp
+	$(CC) $(CFLAGS) $(CPPFLAGS) $(DEPFLAGS) $(INCLUDES) -o $@ -c $<
+
+$(BUILD)/pic/%.o: $(SRCDIR)/%.cpp
+	$(CC) $(CFLAGS) -fPIC $(CPPFLAGS) $(DEPFLAGS) $(INCLUDES) -o $@ -c $<
+
+-include $(DEP)
+
+# Build static library
+$(BBIN): $(OBJ)
+	$(AR) r $@ $^
+	$(RANLIB) $@
+
+# Build shared library
+$(BSO): $(PIC)
+	$(CC) $(CFLAGS) $(LDFLAGS) $^ $(LIBS) -o $@
+
+#Create install directories if needed
+$(INSTALL_LIB): 
+	@[ -d $@ ] || mkdir -p $@
+	
+$(INSTALL_INC):
+	@[ -d $@ ] || mkdir -p $@
+
+UNINSTALL_HPP = $(addprefix $(INSTALL_INC)/, $(HEADERS))
+
+install: $(INSTALL_LIB) $(INSTALL_INC)
+	cp $(BBIN) $(BSO) $(INSTALL_LIB)/
+	cp $(HPP) $(INSTALL_INC)/
+
+#How to uninstall
+uninstall:
+	-$(RM) $(INSTALL_LIB)/$(BIN) $(INSTALL_LIB)/$(SONAME)
+	-$(RM) $(UNINSTALL_HPP)
+
+# Remove object files and core files with "clean" (- prevents errors from exiting)
+RM=rm -f
+.clean: clean
+clean:
+	-$(RM) $(BBIN) $(BSO) $(OBJ) $(PIC) $(DEP) core $(LOGFILES)
+
+.PHONY: all release install uninstall clean
@@ -12,8 +12,11 @@ BUILD=build
 # -Wl,--enable-auto-import: Let the ld.exe linker automatically import from libraries
 LDFLAGS=-mwindows -Wl,--enable-auto-import
 
-#Minimum Windows version: Windows XP, IE 6.01
-CPPFLAGS=-D_WIN32_WINNT=0x0500 -DWINVER=0x0500 -D_WIN32_IE=0x0601 $(MOREFLAGS)
+#Minimum Windows version: Windows XP (getaddrinfo), IE 6.01
+CPPFLAGS=-D_WIN32_WINNT=0x0501 -DWINVER=0x0501 -D_WIN32_IE=0x0601 $(MOREFLAGS)
+
+#Write the headers each object includes to a .d file next to it
+DEPFLAGS=-MMD -MP
 
 #SRC files in SRCDIR directory
 SRC=$(addprefix $(SRCDIR)/, $(SRCFILES))
@@ -22,6 +25,7 @@ HPP=$(addprefix $(SRCDIR)/, $(HEADERS))
 # Choose object file names from source file names
 OBJFILES=$(SRCFILES:.cpp=.o)
 OBJ=$(addprefix $(BUILD)/, $(OBJFILES))
+DEP=$(OBJ:.o=.d)
 BBIN=$(addprefix $(BUILD)/, $(BIN))
 
 # Debug, or optimize
@@ -37,9 +41,12 @@ endif
 .all: all      
 all: $(BBIN) $(LIBBIN)
 
-# Build object files with chosen options
-$(BUILD)/%.o: $(SRCDIR)/%.cpp $(SRCDIR)/%.h
-	$(CC) $(CFLAGS) $(CPPFLAGS) $(INCLUDES) -o $@ -c $<
+# Build object files with chosen options.  Objects are rebuilt when any
+#   header they include changes (from the .d files of the last build).
+$(BUILD)/%.o: $(SRCDIR)/%.cpp
+	$(CC) $(CFLAGS) $(CPPFLAGS) $(DEPFLAGS) $(INCLUDES) -o $@ -c $<
+
+-include $(DEP)
 
 # Build library
 $(BBIN): $(OBJ)
@@ -68,4 +75,4 @@ uninstall:
 RM=rm -f
 .clean: clean
 clean:
-	-$(RM) $(BBIN) $(OBJ) core $(LOGFILES)
+	-$(RM) $(BBIN) $(OBJ) $(DEP) core $(LOGFILES)
@@ -8,10 +8,17 @@
 #include <iostream>
 #include <iomanip>
 
+#include <cerrno>
+#include <cstddef>
+#include <cstring>
+
+#ifndef _WIN32
+    #include <sys/stat.h>
+#endif
+
 //STL namespace
 using std::map;
 using std::pair;
-using std::ofstream;
 using std::string;
 using std::vector;
 using std::set;
@@ -21,38 +28,60 @@ using std::endl;
 using std::hex;
 using std::dec;
 using std::flush;
-using std::ios;
-using std::setfill;
-using std::setw;
 
 //net__ namespace
 using net__::netbase;
 using net__::netpacket;
+using net__::netlog;
+using net__::netstats;
+using net__::netconstats;
+using net__::nethistogram;
+using net__::nethandle;
 
 #ifdef _MSC_VER
 #define snprintf _snprintf_s
 #endif
 
 //Constructor, specify the maximum client connections
-netbase::netbase(size_t max): sdMax(-1), conMax( max),
-    lastMessage(-1),  conCB(connectionCB), disCB(disconnectionCB)            
+netbase::netbase(size_t max): logOpen(false), sdMax(-1), conMax( max),
+    conRecvMode(RECV_CONTIGUOUS),
+    segPool(NETMM_SEGMENT_SIZE, NETMM_SEGMENT_POOL), lastShrink(0),
+    timing(false), conCB(connectionCB), failCB(connectFailCB),
+    disCB(disconnectionCB), writeCB(writableCB), lastTimer(0)
 {
 
     //Assign callback data to this object
     conCBD = this;
+    failCBD = this;
     disCBD = this;
-
-    //Set all buffer pointers in map to null
-    for (size_t sd = 0; sd < NETMM_MAX_SOCKET_DESCRIPTOR; sd++)
-    {
-        conBuffer[sd] = NULL;
-        conBufferIndex[sd] = 0;
-        conBufferLength[sd] = 0;
-        conBufferSize[sd] = 0;
-    }
+    writeCBD = this;
+    pktMap.net = this;
+
+    //Default buffer sizing
+    conPolicy.initialSize = NETMM_INITIAL_BUFFER;
+    conPolicy.maxSize = NETMM_MEMORY_SIZE;
+    conPolicy.minRecv = NETMM_MIN_RECV_SIZE;
+    conPolicy.idleTime = NETMM_IDLE_TIME;
+
+    //Default socket options: send small messages at once
+    conOptions.noDelay = true;
+    conOptions.quickAck = false;
+    conOptions.cork = false;
+    conOptions.recvBuffer = 0;
+    conOptions.sendBuffer = 0;
+    conOptions.notSentLowat = 0;
+    conOptions.keepAliveIdle = 0;
+    conOptions.keepAliveInterval = 0;
+    conOptions.keepAliveCount = 0;
+    conOptions.deferAccept = 0;
 
     //Zero out the socket descriptor set
+#ifndef NETMM_USE_POLL
     FD_ZERO( &sdSet);
+    FD_ZERO( &sdWriteSet);
+#else
+    pollWatches = 0;
+#endif
 
     //Start debug log
     if (!openLog()) {
@@ -70,13 +99,13 @@ netbase::netbase(size_t max): sdMax(-1), conMax( max),
 	WSADATA wsaData;
 	int wsaret = WSAStartup(0x0202, &wsaData); //Request Winsock version 2.2
 	if(wsaret!=0) {
-        debugLog << "Error starting WSA" << endl;
+        NETLOG_ERROR("Error starting WSA");
         return;
     }
     if (wsaData.wVersion != 0x0202)             //Don't accept lower versions
     { // wrong WinSock version!
-        debugLog << "Current winsock version "
-            << hex << wsaData.wVersion << " unsupported" << endl << dec;
+        NETLOG_ERROR("Current winsock version {}.{} unsupported",
+            LOBYTE(wsaData.wVersion), HIBYTE(wsaData.wVersion));
         WSACleanup (); // unload ws2_32.dll
         return;
     }
@@ -92,14 +121,22 @@ netbase::~netbase()
     WSACleanup();
 #endif
 
-    debugLog << "~netbase" << endl;
+    NETLOG_INFO("~netbase");
 
     //Free space from open connections
-    for (size_t sd = 0; sd < NETMM_MAX_SOCKET_DESCRIPTOR; sd++)
+    for (size_t sd = 0; sd < conTable.size(); sd++)
     {
-        if (conBuffer[sd] != NULL) {
-            delete conBuffer[sd];
-            conBuffer[sd] = NULL;
+        if (conTable[sd].buffer != NULL) {
+            delete[] conTable[sd].buffer;
+            conTable[sd].buffer = NULL;
+        }
+        if (conTable[sd].chain != NULL) {
+            delete conTable[sd].chain;
+            conTable[sd].chain = NULL;
+        }
+        if (conTable[sd].sendQueue != NULL) {
+            delete conTable[sd].sendQueue;
+            conTable[sd].sendQueue = NULL;
         }
     }
 }
@@ -143,6 +180,13 @@ void netbase::setConnectCB( connectionFP cbFunc, void *cbData)
     conCBD = cbData;
 }
 
+//Set callback for failed connections
+void netbase::setConnectFailCB( connectionFP cbFunc, void *cbData)
+{
+    failCB = cbFunc;
+    failCBD = cbData;
+}
+
 //Add disconnection callback
 void netbase::setDisconnectCB( connectionFP cbFunc, void *cbData )
 {
@@ -158,6 +202,204 @@ void netbase::removeDisconnectCB()
     disCBD = this;
 }
 
+//Set callback for when a send queue empties
+void netbase::setWritableCB( connectionFP cbFunc, void *cbData )
+{
+    writeCB = cbFunc;
+    writeCBD = cbData;
+}
+
+//Poll a descriptor of another transport with the connections
+bool netbase::watchSocket( sock_t sd, watchFP cbFunc, void *cbData,
+                           bool write)
+{
+    watchEntry entry;
+
+    if (sd == (sock_t)INVALID_SOCKET || cbFunc == NULL || !canTrack(sd)) {
+        NETLOG_WARN("#{} can't be watched", sd);
+        return false;
+    }
+
+    entry.cbFunc = cbFunc;
+    entry.cbData = cbData;
+    entry.write = write;
+    watches[sd] = entry;
+    if (sdMax < sd) {
+        sdMax = sd;
+    }
+
+    return true;
+}
+
+//Stop polling a watched descriptor
+bool netbase::unwatchSocket( sock_t sd)
+{
+    return (watches.erase(sd) != 0);
+}
+
+//Add a timer, fired from run() once *milliseconds* have passed
+size_t netbase::setTimer( unsigned int milliseconds, timerFP cbFunc,
+                          void *cbData)
+{
+    timerEntry entry;
+
+    entry.timerID = ++lastTimer;
+    entry.cbFunc = cbFunc;
+    entry.cbData = cbData;
+
+    timerIndex[entry.timerID] = timers.insert(
+        timerMap::value_type(getTime() + milliseconds, entry));
+
+    return entry.timerID;
+}
+
+//Remove a timer before it fires
+bool netbase::cancelTimer( size_t timerID)
+{
+    std::map< size_t, timerMap::iterator >::iterator iter;
+
+    iter = timerIndex.find(timerID);
+    if (iter == timerIndex.end()) {
+        return false;
+    }
+    timers.erase(iter->second);
+    timerIndex.erase(iter);
+
+    return true;
+}
+
+//Fire due timers.  Timers set by the callbacks wait for the next run().
+int netbase::fireTimers()
+{
+    const uint64_t now = getTime();
+    const size_t newest = lastTimer;
+    timerMap::iterator iter;
+    timerEntry entry;
+    int fired = 0;
+
+    for (iter = timers.begin(); iter != timers.end() && iter->first <= now; ) {
+        if (iter->second.timerID > newest) {
+            iter++;
+            continue;
+        }
+
+        //Forget the timer before calling, the callback may set it again
+        entry = iter->second;
+        timerIndex.erase(entry.timerID);
+        timers.erase(iter);
+
+        entry.cbFunc( entry.timerID, entry.cbData);
+        fired++;
+        stats.timersFired++;
+
+        //Callback may have cancelled other timers
+        iter = timers.begin();
+    }
+
+    return fired;
+}
+
+//Choose buffering for connections made from now on
+void netbase::setRecvMode( recvMode mode)
+{
+    conRecvMode = mode;
+}
+
+//Set buffer sizing policy.  Existing buffers adapt as they grow or idle.
+void netbase::setBufferPolicy( const bufferPolicy& policy)
+{
+    conPolicy = policy;
+
+    //A buffer must at least hold one recv()
+    if (conPolicy.minRecv == 0) {
+        conPolicy.minRecv = 1;
+    }
+    if (conPolicy.initialSize < conPolicy.minRecv) {
+        conPolicy.initialSize = conPolicy.minRecv;
+    }
+    if (conPolicy.maxSize < conPolicy.initialSize) {
+        conPolicy.maxSize = conPolicy.initialSize;
+    }
+}
+
+//Set socket options of later connections
+void netbase::setSocketOptions( const socketOptions& options)
+{
+    conOptions = options;
+}
+
+//Set socket options of *sd* now.  Unix sockets only take buffer sizes.
+bool netbase::setSocketOptions( sock_t sd, const socketOptions& options)
+{
+    struct sockaddr_storage addr;
+    socklen_t length = sizeof(addr);
+    bool tcp, result = true;
+
+    if (sd == (sock_t)INVALID_SOCKET) {
+        return false;
+    }
+    if (getsockname(sd, (struct sockaddr*)&addr, &length) != 0) {
+        NETLOG_WARN("#{} Cannot get socket address", sd);
+        return false;
+    }
+    tcp = (addr.ss_family == AF_INET || addr.ss_family == AF_INET6);
+
+    if (options.recvBuffer > 0) {
+        result &= setOption(sd, SOL_SOCKET, SO_RCVBUF, options.recvBuffer,
+            "SO_RCVBUF");
+    }
+    if (options.sendBuffer > 0) {
+        result &= setOption(sd, SOL_SOCKET, SO_SNDBUF, options.sendBuffer,
+            "SO_SNDBUF");
+    }
+    if (!tcp) {
+        return result;
+    }
+
+    result &= setOption(sd, IPPROTO_TCP, TCP_NODELAY, options.noDelay,
+        "TCP_NODELAY");
+#ifdef TCP_NOTSENT_LOWAT
+    if (options.notSentLowat > 0) {
+        result &= setOption(sd, IPPROTO_TCP, TCP_NOTSENT_LOWAT,
+            options.notSentLowat, "TCP_NOTSENT_LOWAT");
+    }
+#endif
+
+    //Keepalive probes find peers that vanished without a FIN
+    if (options.keepAliveIdle > 0) {
+        result &= setOption(sd, SOL_SOCKET, SO_KEEPALIVE, 1, "SO_KEEPALIVE");
+#ifdef TCP_KEEPIDLE
+        result &= setOption(sd, IPPROTO_TCP, TCP_KEEPIDLE,
+            options.keepAliveIdle, "TCP_KEEPIDLE");
+#endif
+#ifdef TCP_KEEPINTVL
+        if (options.keepAliveInterval > 0) {
+            result &= setOption(sd, IPPROTO_TCP, TCP_KEEPINTVL,
+                options.keepAliveInterval, "TCP_KEEPINTVL");
+        }
+#endif
+#ifdef TCP_KEEPCNT
+        if (options.keepAliveCount > 0) {
+            result &= setOption(sd, IPPROTO_TCP, TCP_KEEPCNT,
+                options.keepAliveCount, "TCP_KEEPCNT");
+        }
+#endif
+    }
+
+    //QUICKACK and CORK are redone on every read and send
+    if (conTable.size() <= (size_t)sd) {
+        conTable.resize(sd + 1);
+    }
+#ifdef TCP_QUICKACK
+    conTable[sd].quickAck = options.quickAck;
+#endif
+#ifdef TCP_CORK
+    conTable[sd].cork = options.cork;
+#endif
+
+    return result;
+}
+
 //Clear the generic and connection specific incoming packet callbacks
 void netbase::unsetAllPktCB()
 {
@@ -171,62 +413,202 @@ void netbase::unsetAllPktCB()
 
 //See if socket is still in connection set
 bool netbase::isClosed(sock_t sd) const {
-    return (conSet.count(sd) == 0);
+    return (sd == (sock_t)INVALID_SOCKET || (size_t)sd >= conTable.size() ||
+            !conTable[sd].live);
+}
+
+//Handle for a connected socket
+nethandle netbase::getHandle( sock_t sd) const
+{
+    if (isClosed(sd)) {
+        return nethandle();
+    }
+    return nethandle( (uint32_t)sd, conTable[sd].generation);
+}
+
+//Socket for a handle, if its connection is still open
+sock_t netbase::getSocket( nethandle h) const
+{
+    if (!isValid(h)) {
+        return (sock_t)INVALID_SOCKET;
+    }
+    return (sock_t)h.index;
+}
+
+//Same descriptor, same connection, still open
+bool netbase::isValid( nethandle h) const
+{
+    return (h.index < conTable.size() && conTable[h.index].live &&
+            conTable[h.index].generation == h.generation);
+}
+
+//Send on a handle's connection
+int netbase::sendPacket( nethandle h, netpacket &msg)
+{
+    if (!isValid(h)) {
+        NETLOG_WARN("#{} stale handle for sendPacket()", h.index);
+        return -1;
+    }
+    return sendPacket( (sock_t)h.index, msg);
+}
+
+//Disconnect a handle's connection
+bool netbase::disconnect( nethandle h)
+{
+    if (!isValid(h)) {
+        NETLOG_WARN("#{} stale handle for disconnect()", h.index);
+        return false;
+    }
+    return disconnect( (sock_t)h.index);
 }
 
+//The connection table grows to fit any socket descriptor.  Windows fd_sets
+//  hold FD_SETSIZE sockets, poll() has no limit of its own.
+bool netbase::canTrack(sock_t sd) const {
+    if (sd == (sock_t)INVALID_SOCKET) {
+        return false;
+    }
+#ifdef NETMM_USE_POLL
+    return true;
+#else
+    return (conSet.size() < FD_SETSIZE);
+#endif
+}
 
-//TODO: non-blocking send!
-//  It should keep one big buffer that is send from asynchronously
 
-//Send packet on a socket descriptor 'sd'.  Waits until send() completes
+//Send packet on a socket descriptor 'sd'.  What send() doesn't take is
+//  queued, and sent by writeSockets() when poll says the socket is writable
 int netbase::sendPacket( sock_t sd, netpacket &msg) {
 
-    int rv, readpos;
     const int length = msg.get_write();
+    netchain *queue;
 
     //Check if connection number exists in conSet
-    if ( conSet.find( sd ) == conSet.end() ) {
-        debugLog << "#" << sd << " socket not found for sendPacket()?" << endl;
+    if ( isClosed( sd) ) {
+        NETLOG_WARN("#{} socket not found for sendPacket()?", sd);
+        return -1;
+    }
+    queue = conTable[sd].sendQueue;
+
+    //The whole message gets queued or sent, never part of it
+    if (queue != NULL && queue->length() + length > conPolicy.maxSize) {
+        NETLOG_ERROR("#{} send queue full, {} bytes waiting", sd,
+            queue->length());
         return -1;
     }
 
 #ifdef DEBUG_PACKET
     debugPacket( &msg);
 #endif
+    stats.messagesOut++;
+    conTable[sd].stats.messagesOut++;
+
+    //Bytes already waiting go first
+    if (queue != NULL && !queue->empty()) {
+        queueBytes(sd, msg.get_ptr(), length);
+        NETLOG_DEBUG("#{} queued {} bytes", sd, length);
+        return length;
+    }
+
+    if (!writeBytes(sd, msg.get_ptr(), length)) {
+        return -1;
+    }
+
+    if (length == 0) {
+        NETLOG_WARN("Warning: No data sent");
+    }
+    
+    return length;
+}
+
+//Send until the socket is full, queue the rest
+bool netbase::writeBytes(sock_t sd, const uint8_t* data, size_t length)
+{
+    size_t readpos;
+    int rv;
 
     //repeat send while (rv > 0 && totalSent < length)
     for ( readpos=0, rv=0; readpos < length; readpos += rv) {
-        rv = send(sd, (const char*)(msg.get_ptr() + readpos), (int)length, 0);
+        rv = send(sd, (const char*)(data + readpos),
+            length - readpos, NETMM_SEND_FLAGS);
+        stats.sendCalls++;
+        conTable[sd].stats.sendCalls++;
         if (rv == SOCKET_ERROR || rv==-1) {
-            debugLog << "#" << sd << " Error:" << getSocketError() << endl;
-            return -1;
+            if (isWouldBlock()) {
+                stats.wouldBlock++;
+                queueBytes(sd, data + readpos, length - readpos);
+                break;
+            }
+            NETLOG_ERROR("#{} Error:{}", sd, getSocketError());
+            return false;
         }
+        stats.bytesOut += rv;
+        conTable[sd].stats.bytesOut += rv;
     }
     
     //Record the message information, how much was sent
-#ifdef DEBUG
-    debugLog << "#" << sd << " sent "
-            << rv << "/" << length << " bytes" << endl;
-#endif
+    NETLOG_DEBUG("#{} sent {}/{} bytes", sd, readpos, length);
+    return true;
+}
 
-    if (rv == 0) {
-        debugLog << "Warning: No data sent" << endl;
-        return 0;
+//Copy bytes to the end of the send queue
+void netbase::queueBytes(sock_t sd, const uint8_t* data, size_t length)
+{
+    uint8_t *bufs[NETMM_SEGMENT_IOV];
+    size_t lens[NETMM_SEGMENT_IOV];
+    size_t count, index, copied;
+
+    if (conTable[sd].sendQueue == NULL) {
+        conTable[sd].sendQueue = new netchain(segPool);
     }
-    if ((size_t)rv < length ) {
-        //TODO: keep a netpacket to be read from on the next send
-        debugLog << "Warning: Send incomplete" << endl;
+
+    while (length > 0) {
+        count = conTable[sd].sendQueue->prepare(bufs, lens, NETMM_SEGMENT_IOV);
+        for (index = 0, copied = 0; index < count && length > 0; index++) {
+            size_t part = (lens[index] < length ? lens[index] : length);
+            memcpy(bufs[index], data, part);
+            data += part;
+            length -= part;
+            copied += part;
+        }
+        conTable[sd].sendQueue->commit(copied);
     }
-    
-    return rv;
+}
+
+//Send from the queue until it is empty or the socket is full.  False if
+//  the connection failed.
+bool netbase::flushQueue(sock_t sd)
+{
+    netchain *queue = conTable[sd].sendQueue;
+    int rv;
+
+    while (queue != NULL && !queue->empty()) {
+        rv = send(sd, (const char*)queue->head(), queue->headLength(),
+            NETMM_SEND_FLAGS);
+        stats.sendCalls++;
+        conTable[sd].stats.sendCalls++;
+        if (rv == SOCKET_ERROR || rv == -1) {
+            if (isWouldBlock()) {
+                stats.wouldBlock++;
+                return true;
+            }
+            NETLOG_ERROR("#{} Error:{}", sd, getSocketError());
+            return false;
+        }
+        stats.bytesOut += rv;
+        conTable[sd].stats.bytesOut += rv;
+        queue->consume(rv);
+    }
+
+    return true;
 }
 
 
 //Setup a socket to be non-blocking and reusable
-int netbase::unblockSocket(sock_t sd) {
+int netbase::unblockSocket(sock_t sd, bool reuse) {
 
     if (sd == (sock_t) INVALID_SOCKET) {
-        debugLog << "Can't unblock an invalid socket" << endl;
+        NETLOG_WARN("Can't unblock an invalid socket");
         return -1;
     }
 
@@ -234,7 +616,7 @@ int netbase::unblockSocket(sock_t sd) {
 #ifdef _WIN32    //Windows
     u_long flags = 1;
     if (ioctlsocket(sd, FIONBIO, &flags) == -1) {
-        debugLog << "FIONBIO error: " << GetLastError() << endl;
+        NETLOG_ERROR("FIONBIO error: {}", GetLastError());
         return -1;
     }
 #else           //Unix
@@ -245,7 +627,7 @@ int netbase::unblockSocket(sock_t sd) {
 #endif
 
     if (fcntl(sd, F_SETFL, flags) == -1) {
-        debugLog << "#" << sd << " Error setting non-blocking socket" << endl;
+        NETLOG_ERROR("#{} Error setting non-blocking socket", sd);
         closeSocket(sd);
         return -1;
     }
@@ -253,28 +635,39 @@ int netbase::unblockSocket(sock_t sd) {
 #endif
 
     //Set socket lingering options (Don't linger... background will handle it).
+#ifdef SO_DONTLINGER
     flags = 1;
     if (setsockopt(sd, SOL_SOCKET, SO_DONTLINGER,
            (char *)&flags, sizeof(flags)) < 0) {
-        debugLog  << "#" << sd << " Error for socket lingering" << endl;
+#else
+    struct linger dontLinger = { 0, 0 };
+    if (setsockopt(sd, SOL_SOCKET, SO_LINGER,
+           (char *)&dontLinger, sizeof(dontLinger)) < 0) {
+#endif
+        NETLOG_ERROR("#{} Error for socket lingering", sd);
         closeSocket(sd);
         return -1;
     }
     
+    if (!reuse) {
+        return 0;
+    }
+    
     // set REUSEADDR / REUSEPORT flags
     flags = 1;
     if (setsockopt(sd, SOL_SOCKET, SO_REUSEADDR,
            (char*) &flags, sizeof(flags)) < 0) {
-        debugLog  << "#" << sd << " Error setting resusable address" << endl;
+        NETLOG_ERROR("#{} Error setting resusable address", sd);
         closeSocket(sd);
         return -1;
     }
 
 #ifdef SO_REUSEPORT
+    //Unix sockets don't have it (EOPNOTSUPP), and don't need it
     flags = 1;
     if (setsockopt(sd, SOL_SOCKET, SO_REUSEPORT,
-        (char*) &flags, sizeof(flags)) < 0) {
-        debugLog << "#" << sd << " Error setting reusable port" << endl;
+        (char*) &flags, sizeof(flags)) < 0 && errno != EOPNOTSUPP) {
+        NETLOG_ERROR("#{} Error setting reusable port", sd);
         closeSocket(sd);
         return -1;
     }
@@ -282,19 +675,85 @@ int netbase::unblockSocket(sock_t sd) {
     return 0;
 }
 
-//This creates an FD_SET from the server socket and all current client sockets
+//Hold back partial segments of *sd* until uncorked
+void netbase::corkSocket(sock_t sd, bool cork)
+{
+#ifdef TCP_CORK
+    setOption(sd, IPPROTO_TCP, TCP_CORK, cork, "TCP_CORK");
+#else
+    (void)sd;
+    (void)cork;
+#endif
+}
+
+//setsockopt() an int value
+bool netbase::setOption(sock_t sd, int level, int name, int value,
+                        const char *what)
+{
+    if (setsockopt(sd, level, name, (char*)&value, sizeof(value)) < 0) {
+        NETLOG_WARN("#{} Cannot set {}: {}", sd, what, getSocketError());
+        return false;
+    }
+    return true;
+}
+
+//This creates an FD_SET (or poll() list) from all current client sockets
 //This must be called before each new "select()" call
 size_t netbase::buildSocketSet()
 {
     std::set<sock_t>::const_iterator iter;
+    std::map<sock_t, watchEntry>::const_iterator watch_iter;
+
+#ifdef NETMM_USE_POLL
+    size_t index = 0;
+    pollSet.resize(conSet.size() + watches.size());
+    for (iter = conSet.begin(); iter != conSet.end(); iter++, index++) {
+        pollSet[index].fd = *iter;
+        pollSet[index].events = POLLIN;
+        pollSet[index].revents = 0;
+        if (conTable[*iter].sendQueue != NULL &&
+            !conTable[*iter].sendQueue->empty())
+        {
+            pollSet[index].events |= POLLOUT;
+        }
+    }
 
+    //Watched descriptors go last.  They aren't connections, so
+    //  readSockets() and writeSockets() pass over them.
+    pollWatches = index;
+    for (watch_iter = watches.begin(); watch_iter != watches.end();
+         watch_iter++, index++)
+    {
+        pollSet[index].fd = watch_iter->first;
+        pollSet[index].events = POLLIN;
+        pollSet[index].revents = 0;
+        if (watch_iter->second.write) {
+            pollSet[index].events |= POLLOUT;
+        }
+    }
+#else
     FD_ZERO( &sdSet );
+    FD_ZERO( &sdWriteSet );
     for (iter = conSet.begin(); iter != conSet.end(); iter++) {
         FD_SET( (unsigned int)(*iter), &sdSet);
+        if (conTable[*iter].sendQueue != NULL &&
+            !conTable[*iter].sendQueue->empty())
+        {
+            FD_SET( (unsigned int)(*iter), &sdWriteSet);
+        }
     }
+    for (watch_iter = watches.begin(); watch_iter != watches.end();
+         watch_iter++)
+    {
+        FD_SET( (unsigned int)watch_iter->first, &sdSet);
+        if (watch_iter->second.write) {
+            FD_SET( (unsigned int)watch_iter->first, &sdWriteSet);
+        }
+    }
+#endif
 
     //Return number of sockets in set
-    return conSet.size();
+    return conSet.size() + watches.size();
 }
 
 
@@ -311,7 +770,7 @@ int netbase::removeSocket(sock_t sd) {
 
     //Check if socket is already closed
     if (sd == (sock_t)INVALID_SOCKET) {
-        debugLog << "Socket already closed" << endl;
+        NETLOG_WARN("Socket already closed");
         return sd;
     }
 
@@ -322,16 +781,20 @@ int netbase::removeSocket(sock_t sd) {
     int rv = close(sd);
 #endif
     if (rv == SOCKET_ERROR) {
-        debugLog << "#" << sd
-            << " Error closing socket: " << getSocketError() << endl;
+        NETLOG_ERROR("#{} Error closing socket: {}", sd, getSocketError());
     }    
 
     //Remove this socket from the list of connected sockets
     //  Should have been done already!
     conSet.erase(sd);
-    if (FD_ISSET((unsigned int)sd, &sdSet)) {
+    if ((size_t)sd < conTable.size()) {
+        conTable[sd].live = false;
+    }
+#ifndef NETMM_USE_POLL
+    if (canTrack(sd) && FD_ISSET((unsigned int)sd, &sdSet)) {
         FD_CLR((unsigned int)sd, &sdSet);
     }
+#endif
     
     return rv;
 }
@@ -339,44 +802,103 @@ int netbase::removeSocket(sock_t sd) {
 //Remember this socket and disconnect it later.  Remove from sdSet and conSet!
 void netbase::pendDisconnect(sock_t sd)
 {
-#ifdef DEBUG
-    debugLog << "#" << sd << " pendDisconnect" << endl;
-#endif
+    NETLOG_DEBUG("#{} pendDisconnect", sd);
 
     //Remove this socket from the list of connected sockets
     conSet.erase(sd);
-    if (FD_ISSET((unsigned int)sd, &sdSet)) {
+    if ((size_t)sd < conTable.size()) {
+        conTable[sd].live = false;
+    }
+#ifndef NETMM_USE_POLL
+    if (canTrack(sd) && FD_ISSET((unsigned int)sd, &sdSet)) {
         FD_CLR((unsigned int)sd, &sdSet);
     }
+#endif
 
     //Remember to free the buffer for this socket later
     closedSocketSet.insert(sd);
 
 }
 
+//Call back watched descriptors that poll() or select() found ready
+void netbase::fireWatches()
+{
+    std::map<sock_t, watchEntry>::iterator watch_iter;
+    vector<sock_t> ready;
+    vector<bool> readable, writable;
+    size_t index;
+
+    //Copy them first, callbacks may unwatch some
+#ifdef NETMM_USE_POLL
+    for (index = pollWatches; index < pollSet.size(); index++) {
+        if (pollSet[index].revents != 0) {
+            ready.push_back(pollSet[index].fd);
+            readable.push_back((pollSet[index].revents & ~POLLOUT) != 0);
+            writable.push_back((pollSet[index].revents & POLLOUT) != 0);
+        }
+    }
+#else
+    for (watch_iter = watches.begin(); watch_iter != watches.end();
+         watch_iter++)
+    {
+        const bool in = FD_ISSET( watch_iter->first, &sdSet);
+        const bool out = (watch_iter->second.write &&
+                          FD_ISSET( watch_iter->first, &sdWriteSet));
+        if (in || out) {
+            ready.push_back(watch_iter->first);
+            readable.push_back(in);
+            writable.push_back(out);
+        }
+    }
+#endif
+
+    for (index = 0; index < ready.size(); index++) {
+        watch_iter = watches.find(ready[index]);
+        if (watch_iter != watches.end()) {
+            watch_iter->second.cbFunc( ready[index], readable[index],
+                writable[index], watch_iter->second.cbData);
+        }
+    }
+}
+
 //Clean up data associated with socket
 void netbase::cleanSocket(sock_t sd) {
 
-#ifdef DEBUG
-    debugLog << "#" << sd << " cleanSocket" << endl;
-#endif
+    NETLOG_DEBUG("#{} cleanSocket", sd);
 
     //Remove the callbacks associated with this socket
     unsetConPktCB(sd);
 
-    //Free the buffer allocated for this socket
-    if (conBuffer[sd] != NULL) {
-        delete conBuffer[sd];
-        conBuffer[sd] = NULL;
-    }
-    
     //Remove this socket from the set of sockets to be closed
     closedSocketSet.erase(sd);
 
+    //Never got a table entry (failed to connect)
+    if (sd == (sock_t)INVALID_SOCKET || (size_t)sd >= conTable.size()) {
+        return;
+    }
+
+    //Free the buffer allocated for this socket
+    if (conTable[sd].buffer != NULL) {
+        delete[] conTable[sd].buffer;
+        conTable[sd].buffer = NULL;
+    }
+    if (conTable[sd].chain != NULL) {
+        delete conTable[sd].chain;
+        conTable[sd].chain = NULL;
+    }
+    if (conTable[sd].sendQueue != NULL) {
+        delete conTable[sd].sendQueue;
+        conTable[sd].sendQueue = NULL;
+    }
+
     //Reset index/length/size pointers
-    conBufferIndex[sd] = 0;
-    conBufferLength[sd] = 0;
-    conBufferSize[sd] = 0;
+    conTable[sd].index = 0;
+    conTable[sd].length = 0;
+    conTable[sd].size = 0;
+    conTable[sd].time = 0;
+    conTable[sd].peak = 0;
+    conTable[sd].quickAck = false;
+    conTable[sd].cork = false;
 }
 
 //Disconnect specific connection
@@ -385,13 +907,13 @@ bool netbase::disconnect( sock_t con) {
     bool result=false;
     
     //If it's not an invalid socket and not closed already
-    if (con != (sock_t)(INVALID_SOCKET) && conSet.count(con) != 0) {
+    if (!isClosed(con)) {
         result = (closeSocket(con) != SOCKET_ERROR);
         char socketNum[8];
         snprintf(socketNum, 8, "%d", con);
-        lastError = lastError + string("; Closing socket #") + socketNum;
+        lastError = string("Closing socket #") + socketNum;
     } else {
-        debugLog << "#" << con << " was already disconnected" << endl;
+        NETLOG_WARN("#{} was already disconnected", con);
     }
     
     //Unset the connection specific callback
@@ -402,104 +924,211 @@ bool netbase::disconnect( sock_t con) {
 
 //Read all incoming data, then fire callbacks
 int netbase::readIncomingSockets() {
+    return readIncomingSockets( pktMap);
+}
+
+//Wait for incoming data, or for room to send queued data
+int netbase::pollSockets() {
 
     int rv=0;
+    uint64_t started = 0;
+    
+    stats.loops++;
     
     //Rebuild the socket set, check for incoming data
     if (buildSocketSet() == 0) {
-        debugLog << "No connections to read" << endl;
+        NETLOG_DEBUG("No connections to read");
         return 0;
     }
     
     //Check socket set for waiting data, until timeout passes
-    rv = select(sdMax+1, &sdSet, (fd_set *) 0, (fd_set *) 0, &timeout);
+    if (timing) {
+        started = getNanoTime();
+    }
+#ifdef NETMM_USE_POLL
+    rv = poll(&pollSet[0], pollSet.size(),
+        (timeout.tv_sec * 1000) + (timeout.tv_usec / 1000));
+#else
+    rv = select(sdMax+1, &sdSet, &sdWriteSet, (fd_set *) 0, &timeout);
+#endif
+    stats.selectCalls++;
+    if (timing) {
+        loopHist[TIME_SELECT].record(getNanoTime() - started);
+    }
 
     if (rv == SOCKET_ERROR) {   //Socket select failed
-        debugLog << "Socket select error:"  << getSocketError() << endl;
-    }
-    else if (rv == 0) {         //No new messages
-        ;//debugLog << "No new server data" << endl;
+        NETLOG_ERROR("Socket select error:{}", getSocketError());
     }
-    else {                      //Something pending on a socket
-        vector<netpacket*> packets = readSockets();
-        rv = fireCallbacks(packets);
+    else if (rv > 0) {
+        writeSockets();
+        if (!watches.empty()) {
+            fireWatches();
+        }
     }
-    //****DEBUG****
-    //cerr << "*";
 
     return rv;
 }
 
+//Send queued data on writable sockets.  Fire the writable callback for
+//  each queue that empties.
+void netbase::writeSockets()
+{
+    vector<sock_t> writable;
+    vector<sock_t>::const_iterator con_iter;
+    sock_t con;
+
+#ifdef NETMM_USE_POLL
+    vector<struct pollfd>::const_iterator poll_iter;
+    for (poll_iter = pollSet.begin(); poll_iter != pollSet.end(); poll_iter++) {
+        if (poll_iter->revents & POLLOUT) {
+            writable.push_back(poll_iter->fd);
+        }
+    }
+#else
+    std::set<sock_t>::const_iterator set_iter;
+    for (set_iter = conSet.begin(); set_iter != conSet.end(); set_iter++) {
+        if (FD_ISSET( *set_iter, &sdWriteSet)) {
+            writable.push_back(*set_iter);
+        }
+    }
+#endif
+
+    for (con_iter = writable.begin(); con_iter != writable.end(); con_iter++) {
+        con = *con_iter;
+        if (isClosed(con)) {
+            continue;
+        }
+        if (conTable[con].cork) {
+            corkSocket( con, true);
+        }
+        if (!flushQueue(con)) {
+            pendDisconnect(con);
+            continue;
+        }
+        if (conTable[con].cork) {
+            corkSocket( con, false);
+        }
+        if (conTable[con].sendQueue->empty()) {
+            NETLOG_DEBUG("#{} send queue empty", con);
+            writeCB( con, writeCBD);
+        }
+    }
+}
+
+//End of one readIncomingSockets() pass
+void netbase::endLoop(uint64_t started)
+{
+    //Give back memory held by idle connections
+    shrinkBuffers();
+
+    if (timing) {
+        loopHist[TIME_LOOP].record(getNanoTime() - started);
+    }
+}
+
 //Check all sockets in sdSet for incoming data, then process callbacks
 vector<netpacket*> netbase::readSockets()
 {
     int rv=0, con=0;
-    std::set<sock_t>::const_iterator con_iter;
+    vector<sock_t>::const_iterator con_iter;
     vector< netpacket * > packets;
     
-    //Copy connection set, as conSet entries may be deleted due to disconnects
-    std::set<sock_t> socketSet = conSet;
+    //Copy ready sockets, as conSet entries may be deleted due to disconnects
+    vector<sock_t> readySet;
+#ifdef NETMM_USE_POLL
+    vector<struct pollfd>::const_iterator poll_iter;
+    for (poll_iter = pollSet.begin(); poll_iter != pollSet.end(); poll_iter++) {
+        if (poll_iter->revents & ~POLLOUT) {
+            readySet.push_back(poll_iter->fd);
+        }
+    }
+#else
+    std::set<sock_t>::const_iterator set_iter;
+    for (set_iter = conSet.begin(); set_iter != conSet.end(); set_iter++) {
+        if (FD_ISSET( *set_iter, &sdSet)) {
+            readySet.push_back(*set_iter);
+        }
+    }
+#endif
 
-    //Check all connections in conSet
-    for (con_iter = socketSet.begin(); con_iter!=socketSet.end(); con_iter++) {
+    //Read each ready connection
+    for (con_iter = readySet.begin(); con_iter!=readySet.end(); con_iter++) {
         con = *con_iter;
-        if (FD_ISSET( con, &sdSet)) {
-          
-            //Get offset in connection buffer
-            size_t bufferOffset = conBufferLength[con];
-
-            //Resize connection buffer, if needed
-            uint8_t* myBuffer=NULL;
-            while (bufferOffset + netbase::NETMM_MAX_RECV_SIZE >
-                    conBufferSize[con])
-            {
-                //Increase connection buffer size
-                conBufferSize[con] = (conBufferSize[con] << 1);
-                
-                //Increase memory allocation
-                if (conBufferSize[con] == 0) {
-                    //Buffer was unallocated... better create one.
-                    conBufferSize[con] = netbase::NETMM_MAX_RECV_SIZE;
-                    conBuffer[con] = new uint8_t[conBufferSize[con]];
-                } else {
-                
-                    //Copy old buffer to bigger buffer
-                    myBuffer = new uint8_t[conBufferSize[con]];
-                    memcpy( myBuffer, conBuffer[con], bufferOffset);
-                    
-                    //Delete old buffer
-                    delete conBuffer[con];
-                    conBuffer[con] = myBuffer;
-                }
-            }
-            
-            //Point to connection buffer
-            myBuffer = conBuffer[con];
 
-            //Copy the incoming bytes to myBuffer + offset
-            rv = recvSocket( con, (myBuffer + bufferOffset) );
+        //Closed by a writable callback
+        if (isClosed(con)) {
+            continue;
+        }
 
-            //Point the packet object at new received bytes
-            if ( rv > 0 ) {
+#ifdef TCP_QUICKACK
+        //The kernel drops out of quick ACK mode on its own, so rearm it
+        if (conTable[con].quickAck) {
+            setOption(con, IPPROTO_TCP, TCP_QUICKACK, 1, "TCP_QUICKACK");
+        }
+#endif
 
-                //Keep track of buffer offsets
-                conBufferLength[con] += rv;
-                
-                //Packet points at unconsumed buffer space
-                netpacket *pkt = makePacket(con,myBuffer + conBufferIndex[con],
-                    conBufferLength[con] - conBufferIndex[con]);
-                
-                //Set connection ID for packet
-                pkt->ID = con;
-                                
-                //Add packet to the queue
+        //Chained connections readv() into pooled segments
+        if (conTable[con].chain == NULL && conTable[con].buffer == NULL &&
+            conRecvMode == RECV_CHAINED)
+        {
+            conTable[con].chain = new netchain(segPool);
+        }
+        if (conTable[con].chain != NULL) {
+            rv = recvChain( con, conTable[con].chain );
+            if ( rv > 0 ) {
+                //Packet points at unconsumed bytes of first segment
+                netpacket *pkt = makePacket(con, conTable[con].chain->head(),
+                    conTable[con].chain->headLength());
                 packets.push_back( pkt);
 
                 //DEBUG
-                debugLog << "#" << con << " Added packet size=" 
-                        << conBufferLength[con] - conBufferIndex[con] << endl;
+                NETLOG_DEBUG("#{} Added packet size={}", con,
+                    conTable[con].chain->length());
+            }
+            continue;
+        }
+      
+        //Read until the socket is drained, growing the buffer as it fills
+        size_t space, received = 0;
+        do {
+            if (!reserveBuffer( con, conPolicy.minRecv)) {
+                pendDisconnect(con);
+                break;
+            }
+            space = conTable[con].size - conTable[con].length;
+
+            //Copy the incoming bytes to buffer + length
+            rv = recvSocket( con, conTable[con].buffer + conTable[con].length,
+                space );
+            if ( rv > 0 ) {
+                conTable[con].length += rv;
+                received += rv;
+            }
+        } while ( rv == (int)space && isReadable(con) );
+
+        //Point the packet object at new received bytes
+        if ( received > 0 ) {
+            size_t unread = conTable[con].length - conTable[con].index;
 
+            //Remember activity and largest pending message
+            conTable[con].time = getTime();
+            if (conTable[con].peak < unread) {
+                conTable[con].peak = unread;
             }
+            
+            //Packet points at unconsumed buffer space
+            netpacket *pkt = makePacket(con,
+                conTable[con].buffer + conTable[con].index, unread);
+            
+            //Set connection ID for packet
+            pkt->ID = con;
+                            
+            //Add packet to the queue
+            packets.push_back( pkt);
+
+            //DEBUG
+            NETLOG_DEBUG("#{} Added packet size={}", con, unread);
+
         }
     }
 
@@ -508,146 +1137,414 @@ vector<netpacket*> netbase::readSockets()
 
 //Fire associated callbacks for the list of netpackets
 int netbase::fireCallbacks( vector<netpacket*>& packets) {
-  
-    //All pending data has been read, fire incoming data callbacks now
-    vector< netpacket * >::iterator pkt_iter;
+    return fireCallbacks( pktMap, packets);
+}
+
+//Find the connection specific callback, and run it
+size_t netbase::pktCallbacks::onData( sock_t con, netpacket *pkt)
+{
     map< sock_t, netpacket::netPktCB >::const_iterator cb_iter;
     map< sock_t, void* >::const_iterator cbd_iter;
-    netpacket::netPktCB callback;
-    void *cbData;
+    void *cbData = NULL;
 
-    size_t bytes_read;
-    sock_t con;
-    
-    //For each packet on the list
-    for (pkt_iter = packets.begin(); pkt_iter != packets.end(); pkt_iter++) {
-
-        //Packet pointer
-        netpacket *pkt = *pkt_iter;
-        if (pkt == NULL) {
-            debugLog << "NULL packet in my queue??" << endl;
-            continue;
-        }
+    //Connection specific callback data
+    cbd_iter = net->packetCBD_map.find( con );
+    if (cbd_iter != net->packetCBD_map.end()) {
+        cbData = cbd_iter->second;
+    }
 
-        //Get connection ID from packet (I hope we added it earlier!)
-        con = pkt->ID;
-        
-        //Connection specific callback data
-        cbd_iter = packetCBD_map.find( con );
-        if (cbd_iter == packetCBD_map.end()) {
-            cbData = NULL;
-        } else {
-            cbData = cbd_iter->second;
-        };
-        
-        //Find connection specific callback
-        cb_iter = packetCB_map.find( con );
-        
-        //Run connection specific callback, if exists
-        if ( cb_iter != packetCB_map.end()) {
-            callback = cb_iter->second;
-
-            //Keep running callback until no more bytes are read(?)
-            do {
-                bytes_read = callback( pkt, cbData);
-                conBufferIndex[con] += bytes_read;
-#ifdef DEBUG
-                debugLog << "#" << con << " bytes_read=" << bytes_read
-                    << " index=" << conBufferIndex[con] << " length="
-                    << conBufferLength[con] << endl;
-#endif
-                //Reset buffer if all data has been consumed
-                if (conBufferIndex[con] == conBufferLength[con]) {
-                    conBufferIndex[con] = 0;
-                    conBufferLength[con] = 0;
-                } else if (conBufferLength[con] < conBufferIndex[con]) {
-                    //Index should never go past length.
-                    debugLog << "#" << con
-                        << " ERROR! Read past end of packet "
-                        << conBufferIndex[con] << "/" << conBufferLength[con]
-                        << endl;
-                    cerr << "#" << con << " ERROR! Read past end of packet "
-                        << conBufferIndex[con] << "/" << conBufferLength[con]
-                        << endl;
-                    cerr << "bytes_read=" << bytes_read << " Index was "
-                        << (int)(conBufferIndex[con] - bytes_read)
-                        << " first byte=0x" << hex
-                        << (int)(conBuffer[(conBufferIndex[con] - bytes_read)])
-                        << dec << endl;
-                    
-                    //Set index back to max length and quit
-                    conBufferIndex[con] = conBufferLength[con];
-                } else if (bytes_read > 0) {
-                    //Make a new packet, run the callback again.
-                    //  There may be more messages after the single one read in
-                    delete pkt;
-                    pkt = makePacket(con,
-                        conBuffer[con] + conBufferIndex[con],
-                        conBufferLength[con] - conBufferIndex[con]);
-                    pkt->ID = con;
-                    *pkt_iter = pkt;
-                }
-                //cerr << "-";
-            } while (bytes_read > 0 &&
-                conBufferIndex[con] < conBufferLength[con]);
-        } else {
-            debugLog << "#" << con << " no connection callback!" << endl;
-        }
+    cb_iter = net->packetCB_map.find( con );
+    if (cb_iter == net->packetCB_map.end()) {
+        NETLOG_WARN("#{} no connection callback!", con);
+        return 0;
     }
 
-    //Handle disconnected sockets
-    //  (this can happen immediately after receiving bytes)
+    return cb_iter->second( pkt, cbData);
+}
+
+//Handle disconnected sockets
+void netbase::fireDisconnects()
+{
     set<sock_t>::const_iterator con_iter;
     set<sock_t> closedSocketCopy( closedSocketSet );
+    sock_t con;
+
     for (con_iter = closedSocketCopy.begin();
          con_iter != closedSocketCopy.end();
          con_iter++)
     {
-
-
         con = *con_iter;
-        debugLog << "#" << con << " disconnect callback" << endl;
+        NETLOG_INFO("#{} disconnect callback", con);
 
         //Disconnection callback
         disCB( con, disCBD);
+        stats.disconnects++;
         
         //Actually close the socket, and clean up associated data
         closeSocket(con);
     }
+}
+
+netpacket* netbase::consumePacket( netpacket* pkt, size_t bytes_read)
+{
+    sock_t con = pkt->ID;
+    netchain *chain = conTable[con].chain;
+
+    //Chained buffer: segments are released as they are consumed
+    if (chain != NULL) {
+        chain->consume(bytes_read);
+        NETLOG_DEBUG("#{} bytes_read={} unread={}", con, bytes_read,
+            chain->length());
+        if (chain->empty()) {
+            return NULL;
+        }
+
+        //Nothing consumed: the message may straddle segments, join them.
+        //  Leave as much room again for the rest of it, up to maxSize.
+        if (bytes_read == 0) {
+            size_t space = 0;
+            if (chain->length() < conPolicy.maxSize) {
+                space = conPolicy.maxSize - chain->length();
+            }
+            if (space > chain->length()) {
+                space = chain->length();
+            }
+            if (pkt->get_maxsize() < chain->length() &&
+                chain->linearize(space))
+            {
+                return makePacket(con, chain->head(), chain->headLength());
+            }
+            return NULL;
+        }
 
+        return makePacket(con, chain->head(), chain->headLength());
+    }
 
-    //Delete packets created by makePacket() in readSockets().
-    //  Create list of connections with unread data
-    for (pkt_iter = packets.begin(); pkt_iter != packets.end(); pkt_iter++) {
-        delete (*pkt_iter);
+    conTable[con].index += bytes_read;
+    NETLOG_DEBUG("#{} bytes_read={} index={} length={}", con, bytes_read,
+        conTable[con].index, conTable[con].length);
+    //Reset buffer if all data has been consumed
+    if (conTable[con].index == conTable[con].length) {
+        conTable[con].index = 0;
+        conTable[con].length = 0;
+    } else if (conTable[con].length < conTable[con].index) {
+        //Index should never go past length.
+        NETLOG_ERROR("#{} ERROR! Read past end of packet {}/{}", con,
+            conTable[con].index, conTable[con].length);
+        cerr << "#" << con << " ERROR! Read past end of packet "
+            << conTable[con].index << "/" << conTable[con].length
+            << endl;
+        cerr << "bytes_read=" << bytes_read << " Index was "
+            << (int)(conTable[con].index - bytes_read)
+            << " first byte=0x" << hex
+            << (int)(conTable[con].buffer[conTable[con].index - bytes_read])
+            << dec << endl;
+
+        //Set index back to max length and quit
+        conTable[con].index = conTable[con].length;
+    } else if (bytes_read > 0) {
+        //Point a new packet at the remaining bytes
+        return makePacket(con,
+            conTable[con].buffer + conTable[con].index,
+            conTable[con].length - conTable[con].index);
     }
-      
-    //Return number of packets processed (not total size)
-    return (int)(packets.size());
+
+    return NULL;
 }
 
-//Recieve incoming data on a buffer, return the number of bytes read in
-//Check if socket is closed after receiving
-int netbase::recvSocket(sock_t sd, uint8_t* buffer)
+//Receive incoming data into a segment chain, return the number of bytes read
+//  Only asks the socket for more when every prepared segment was filled
+int netbase::recvChain(sock_t sd, netchain* chain)
 {
-    int rv, rs;
+    uint8_t* bufs[NETMM_SEGMENT_IOV];
+    size_t lens[NETMM_SEGMENT_IOV];
+#ifdef _WIN32
+    WSABUF iov[NETMM_SEGMENT_IOV];
+    DWORD received, flags;
+#else
+    struct iovec iov[NETMM_SEGMENT_IOV];
+#endif
+    size_t count, index, space, limit;
+    int rv;
     int offset = 0;
 
+    do {
+        //Unread bytes are held to maxSize, as in a contiguous buffer
+        if (chain->length() + conPolicy.minRecv > conPolicy.maxSize) {
+            NETLOG_WARN("#{} chain would exceed {} bytes", sd,
+                conPolicy.maxSize);
+            pendDisconnect(sd);
+            return (offset > 0 ? offset : -1);
+        }
+        limit = conPolicy.maxSize - chain->length();
+
+        //Point the vector at free space in the chain
+        count = chain->prepare( bufs, lens, NETMM_SEGMENT_IOV);
+        for (index = 0, space = 0; index < count; index++) {
+            if (lens[index] > limit - space) {
+                lens[index] = limit - space;
+            }
+#ifdef _WIN32
+            iov[index].buf = (char*)bufs[index];
+            iov[index].len = (u_long)lens[index];
+#else
+            iov[index].iov_base = bufs[index];
+            iov[index].iov_len = lens[index];
+#endif
+            space += lens[index];
+        }
+
+        //Read incoming bytes into the segments
+#ifdef _WIN32
+        flags = 0;
+        rv = WSARecv( sd, iov, (DWORD)count, &received, &flags, NULL, NULL);
+        if (rv != SOCKET_ERROR) {
+            rv = (int)received;
+        }
+#else
+        rv = readv( sd, iov, (int)count);
+#endif
+        stats.recvCalls++;
+        conTable[sd].stats.recvCalls++;
+        chain->commit( rv > 0 ? rv : 0 );
+
+        if (rv == 0) {
+            NETLOG_INFO("#{} disconnected from us", sd);
+            pendDisconnect(sd);
+            break;
+        }
+
+        //Nothing there after all
+        if (rv == SOCKET_ERROR && isWouldBlock()) {
+            stats.wouldBlock++;
+            break;
+        }
+
+        if (rv == SOCKET_ERROR) {
+            NETLOG_ERROR("#{} readv Error: {}", sd, getSocketError());
+            pendDisconnect(sd);
+            //Still deliver anything received before the error
+            return (offset > 0 ? offset : -1);
+        }
+
+        NETLOG_DEBUG("#{} readv {}/{} bytes in {} segments", sd, rv, space,
+            count);
+        offset += rv;
+        stats.bytesIn += rv;
+        conTable[sd].stats.bytesIn += rv;
+
+        //Segments were all filled, see if there is more to read
+    } while ((size_t)rv == space && isReadable(sd));
+
+    return offset;
+}
+
+//Next generation of *sd*, growing the table to cover it
+void netbase::newGeneration(sock_t sd)
+{
+    if (conTable.size() <= (size_t)sd) {
+        conTable.resize(sd + 1);
+    }
+
+    //New connection on this descriptor: old handles no longer match
+    conTable[sd].generation++;
+    if (conTable[sd].generation == 0) {
+        conTable[sd].generation = 1;
+    }
+}
+
+//Allocate receive buffer for a new connection, according to conRecvMode
+void netbase::allocBuffer(sock_t sd, bool stamp)
+{
+    if (stamp || conTable.size() <= (size_t)sd) {
+        newGeneration(sd);
+    }
+    conTable[sd].live = true;
+
+    //Fresh counters for the connection
+    conTable[sd].stats.clear();
+    conTable[sd].stats.connectTime = getTime();
+
+    if (conRecvMode == RECV_CHAINED) {
+        conTable[sd].chain = new netchain(segPool);
+        return;
+    }
+
+    //Contiguous buffer is allocated when the first bytes arrive
+    conTable[sd].buffer = NULL;
+    conTable[sd].index = 0;
+    conTable[sd].length = 0;
+    conTable[sd].size = 0;
+    conTable[sd].time = getTime();
+    conTable[sd].peak = 0;
+}
+
+//Make sure connection buffer has *space* free bytes after its length.
+//  Unread bytes are moved to the front first, then the buffer is doubled.
+bool netbase::reserveBuffer(sock_t sd, size_t space)
+{
+    size_t unread = conTable[sd].length - conTable[sd].index;
+    size_t size;
+    uint8_t *myBuffer;
+
+    //Enough room already
+    if (conTable[sd].buffer != NULL &&
+        conTable[sd].length + space <= conTable[sd].size)
+    {
+        return true;
+    }
+
+    //Move unread bytes to the front, if that makes enough room
+    if (conTable[sd].buffer != NULL && unread + space <= conTable[sd].size) {
+        memmove( conTable[sd].buffer, conTable[sd].buffer + conTable[sd].index, unread);
+        conTable[sd].index = 0;
+        conTable[sd].length = unread;
+        return true;
+    }
+
+    //New size: start from what this connection has needed before
+    size = conPolicy.initialSize;
+    if (size < conTable[sd].size) {
+        size = conTable[sd].size;
+    }
+    while (size < conTable[sd].peak || size < unread + space) {
+        size = (size << 1);
+    }
+    if (size > conPolicy.maxSize) {
+        size = conPolicy.maxSize;
+    }
+    if (size < unread + space) {
+        NETLOG_WARN("#{} buffer would exceed {} bytes", sd, conPolicy.maxSize);
+        return false;
+    }
+
+    //Copy unread bytes to the new buffer
+    myBuffer = new uint8_t[size];
+    if (conTable[sd].buffer != NULL) {
+        memcpy( myBuffer, conTable[sd].buffer + conTable[sd].index, unread);
+        delete[] conTable[sd].buffer;
+    }
+    conTable[sd].buffer = myBuffer;
+    conTable[sd].index = 0;
+    conTable[sd].length = unread;
+    conTable[sd].size = size;
+    stats.bufferGrowths++;
+
+    NETLOG_DEBUG("#{} buffer size={}", sd, size);
+    return true;
+}
+
+//Free empty buffers of idle connections, shrink the others to fit
+void netbase::shrinkBuffers()
+{
+    std::set<sock_t>::const_iterator con_iter;
+    uint64_t now;
+    size_t unread, size;
+    sock_t con;
+    uint8_t *myBuffer;
+
+    //Scan at most twice per idle period
+    if (conPolicy.idleTime == 0) {
+        return;
+    }
+    now = getTime();
+    if (now - lastShrink < (conPolicy.idleTime >> 1)) {
+        return;
+    }
+    lastShrink = now;
+
+    for (con_iter = conSet.begin(); con_iter != conSet.end(); con_iter++) {
+        con = *con_iter;
+        if (conTable[con].buffer == NULL ||
+            now - conTable[con].time < conPolicy.idleTime)
+        {
+            continue;
+        }
+
+        //Forget about old peaks slowly
+        conTable[con].peak = (conTable[con].peak >> 1);
+        conTable[con].time = now;
+
+        //Nothing buffered: free it, it's allocated again on next recv
+        unread = conTable[con].length - conTable[con].index;
+        if (unread == 0) {
+            delete[] conTable[con].buffer;
+            conTable[con].buffer = NULL;
+            conTable[con].index = 0;
+            conTable[con].length = 0;
+            conTable[con].size = 0;
+            stats.bufferShrinks++;
+            continue;
+        }
+
+        //Partial message: smallest buffer that still holds it
+        size = conPolicy.initialSize;
+        while (size < unread + conPolicy.minRecv) {
+            size = (size << 1);
+        }
+        if (size >= conTable[con].size) {
+            continue;
+        }
+        myBuffer = new uint8_t[size];
+        memcpy( myBuffer, conTable[con].buffer + conTable[con].index, unread);
+        delete[] conTable[con].buffer;
+        conTable[con].buffer = myBuffer;
+        conTable[con].index = 0;
+        conTable[con].length = unread;
+        conTable[con].size = size;
+        stats.bufferShrinks++;
+    }
+}
+
+//Check one socket for waiting data, without blocking
+bool netbase::isReadable(sock_t sd)
+{
+    int rs;
+
+#ifdef NETMM_USE_POLL
+    struct pollfd sdPoll;
+    sdPoll.fd = sd;
+    sdPoll.events = POLLIN;
+    sdPoll.revents = 0;
+    rs = poll(&sdPoll, 1, 0);
+#else
     //Create FD_SET that has only this socket
-    fd_set sds, sds2;
+    fd_set sds;
     FD_ZERO(&sds);
     FD_SET((unsigned int)sd, &sds);
 
+    //FIRST argument is highest socket descriptor + 1
+    //SECOND argument is FD_SET containing socket(s) to read
+    //THIRD argument is FD_SET containing socket(s) to write
+    //FOURTH argument is FD_SET containing out-of-band socket data
+    //FIFTH argument is timeout until select stops blocking
+    rs = select(sd+1, &sds, NULL, NULL, &timeout);
+#endif
+    stats.selectCalls++;
+
+    if (rs == SOCKET_ERROR) {   //Socket select failed
+        NETLOG_ERROR("select() error:{}", getSocketError());
+    }
+    return (rs > 0);
+}
+
+//Recieve incoming data on a buffer, return the number of bytes read in
+//Check if socket is closed after receiving
+int netbase::recvSocket(sock_t sd, uint8_t* buffer, size_t size)
+{
+    int rv;
+    size_t offset = 0;
+
     do {
         //Read incoming bytes to buffer
-        rv = recv( sd, (char*)(buffer + offset), NETMM_MAX_RECV_SIZE,  0 );
+        rv = recv( sd, (char*)(buffer + offset), (int)(size - offset),  0 );
+        stats.recvCalls++;
+        conTable[sd].stats.recvCalls++;
     
         if (rv == 0) {
-#ifdef DEBUG
-            debugLog << "#" << sd << " disconnected from us" << endl;
-#endif
+            NETLOG_INFO("#{} disconnected from us", sd);
             pendDisconnect(sd);
-            rs=0;   //Disconnected, nothing more to receive...
+            //Disconnected, nothing more to receive...
             //If we got anything on an earlier loop iteration,
             //  we will need to process it.
             break;
@@ -657,46 +1554,39 @@ int netbase::recvSocket(sock_t sd, uint8_t* buffer)
         //      since we are lazy
         #ifdef _WIN32
         if (WSAGetLastError() == WSAECONNRESET) {
-            debugLog << "#" << sd << " reset" << endl;
+            NETLOG_DEBUG("#{} reset", sd);
             pendDisconnect(sd);
-            return 0;
+            return (int)offset;
         }
         #endif
         
+        //Nothing there after all
+        if (rv == SOCKET_ERROR && isWouldBlock()) {
+            stats.wouldBlock++;
+            break;
+        }
+        
         if (rv == SOCKET_ERROR) {
-            debugLog << "#" << sd << " recv Error: "<< getSocketError()<< endl;
+            NETLOG_ERROR("#{} recv Error: {}", sd, getSocketError());
             pendDisconnect(sd);
-            return -1;
+            //Still deliver anything received before the error
+            return (offset > 0 ? (int)offset : -1);
         }
     
         //rv was not 0 or SOCKET_ERROR, so it's the number of bytes received.
-#ifdef DEBUG
-        debugLog << "#" << sd << " recv " << rv << " bytes" << endl;
-#endif
+        NETLOG_DEBUG("#{} recv {} bytes", sd, rv);
         offset += rv;
+        stats.bytesIn += rv;
+        conTable[sd].stats.bytesIn += rv;
 
-        //See if there is more to read
-        sds2 = sds;
-        
-        //FIRST argument is highest socket descriptor + 1
-        //SECOND argument is FD_SET containing socket(s) to read
-        //THIRD argument is FD_SET containing socket(s) to write
-        //FOURTH argument is FD_SET containing out-of-band socket data
-        //FIFTH argument is timeout until select stops blocking
-        rs = select(sd+1, &sds2, NULL, NULL, &timeout); 
-        
-        if (rs == SOCKET_ERROR) {   //Socket select failed
-            debugLog << "select() error:"  << getSocketError() << endl;
-        }
-    } while (rs > 0);  //Keep reading if select says there's something here
+    //Keep reading while there is room, and select says there's something here
+    } while (offset < size && isReadable(sd));
     
     if (offset > 0) {
-#ifdef DEBUG
-        debugLog << "#" << sd << " Received " << offset << " bytes" << endl;
-#endif
+        NETLOG_DEBUG("#{} Received {} bytes", sd, offset);
     }
 
-    return offset;  //Return total number of bytes received
+    return (int)offset;  //Return total number of bytes received
 }
 
 //Default functions for function pointers.  Your replacement must return
@@ -716,8 +1606,7 @@ size_t netbase::incomingCB( netpacket* pkt, void *CBD) {
         std::cerr << "Null callback data on incomingCB!" << endl;
         std::cerr << "Packet on #" << pkt->ID << endl;
     } else {
-        ((netbase*)CBD)->debugLog << "#" << pkt->ID << " maxsize="
-            << pkt->get_maxsize() << endl;
+        NETLOG_DEBUG("#{} maxsize={}", pkt->ID, pkt->get_maxsize());
     }
 #endif
 
@@ -733,7 +1622,7 @@ size_t netbase::connectionCB( sock_t con, void *CBD) {
         std::cerr << "Null callback data on connectionCB!" << endl;
         std::cerr << "New connection #" << con << endl;
     } else {
-        ((netbase*)CBD)->debugLog << "#" << con << " connected" << endl;
+        NETLOG_INFO("#{} connected", con);
     }
 #endif
     return con;
@@ -746,10 +1635,30 @@ size_t netbase::disconnectionCB( sock_t con, void *CBD) {
         std::cerr << "Null callback data on disconnectionCB!" << endl;
         std::cerr << "Dropped connection #" << con << endl;
     } else {
-        ((netbase*)CBD)->debugLog << "#" << con << " disconnectCB" << endl;
+        NETLOG_INFO("#{} disconnectCB", con);
+    }
+#endif
+    return con;
+};
+
+//Default connect failed callback
+size_t netbase::connectFailCB( sock_t con, void *CBD)
+{
+#ifdef DEBUG
+    if ( CBD == NULL) {
+        std::cerr << "Null callback data on connectFailCB!" << endl;
+        std::cerr << "Failed connection #" << con << endl;
+    } else {
+        NETLOG_DEBUG("#{} connectFailCB", con);
     }
 #endif
     return con;
+}
+
+//Default send queue empty callback
+size_t netbase::writableCB( sock_t con, void *CBD) {
+    NETLOG_DEBUG("#{} writable", con);
+    return con;
 };
 
 
@@ -759,27 +1668,34 @@ void netbase::debugBuffer( uint8_t* buffer, size_t buflen) const
     //int byte, width=16;
     size_t byte, width=16;
     uint16_t curr_word;
+    char word[8];
+    string line;
 
-    debugLog << "::: Buffer contents ::: " << endl << hex;
+    NETLOG_DEBUG("::: Buffer contents ::: ");
 
-    //Dump the buffer contents
-    for (byte = 0; byte < buflen - 1; byte += 2) {
+    //Dump the buffer contents, one log record per line
+    for (byte = 0; byte + 1 < buflen; byte += 2) {
 
         memcpy( &curr_word, (buffer + byte), sizeof(curr_word));
-        debugLog << "0x" << setfill('0') << setw(4) << curr_word;
+        snprintf( word, 8, "0x%04x", curr_word);
+        line += word;
 
-        if ((byte % width ) == (width - 2))
-            debugLog << endl;
-        else
-            debugLog << " ";
+        if ((byte % width ) == (width - 2)) {
+            NETLOG_DEBUG("{}", line);
+            line.clear();
+        } else {
+            line += " ";
+        }
     }
 
     //If it is off a word boundary, dump the last byte
-    if (byte == buflen - 1)
-        debugLog << " 0x" << hex << setw(2) << (uint16_t)buffer[byte] << dec;
+    if (byte + 1 == buflen) {
+        snprintf( word, 8, " 0x%02x", buffer[byte]);
+        line += word;
+    }
 
-    if ( (byte % width) > 0)
-        debugLog << endl;
+    if ( !line.empty())
+        NETLOG_DEBUG("{}", line);
 }
 
 //New packet object, pointing at the data in a connectin-specific buffer
@@ -794,6 +1710,321 @@ netpacket *netbase::makePacket( sock_t con, uint8_t *buffer, size_t pkt_size)
     return result;
 }
 
+//Milliseconds since some fixed point, for measuring intervals
+uint64_t netbase::getTime()
+{
+#ifdef _WIN32
+    return (uint64_t)GetTickCount();
+#else
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return ((uint64_t)now.tv_sec * 1000) + (now.tv_nsec / 1000000);
+#endif
+}
+
+//Nanoseconds from a monotonic clock
+uint64_t netbase::getNanoTime()
+{
+#ifdef _WIN32
+    LARGE_INTEGER now, frequency;
+    QueryPerformanceCounter(&now);
+    QueryPerformanceFrequency(&frequency);
+    return (uint64_t)((double)now.QuadPart * 1e9 / (double)frequency.QuadPart);
+#else
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return ((uint64_t)now.tv_sec * 1000000000) + now.tv_nsec;
+#endif
+}
+
+//Did the last socket call fail only because it would block?
+bool netbase::isWouldBlock()
+{
+#ifdef _WIN32
+    return (WSAGetLastError() == WSAEWOULDBLOCK);
+#else
+    return (errno == EAGAIN || errno == EWOULDBLOCK);
+#endif
+}
+
+#ifndef _WIN32
+//Abstract names start with a 0 byte, and aren't 0 terminated
+socklen_t netbase::unixAddress( const string& path, struct sockaddr_un& addr)
+{
+    const size_t header = offsetof(struct sockaddr_un, sun_path);
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (path.empty() || path.size() >= sizeof(addr.sun_path)) {
+        NETLOG_ERROR("Bad Unix socket path {}", path);
+        return 0;
+    }
+
+    if (path[0] == '@') {
+#ifdef __linux__
+        memcpy(addr.sun_path + 1, path.c_str() + 1, path.size() - 1);
+        return (socklen_t)(header + path.size());
+#else
+        NETLOG_ERROR("No abstract Unix sockets here: {}", path);
+        return 0;
+#endif
+    }
+
+    memcpy(addr.sun_path, path.c_str(), path.size());
+    return (socklen_t)(header + path.size() + 1);
+}
+
+//Unnamed sockets (the client end, usually) have an empty path
+string netbase::unixPath( const struct sockaddr_un* addr, socklen_t length)
+{
+    const size_t header = offsetof(struct sockaddr_un, sun_path);
+    size_t size;
+
+    if (length <= header) {
+        return string();
+    }
+    size = length - header;
+    if (size > sizeof(addr->sun_path)) {
+        size = sizeof(addr->sun_path);
+    }
+
+    if (addr->sun_path[0] == '\0') {
+        return "@" + string(addr->sun_path + 1, size - 1);
+    }
+    return string(addr->sun_path, strnlen(addr->sun_path, size));
+}
+#endif
+
+//Abstract names have no file
+void netbase::unlinkPath( const std::string& path)
+{
+#ifndef _WIN32
+    if (!path.empty() && path[0] != '@') {
+        unlink(path.c_str());
+    }
+#endif
+}
+
+//Only a socket nobody listens on any more is removed.  A live server
+//  takes the connect (or its backlog is full), a stale file refuses it.
+bool netbase::removeStale( const std::string& path)
+{
+#ifndef _WIN32
+    struct stat info;
+    struct sockaddr_un addr;
+    socklen_t addr_len;
+    sock_t sd;
+    int rv, error;
+
+    //Abstract names go away with their socket
+    if (path.empty() || path[0] == '@' || lstat(path.c_str(), &info) != 0) {
+        return true;
+    }
+    if (!S_ISSOCK(info.st_mode)) {
+        lastError = "Not a socket, left alone: " + path;
+        errno = EADDRINUSE;
+        return false;
+    }
+
+    addr_len = unixAddress(path, addr);
+    sd = socket( AF_UNIX, SOCK_STREAM, 0);
+    if (addr_len == 0 || sd == (sock_t)INVALID_SOCKET) {
+        lastError = "Cannot check socket " + path;
+        errno = EADDRINUSE;
+        return false;
+    }
+    fcntl(sd, F_SETFL, fcntl(sd, F_GETFL, 0) | O_NONBLOCK);
+    rv = connect(sd, (sockaddr*)&addr, addr_len);
+    error = errno;
+    close(sd);
+
+    if (rv == -1 && (error == ECONNREFUSED || error == ENOENT)) {
+        NETLOG_INFO("Removing stale socket {}", path);
+        unlinkPath(path);
+        return true;
+    }
+    lastError = "Address in use, a server answers on " + path;
+    errno = EADDRINUSE;
+    return false;
+#else
+    return true;
+#endif
+}
+
+//Numbers only: no lookups on the loop thread
+socklen_t netbase::inetAddress( const string& address, uint16_t port,
+                                struct sockaddr_storage& addr)
+{
+    struct addrinfo hints, *info = NULL;
+    socklen_t length = 0;
+
+    memset(&addr, 0, sizeof(addr));
+    if (address.empty()) {
+        return 0;
+    }
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_flags = AI_NUMERICHOST;
+    if (getaddrinfo(address.c_str(), NULL, &hints, &info) == 0 &&
+        info != NULL && info->ai_addrlen <= sizeof(addr))
+    {
+        memcpy(&addr, info->ai_addr, info->ai_addrlen);
+        length = addressLength(&addr);
+        if (addr.ss_family == AF_INET) {
+            ((struct sockaddr_in*)&addr)->sin_port = htons(port);
+        } else if (addr.ss_family == AF_INET6) {
+            ((struct sockaddr_in6*)&addr)->sin6_port = htons(port);
+        }
+    }
+    if (info != NULL) {
+        freeaddrinfo(info);
+    }
+
+    return length;
+}
+
+//A dual-stack IPv6 socket reaches IPv4 as ::ffff:a.b.c.d
+socklen_t netbase::inetAddress( const struct sockaddr_storage* from,
+                                uint16_t port, int family,
+                                struct sockaddr_storage& addr)
+{
+    struct sockaddr_in6 *addr6 = (struct sockaddr_in6*)&addr;
+    struct sockaddr_in *addr4 = (struct sockaddr_in*)&addr;
+    const struct sockaddr_in *from4 = (const struct sockaddr_in*)from;
+
+    memset(&addr, 0, sizeof(addr));
+    if (from->ss_family == AF_INET6 && family == AF_INET6) {
+        memcpy(addr6, from, sizeof(*addr6));
+        addr6->sin6_port = htons(port);
+        return sizeof(*addr6);
+    }
+    if (from->ss_family != AF_INET) {
+        return 0;
+    }
+
+    if (family == AF_INET6) {
+        addr6->sin6_family = AF_INET6;
+        addr6->sin6_port = htons(port);
+        addr6->sin6_addr.s6_addr[10] = 0xff;
+        addr6->sin6_addr.s6_addr[11] = 0xff;
+        memcpy(&addr6->sin6_addr.s6_addr[12], &from4->sin_addr, 4);
+        return sizeof(*addr6);
+    }
+    memcpy(addr4, from4, sizeof(*addr4));
+    addr4->sin_port = htons(port);
+    return sizeof(*addr4);
+}
+
+//Length of an IPv4 or IPv6 address, 0 for anything else
+socklen_t netbase::addressLength( const struct sockaddr_storage* addr)
+{
+    switch (addr->ss_family) {
+        case AF_INET:
+            return sizeof(struct sockaddr_in);
+        case AF_INET6:
+            return sizeof(struct sockaddr_in6);
+        default:
+            return 0;
+    }
+}
+
+//Numeric, so logging never waits for a name server
+string netbase::addressString( const struct sockaddr_storage* addr,
+                               socklen_t length)
+{
+    char host[NI_MAXHOST], port[NI_MAXSERV];
+
+#ifndef _WIN32
+    if (addr->ss_family == AF_UNIX) {
+        return unixPath((const struct sockaddr_un*)addr, length);
+    }
+#endif
+    if (addressLength(addr) == 0 || length < addressLength(addr) ||
+        getnameinfo((const struct sockaddr*)addr, addressLength(addr),
+                    host, sizeof(host), port, sizeof(port),
+                    NI_NUMERICHOST | NI_NUMERICSERV) != 0)
+    {
+        return "?";
+    }
+
+    if (addr->ss_family == AF_INET6) {
+        return string("[") + host + "]:" + port;
+    }
+    return string(host) + ":" + port;
+}
+
+//Snapshot of counters, with gauges measured now
+netstats netbase::getStats() const
+{
+    netstats snapshot = stats;
+    std::set<sock_t>::const_iterator con_iter;
+    sock_t con;
+
+    snapshot.connections = conSet.size();
+    snapshot.pendingDisconnects = closedSocketSet.size();
+    snapshot.timers = timers.size();
+    snapshot.time = getTime();
+
+    for (con_iter = conSet.begin(); con_iter != conSet.end(); con_iter++) {
+        con = *con_iter;
+        if (conTable[con].chain != NULL) {
+            snapshot.bufferedBytes += conTable[con].chain->length();
+            snapshot.bufferMemory +=
+                conTable[con].chain->count() * segPool.get_segsize();
+        } else {
+            snapshot.bufferedBytes += conTable[con].length - conTable[con].index;
+            snapshot.bufferMemory += conTable[con].size;
+        }
+        if (conTable[con].sendQueue != NULL) {
+            snapshot.queuedBytes += conTable[con].sendQueue->length();
+        }
+    }
+
+    return snapshot;
+}
+
+//Per connection counters
+const netconstats* netbase::getConStats( sock_t sd) const
+{
+    if (isClosed(sd) || (size_t)sd >= conTable.size()) {
+        return NULL;
+    }
+    return &conTable[sd].stats;
+}
+
+//Bytes sendPacket() has not been able to send yet
+size_t netbase::getQueued( sock_t sd) const
+{
+    if (isClosed(sd) || conTable[sd].sendQueue == NULL) {
+        return 0;
+    }
+    return conTable[sd].sendQueue->length();
+}
+
+//Start counting from zero
+void netbase::resetStats()
+{
+    int which;
+
+    stats.clear();
+    for (which = 0; which < TIME_COUNT; which++) {
+        loopHist[which].clear();
+    }
+}
+
+//Turn loop histograms on or off
+void netbase::setTiming( bool enable)
+{
+    timing = enable;
+}
+
+//Histogram of one loop step, in nanoseconds
+const nethistogram& netbase::getHistogram( loopStep which) const
+{
+    return loopHist[which];
+}
+
 //Get the most recent socket error from the system
 string netbase::getSocketError() const
 {
@@ -878,6 +2109,8 @@ string netbase::getSocketError() const
             lastError = "Unknown winsock error";
             break;
     }
+#else
+    lastError = strerror(errno);
 #endif
 
     return lastError;
@@ -886,21 +2119,21 @@ string netbase::getSocketError() const
 //Start the debugging log
 bool netbase::openLog() const
 {
-#ifdef DEBUG
-    if ( ! debugLog.is_open() )
-        debugLog.open("network.log", ios::out | ios::app);
+#if NETMM_LOG_LEVEL < NETMM_LOG_NONE
+    if ( ! logOpen )
+        logOpen = netlog::open("network.log");
 #endif
-    return (debugLog.is_open());
+    return logOpen;
 }
 
 
 //Stop the debugging log
 bool netbase::closeLog() const
 {
-#ifdef DEBUG
-    if ( debugLog.is_open() )
-        debugLog.close();
-#endif
+    if ( logOpen ) {
+        netlog::close();
+        logOpen = false;
+    }
     return true;
 }
 
@@ -912,7 +2145,7 @@ size_t netbase::debugPacket(const netpacket *pkt) const
     return 0;
 #endif
     if (pkt == NULL) {
-        debugLog << "Null packet" << endl;
+        NETLOG_WARN("Null packet");
         return 0;
     }
     
@@ -920,41 +2153,39 @@ size_t netbase::debugPacket(const netpacket *pkt) const
     size_t read = pkt->get_read();
     size_t written = pkt->get_write();
     size_t size = pkt->get_maxsize();
-    debugLog << "#" << pkt->ID << " (w=" << written << ","
-             << "r=" << read << "/" << size << ")" << endl;
+    NETLOG_DEBUG("#{} (w={},r={}/{})", pkt->ID, written, read, size);
 
     const uint8_t *mybytes = pkt->get_ptr();
     uint8_t mybyte;
     char hexvalue[8];
+    string text;
 
     //Print the written bytes    
     if (written > 0) {
-        debugLog << "     Written=";
         //Vars
         
         for (size_t index=0; index < written; index++) {
             mybyte = mybytes[index];
             if (mybyte >= ' ' && mybyte <= '~') {
-                debugLog << (char)mybyte;
+                text += (char)mybyte;
             } else {
                 snprintf( hexvalue, 8, "{0x%02X}", mybyte);
-                debugLog << hexvalue;
+                text += hexvalue;
             }
         }
-        debugLog << endl;
+        NETLOG_DEBUG("     Written={}", text);
     } else if (read < size) {
-        debugLog << "     Unread=";
         //Print the unread bytes
         for (size_t index=read; index < (size - read); index++) {
             mybyte = mybytes[index];
             if (mybyte >= ' ' && mybyte <= '~') {
-                debugLog << (char)mybyte;
+                text += (char)mybyte;
             } else {
                 snprintf( hexvalue, 8, "{0x%02X}", mybyte);
-                debugLog << hexvalue;
+                text += hexvalue;
             }
         }
-        debugLog << endl;
+        NETLOG_DEBUG("     Unread={}", text);
     }
     
     //Did not consume any bytes :)
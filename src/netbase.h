@@ -7,18 +7,21 @@
 //
 
 #include "netpacket.h"
+#include "netchain.h"
+#include "netlog.h"
+#include "netstats.h"
+#include "nethistogram.h"
+#include "nethandle.h"
+#include "nethandler.h"
 
 
 //Platform support
-#ifdef _WIN32
-    #include <winsock2.h>
-#else
-    #include <sys/select.h>
-#endif
+#include "netplatform.h"
 
 #ifndef _MSC_VER
     #include <sys/time.h>
 #endif
+#include <time.h>
 
 //STL classes
 #include <set>
@@ -39,16 +42,81 @@ namespace net__ {
     
         //Function pointer types
         typedef size_t (*connectionFP)( sock_t sd, void *cb_data);
+        typedef void (*timerFP)( size_t timerID, void *cb_data);
+        typedef void (*watchFP)( sock_t sd, bool readable, bool writable,
+                                 void *cb_data);
+        
+        //How incoming bytes are buffered for each connection
+        enum recvMode {
+            RECV_CONTIGUOUS,    //One buffer, doubled and copied as needed
+            RECV_CHAINED        //Chain of pooled segments, read with readv
+        };
+        
+        //Event loop steps timed by setTiming()
+        enum loopStep {
+            TIME_SELECT,        //select() wait
+            TIME_READ,          //readSockets()
+            TIME_CALLBACKS,     //One fireCallbacks() pass
+            TIME_HANDLER,       //One packet callback
+            TIME_LOOP,          //One readIncomingSockets() pass
+            TIME_COUNT
+        };
+        
+        //Sizing of RECV_CONTIGUOUS connection buffers.  Buffers are
+        //  allocated when the first bytes arrive, doubled while a message
+        //  doesn't fit, and shrunk (or freed) after idleTime.
+        struct bufferPolicy {
+            size_t initialSize;     //First allocation
+            size_t maxSize;         //Disconnect rather than grow past this
+            size_t minRecv;         //Free space wanted before each recv()
+            unsigned int idleTime;  //Idle milliseconds before shrink, 0=never
+        };
+        
+        //Socket options of TCP connections.  0 leaves the system default.
+        //  What a system or socket doesn't have is skipped: Unix sockets
+        //  only take the buffer sizes.
+        struct socketOptions {
+            bool noDelay;           //TCP_NODELAY: no Nagle delay (default)
+            bool quickAck;          //TCP_QUICKACK on every read (Linux)
+            bool cork;              //TCP_CORK while callbacks and queue
+                                    //  flushes send, full segments (Linux)
+            int recvBuffer;         //SO_RCVBUF bytes
+            int sendBuffer;         //SO_SNDBUF bytes
+            int notSentLowat;       //TCP_NOTSENT_LOWAT: writable below this
+            int keepAliveIdle;      //Idle seconds before keepalive probes,
+                                    //  0 = no keepalive
+            int keepAliveInterval;  //Seconds between probes
+            int keepAliveCount;     //Unanswered probes that drop it
+            int deferAccept;        //TCP_DEFER_ACCEPT seconds: accept only
+                                    //  once data arrives (Linux listeners)
+        };
     
         //Constructors
         netbase(size_t);    //Maximum connections
         virtual ~netbase();
     
-        //Send packet "pkt" on socket "sd"
+        //Send packet "pkt" on socket "sd".  Whatever the socket won't take
+        //  right away is queued, and sent from run() as the socket drains.
+        //  Returns the packet length, or -1 if the connection is closed or
+        //  its queue would grow past bufferPolicy.maxSize.
         int sendPacket( sock_t sd, netpacket &pkt);
     
         //Close socket "sd", and remove connection specific callbacks
         bool disconnect( sock_t sd);
+        
+        //Send and disconnect by handle.  Handles to connections that are
+        //  gone are rejected, even if their socket descriptor was reused.
+        int sendPacket( nethandle h, netpacket &pkt);
+        bool disconnect( nethandle h);
+        
+        //Handle for connection *sd*, null handle if not connected
+        nethandle getHandle( sock_t sd) const;
+        
+        //Socket of handle *h*, INVALID_SOCKET if the connection is gone
+        sock_t getSocket( nethandle h) const;
+        
+        //Is the connection of handle *h* still open?
+        bool isValid( nethandle h) const;
 
         //Add a callback for incoming packets on matching connection *c*
         bool setConPktCB( sock_t sd, netpacket::netPktCB cbFunc, void *cbData );
@@ -70,32 +138,115 @@ namespace net__ {
         
         //Remove disconnect callback
         void removeDisconnectCB();
+        
+        //Set callback for when a connection has sent all of its queue
+        void setWritableCB( connectionFP cbFunc, void *cbData );
+        
+        //Set callback for connections that failed or timed out, from
+        //  netclient::doConnect() or netshm::doConnect()
+        void setConnectFailCB( connectionFP cbFunc, void *cbData);
+        
+        //Poll *sd* in run() along with the connections, and call *cbFunc*
+        //  when it is readable, or writable if *write*.  Calling it again
+        //  changes the callback or write interest.  Lets another transport
+        //  share this loop, see netdgram::attach().
+        bool watchSocket( sock_t sd, watchFP cbFunc, void *cbData,
+                          bool write = false);
+        
+        //Stop polling *sd*, before closing it
+        bool unwatchSocket( sock_t sd);
+        
+        //Send connect, connect failed, disconnect and writable events to
+        //  *handler*, see nethandler.h.  Replaces the callbacks set above, so *handler*
+        //  must outlive every later run().  run(H&) does this for its own
+        //  pass only.
+        template <class H> void setHandler( H& handler) {
+            setConnectCB( handlerConnect<H>, &handler);
+            setConnectFailCB( handlerConnectFailed<H>, &handler);
+            setDisconnectCB( handlerDisconnect<H>, &handler);
+            setWritableCB( handlerWritable<H>, &handler);
+        };
+        
+        //Buffering for connections made after this call
+        void setRecvMode( recvMode mode);
+        
+        //Call cbFunc from run() after *milliseconds*.  Returns timer ID.
+        size_t setTimer( unsigned int milliseconds, timerFP cbFunc,
+                         void *cbData);
+        
+        //Cancel a timer that has not fired yet
+        bool cancelTimer( size_t timerID);
+        
+        //Set sizing of connection buffers
+        void setBufferPolicy( const bufferPolicy& policy);
+        const bufferPolicy& getBufferPolicy() const { return conPolicy; };
+        
+        //Socket options for connections made, and ports opened, after
+        //  this call.  Connections accepted on a port get its options.
+        void setSocketOptions( const socketOptions& options);
+        const socketOptions& getSocketOptions() const { return conOptions; };
+        
+        //Set *options* on socket *sd* now.  False if any failed.
+        bool setSocketOptions( sock_t sd, const socketOptions& options);
     
         //const functions
         bool isClosed(sock_t sd) const;   //Is socket closed?
+        
+        //Milliseconds from a monotonic clock
+        static uint64_t getTime();
+        
+        //Nanoseconds from a monotonic clock, for measuring short intervals
+        static uint64_t getNanoTime();
+        
+        //Counters with current gauges filled in
+        virtual netstats getStats() const;
+        
+        //Counters for connection *sd*, NULL if not connected
+        const netconstats* getConStats( sock_t sd) const;
+        
+        //Bytes waiting in the send queue of *sd*
+        size_t getQueued( sock_t sd) const;
+        
+        //Zero the event loop counters and histograms
+        void resetStats();
+        
+        //Record how long each loop step takes.  Off by default: costs
+        //  two clock reads per step and per callback.
+        void setTiming( bool enable);
+        
+        //Durations of a loop step, in nanoseconds
+        const nethistogram& getHistogram( loopStep which) const;
     
         //Logging functions
-        bool openLog() const;     //will open the debugLog, if not open already
-        bool closeLog() const;    //close the debugLog if open
+        bool openLog() const;     //will open the netlog, if not open already
+        bool closeLog() const;    //close the netlog if open
         size_t debugPacket(const netpacket *pkt) const;
         
         //
         //Public data members
         //
-          //Public can write to .debugLog
-        mutable std::ofstream debugLog;
+          //This object has the netlog open
+        mutable bool logOpen;
           //String for last error message
         mutable std::string lastError;
-          //64K Maximum packet receive size
           
         //
         // Public constants
         //
+          //64K Maximum packet receive size
         static const size_t NETMM_MAX_RECV_SIZE   = 0x10000;
-          //64K maximum socket ID
-        static const size_t NETMM_MAX_SOCKET_DESCRIPTOR = 0xFFFF;
           //Connection buffer is twice packet receive size
         static const size_t NETMM_CON_BUFFER_SIZE = (NETMM_MAX_RECV_SIZE << 1);
+          //Segment size for RECV_CHAINED
+        static const size_t NETMM_SEGMENT_SIZE = 0x4000;
+          //Segments filled by one readv() call
+        static const size_t NETMM_SEGMENT_IOV = 16;
+          //Free segments kept in the pool (16MB)
+        static const size_t NETMM_SEGMENT_POOL = 0x400;
+          //Default bufferPolicy
+        static const size_t NETMM_INITIAL_BUFFER  = 0x1000;
+        static const size_t NETMM_MIN_RECV_SIZE   = 0x1000;
+        static const unsigned int NETMM_IDLE_TIME = 30000;
     
     protected:
         //
@@ -103,48 +254,136 @@ namespace net__ {
         //
         static const size_t NETMM_MEMORY_SIZE     = 0x1000000; //16MB
     
+        //Receive buffer and counters of one connection
+        struct conEntry {
+            uint8_t* buffer;
+            size_t index;
+            size_t length;
+            size_t size;
+            uint64_t time;      //Last data
+            size_t peak;        //Max unread
+            
+            // Buffer         Index   Length                             Size
+            // |  (consumed)    |       |                                  |
+            // |-----------------------------------------------------------|
+            
+              //RECV_CHAINED connections use a segment chain instead
+            netchain* chain;
+            
+            netconstats stats;
+            
+              //Connection number on this descriptor, for nethandle
+            uint32_t generation;
+              //Connected (in conSet)
+            bool live;
+              //Bytes sendPacket() couldn't send yet, NULL if none
+            netchain* sendQueue;
+              //socketOptions that need work on every read or send
+            bool quickAck;
+            bool cork;
+            
+            conEntry(): buffer(NULL), index(0), length(0), size(0), time(0),
+                peak(0), chain(NULL), generation(0), live(false),
+                sendQueue(NULL), quickAck(false), cork(false) {};
+        };
+    
           //Network parameters
         struct timeval timeout; //Timeout interval
           //set of all file descriptors
+#ifdef NETMM_USE_POLL
+        std::vector<struct pollfd> pollSet;
+        size_t pollWatches;     //Index of first watched descriptor
+#else
         fd_set sdSet;
+        fd_set sdWriteSet;      //Sockets with a send queue
+#endif
           //Currently connected sockets
         std::set<sock_t> conSet;
           //Sockets which are pending disconnection
         std::set<sock_t> closedSocketSet;
+          //Descriptors of other transports, polled with the connections
+        struct watchEntry {
+            watchFP cbFunc;
+            void *cbData;
+            bool write;
+        };
+        std::map<sock_t, watchEntry> watches;
           //Max socket descriptor in conSet
         sock_t sdMax;
           //Max connections allowed
         size_t conMax;
         
-          //Each connection gets its own buffer
-        uint8_t* conBuffer[NETMM_MAX_SOCKET_DESCRIPTOR];
-        size_t conBufferIndex[NETMM_MAX_SOCKET_DESCRIPTOR];
-        size_t conBufferLength[NETMM_MAX_SOCKET_DESCRIPTOR];
-        size_t conBufferSize[NETMM_MAX_SOCKET_DESCRIPTOR];
+          //Each connection gets its own entry, indexed by socket descriptor.
+          //  Grows when a connection is made, so idle objects stay small.
+        std::vector<conEntry> conTable;
+          //Buffering for new connections
+        recvMode conRecvMode;
+          //Segments for all chains
+        netsegpool segPool;
+          //Sizing of contiguous buffers
+        bufferPolicy conPolicy;
+          //Socket options of new connections
+        socketOptions conOptions;
+          //Last time idle buffers were shrunk
+        uint64_t lastShrink;
         
-        // Buffer         Index   Length                             Size
-        // |  (consumed)    |       |                                  |
-        // |-----------------------------------------------------------|
-        
-        size_t lastMessage;  //Increment each time a message is sent out
+          //Event loop counters
+        netstats stats;
+          //Loop step durations, when timing
+        bool timing;
+        nethistogram loopHist[TIME_COUNT];
     
         //Function pointer for when a new connection is received
         connectionFP conCB;
         void *conCBD;
     
+        //Function pointer for when a connection fails
+        connectionFP failCB;
+        void *failCBD;
+    
         //Function pointer for when disconnection occurs
         connectionFP disCB;
         void *disCBD;
     
+        //Function pointer for when a send queue empties
+        connectionFP writeCB;
+        void *writeCBD;
+    
         //Map connection IDs to callback function/data for incoming packets
         std::map< sock_t, netpacket::netPktCB > packetCB_map;
         std::map< sock_t, void* > packetCBD_map;
     
         //Map socket descriptor to sequential index, for memory pointing fun.
         std::map<sock_t, size_t> conIndexMap;
+        
+        //Handler for run() without one: setConPktCB() callbacks
+        struct pktCallbacks {
+            netbase *net;
+            size_t onData( sock_t sd, netpacket *pkt);
+        };
+        pktCallbacks pktMap;
+        
+        //Timers, ordered by when they fire
+        struct timerEntry {
+            size_t timerID;
+            timerFP cbFunc;
+            void *cbData;
+        };
+        typedef std::multimap< uint64_t, timerEntry > timerMap;
+        timerMap timers;
+        std::map< size_t, timerMap::iterator > timerIndex;
+        size_t lastTimer;
+        
+        //Fire callbacks for timers that are due
+        int fireTimers();
     
-        //Modify a socket to be non-blocking
-        int unblockSocket(sock_t sd); 
+        //Modify a socket to be non-blocking, and its address reusable
+        //  if *reuse*.  Datagram sockets don't want that: a second socket
+        //  could bind the same port and take some of the datagrams.
+        int unblockSocket(sock_t sd, bool reuse = true); 
+        
+        //Does *sd* fit in the select() set?  Always, with poll()
+        bool canTrack(sock_t sd) const;
         
         //Create the set of sockets
         size_t buildSocketSet();
@@ -152,14 +391,123 @@ namespace net__ {
         //Select on socketSet until incoming packets complete
         int readIncomingSockets();
         
+        //The same, passing every packet to handler.onData()
+        template <class H> int readIncomingSockets( H& handler);
+        
+        //Wait for sockets to be ready, send queued data.  Returns the
+        //  select()/poll() result.
+        int pollSockets();
+        
+        //Send queued data on sockets that are writable
+        void writeSockets();
+        
+        //Send as much of the send queue of *sd* as it takes
+        bool flushQueue(sock_t sd);
+        
+        //Hold back partial segments of *sd* (TCP_CORK), or send them
+        void corkSocket(sock_t sd, bool cork);
+        
+        //setsockopt() an int, logging what failed
+        bool setOption(sock_t sd, int level, int name, int value,
+                       const char *what);
+        
+        //Add *length* bytes to the send queue of *sd*
+        void queueBytes(sock_t sd, const uint8_t* data, size_t length);
+        
+        //Send a message of *length* bytes on *sd*, whose queue is empty,
+        //  and queue what it won't take.  False on a connection error.
+        virtual bool writeBytes(sock_t sd, const uint8_t* data,
+                                size_t length);
+        
         //Read set of sockets, return list of netpackets
         std::vector<netpacket*> readSockets();
         
         //Fire callbacks for list of packets (and disconnected sockets)
         int fireCallbacks(std::vector<netpacket*>& packets);
         
-        //Receive data on a socket to a buffer
-        int recvSocket(sock_t sd, uint8_t* buffer);
+        //The same, passing every packet to handler.onData()
+        template <class H> int fireCallbacks( H& handler,
+                                              std::vector<netpacket*>& packets);
+        
+        //Fire disconnect callbacks, and close the sockets
+        void fireDisconnects();
+        
+        //Call back watched descriptors that are ready
+        void fireWatches();
+        
+        //Shrink idle buffers, time the loop that started at *started*
+        void endLoop(uint64_t started);
+        
+        //Receive up to *size* bytes on a socket to a buffer
+        int recvSocket(sock_t sd, uint8_t* buffer, size_t size);
+        
+        //Is there something to read on the socket right now?
+        bool isReadable(sock_t sd);
+        
+        //Make room for *space* more bytes in connection buffer
+        bool reserveBuffer(sock_t sd, size_t space);
+        
+        //Shrink buffers of connections idle longer than conPolicy.idleTime
+        void shrinkBuffers();
+        
+        //Receive data on a socket into a segment chain with readv
+        int recvChain(sock_t sd, netchain* chain);
+        
+        //Allocate receive buffer (or chain) for a new connection.  False
+        //  *stamp* keeps the generation newGeneration() gave it earlier.
+        void allocBuffer(sock_t sd, bool stamp = true);
+        
+        //New connection on *sd*: handles to the last one stop matching
+        void newGeneration(sock_t sd);
+        
+        //Did the last socket call fail with EAGAIN/EWOULDBLOCK?
+        static bool isWouldBlock();
+        
+#ifndef _WIN32
+        //Unix socket address for *path*: a file, or on Linux "@name" for
+        //  the abstract namespace.  Returns the address length, 0 if the
+        //  path is empty or too long.
+        static socklen_t unixAddress( const std::string& path,
+                                      struct sockaddr_un& addr);
+        
+        //Path of Unix socket address *addr*, "@name" if abstract
+        static std::string unixPath( const struct sockaddr_un* addr,
+                                     socklen_t length);
+#endif
+        
+        //Remove the file of Unix socket *path*, if it has one
+        static void unlinkPath( const std::string& path);
+        
+        //Before binding *path*: remove the socket file a process that is
+        //  gone left behind.  False (EADDRINUSE) if *path* is some other
+        //  file, or something still answers on it.
+        bool removeStale( const std::string& path);
+
+        //Numeric IPv4 or IPv6 *address* (an IPv6 one may name its
+        //  interface: "fe80::1%eth0") and *port* in *addr*.  Returns the
+        //  address length, 0 if *address* isn't numeric.
+        static socklen_t inetAddress( const std::string& address,
+                                      uint16_t port,
+                                      struct sockaddr_storage& addr);
+
+        //Copy *from* with *port* into *addr*, for a socket of *family*:
+        //  an IPv4 address becomes IPv4-mapped IPv6 for an AF_INET6
+        //  socket.  Returns the address length, 0 if it can't be reached.
+        static socklen_t inetAddress( const struct sockaddr_storage* from,
+                                      uint16_t port, int family,
+                                      struct sockaddr_storage& addr);
+
+        //Length of an IPv4 or IPv6 address, 0 for anything else
+        static socklen_t addressLength( const struct sockaddr_storage* addr);
+
+        //"address:port" ("[address]:port" for IPv6), or a Unix socket
+        //  path, for logs
+        static std::string addressString( const struct sockaddr_storage* addr,
+                                          socklen_t length);
+
+        //Consume bytes read by a callback.  Return packet for the
+        //  remaining data, or NULL if the callback should not run again.
+        netpacket* consumePacket(netpacket* pkt, size_t bytes_read);
         
         //Socket is finished, handle cleanup at end of processing loop
         void pendDisconnect(sock_t sd);
@@ -186,7 +534,161 @@ namespace net__ {
         //Default connect/disconnect callbacks.  Return socket descriptor.
         static size_t connectionCB( sock_t con, void *CBD);
         static size_t disconnectionCB( sock_t con, void *CBD);
+        static size_t writableCB( sock_t con, void *CBD);
+        static size_t connectFailCB( sock_t con, void *CBD);
+        
+        //Callbacks for setHandler(), *CBD* is the handler
+        template <class H> static size_t handlerConnect( sock_t con,
+                                                         void *CBD) {
+            ((H*)CBD)->onConnect( con);
+            return con;
+        };
+        template <class H> static size_t handlerConnectFailed( sock_t con,
+                                                              void *CBD) {
+            ((H*)CBD)->onConnectFailed( con);
+            return con;
+        };
+        template <class H> static size_t handlerDisconnect( sock_t con,
+                                                            void *CBD) {
+            ((H*)CBD)->onDisconnect( con);
+            return con;
+        };
+        template <class H> static size_t handlerWritable( sock_t con,
+                                                          void *CBD) {
+            ((H*)CBD)->onWritable( con);
+            return con;
+        };
+        
+        //Points the connection callbacks at a handler for one run(H&)
+        //  pass, and puts the ones from before it back afterwards
+        class handlerScope {
+        public:
+            template <class H> handlerScope( netbase& base, H& handler):
+                net(base), conFn(base.conCB), conData(base.conCBD),
+                failFn(base.failCB), failData(base.failCBD),
+                disFn(base.disCB), disData(base.disCBD),
+                writeFn(base.writeCB), writeData(base.writeCBD) {
+                net.setHandler( handler);
+            };
+            ~handlerScope() {
+                net.conCB = conFn;
+                net.conCBD = conData;
+                net.failCB = failFn;
+                net.failCBD = failData;
+                net.disCB = disFn;
+                net.disCBD = disData;
+                net.writeCB = writeFn;
+                net.writeCBD = writeData;
+            };
+        private:
+            netbase& net;
+            connectionFP conFn;
+            void *conData;
+            connectionFP failFn;
+            void *failData;
+            connectionFP disFn;
+            void *disData;
+            connectionFP writeFn;
+            void *writeData;
+        };
     };
+    
+    //Read all incoming data, then pass it to the handler
+    template <class H> int netbase::readIncomingSockets( H& handler)
+    {
+        uint64_t started = 0;
+        int rv;
+        
+        if (timing) {
+            started = getNanoTime();
+        }
+        
+        rv = pollSockets();
+        if (rv > 0) {
+            uint64_t selected = (timing ? getNanoTime() : 0);
+            std::vector<netpacket*> packets = readSockets();
+            if (timing) {
+                loopHist[TIME_READ].record(getNanoTime() - selected);
+            }
+            rv = fireCallbacks( handler, packets);
+        }
+        
+        endLoop(started);
+        return rv;
+    }
+    
+    //Run handler.onData() for each packet until it stops reading, then
+    //  handle disconnected sockets
+    template <class H> int netbase::fireCallbacks( H& handler,
+                                                   std::vector<netpacket*>& packets)
+    {
+        std::vector<netpacket*>::iterator pkt_iter;
+        netpacket *pkt, *next;
+        size_t bytes_read;
+        sock_t con;
+        const uint64_t started = getNanoTime();
+        uint64_t called = 0, elapsed;
+        
+        stats.packets += packets.size();
+        
+        for (pkt_iter = packets.begin(); pkt_iter != packets.end(); pkt_iter++) {
+            pkt = *pkt_iter;
+            if (pkt == NULL) {
+                NETLOG_WARN("NULL packet in my queue??");
+                continue;
+            }
+            con = pkt->ID;
+            
+            //Replies to everything read go out together
+            if (conTable[con].cork) {
+                corkSocket( con, true);
+            }
+            
+            //Keep running the handler until no more bytes are read
+            do {
+                if (timing) {
+                    called = getNanoTime();
+                }
+                bytes_read = handler.onData( con, pkt);
+                if (timing) {
+                    loopHist[TIME_HANDLER].record(getNanoTime() - called);
+                }
+                stats.callbacks++;
+                if (bytes_read > 0 && bytes_read <= pkt->get_maxsize()) {
+                    stats.messagesIn++;
+                    conTable[con].stats.messagesIn++;
+                }
+                
+                //There may be more messages after the one read
+                next = consumePacket( pkt, bytes_read);
+                if (next != NULL) {
+                    delete pkt;
+                    pkt = next;
+                    *pkt_iter = pkt;
+                }
+            } while (next != NULL);
+            
+            if (conTable[con].cork && !isClosed(con)) {
+                corkSocket( con, false);
+            }
+        }
+        
+        //This can happen immediately after receiving bytes
+        fireDisconnects();
+        
+        //Delete packets created by makePacket() in readSockets()
+        for (pkt_iter = packets.begin(); pkt_iter != packets.end(); pkt_iter++) {
+            delete (*pkt_iter);
+        }
+        elapsed = getNanoTime() - started;
+        stats.callbackTime += elapsed;
+        if (timing) {
+            loopHist[TIME_CALLBACKS].record(elapsed);
+        }
+        
+        //Return number of packets processed (not total size)
+        return (int)(packets.size());
+    }
 }
     
 #endif
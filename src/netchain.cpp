@@ -0,0 +1,240 @@
+// netchain: Chained receive segments for vectored reads
+
+#include "netchain.h"
+#include <cstring>
+
+//STL namespace
+using std::deque;
+using std::vector;
+
+//net__ namespace
+using net__::netsegpool;
+using net__::netchain;
+using net__::netsegment;
+
+//
+//  netsegpool function implementations
+//
+
+//Constructor, specify segment size and how many free segments to keep
+netsegpool::netsegpool( size_t segmentSize, size_t maxFree):
+    segSize(segmentSize), freeMax(maxFree)
+{
+    ;
+}
+
+//Destructor, free the free list
+netsegpool::~netsegpool()
+{
+    vector<uint8_t*>::iterator iter;
+    for (iter = freeList.begin(); iter != freeList.end(); iter++) {
+        delete[] (*iter);
+    }
+    freeList.clear();
+}
+
+//Reuse a free segment if possible
+uint8_t* netsegpool::get()
+{
+    uint8_t* result;
+
+    if (freeList.empty()) {
+        result = new uint8_t[segSize];
+    } else {
+        result = freeList.back();
+        freeList.pop_back();
+    }
+
+    return result;
+}
+
+//Keep segment for later, unless it is oversized or the free list is full
+void netsegpool::put( uint8_t* seg, size_t size)
+{
+    if (seg == NULL) {
+        return;
+    }
+
+    if (size == segSize && freeList.size() < freeMax) {
+        freeList.push_back(seg);
+    } else {
+        delete[] seg;
+    }
+}
+
+//
+//  netchain function implementations
+//
+
+//Constructor, segments come from *segpool*
+netchain::netchain( netsegpool& segpool): pool(segpool), unread(0),
+    prepared(0)
+{
+    ;
+}
+
+//Destructor, give all segments back
+netchain::~netchain()
+{
+    deque<netsegment>::iterator iter;
+    for (iter = segments.begin(); iter != segments.end(); iter++) {
+        release(*iter);
+    }
+    segments.clear();
+}
+
+//Free space at the end of the last segment, then new segments from the pool
+size_t netchain::prepare( uint8_t** bufs, size_t* lens, size_t max)
+{
+    size_t n = 0;
+    netsegment seg;
+
+    prepared = segments.size();
+
+    //Fill the rest of the last segment first
+    if (!segments.empty() && max > 0) {
+        netsegment& tail = segments.back();
+        if (tail.length < tail.size) {
+            bufs[n] = tail.data + tail.length;
+            lens[n] = tail.size - tail.length;
+            prepared--;
+            n++;
+        }
+    }
+
+    //Then whole segments
+    for (; n < max; n++) {
+        seg.data = pool.get();
+        seg.index = 0;
+        seg.length = 0;
+        seg.size = pool.get_segsize();
+        segments.push_back(seg);
+
+        bufs[n] = seg.data;
+        lens[n] = seg.size;
+    }
+
+    return n;
+}
+
+//Spread received bytes over prepared segments, release the unused ones
+void netchain::commit( size_t bytes)
+{
+    size_t index, space, used;
+
+    unread += bytes;
+    for (index = prepared; index < segments.size() && bytes > 0; index++) {
+        netsegment& seg = segments[index];
+        space = seg.size - seg.length;
+        used = (bytes < space ? bytes : space);
+        seg.length += used;
+        bytes -= used;
+    }
+
+    //Segments that received nothing go back to the pool
+    while (!segments.empty() && segments.back().length == 0) {
+        release(segments.back());
+        segments.pop_back();
+    }
+}
+
+//Advance past consumed bytes, releasing segments as they empty
+void netchain::consume( size_t bytes)
+{
+    size_t avail;
+
+    if (bytes > unread) {
+        bytes = unread;
+    }
+    unread -= bytes;
+
+    while (bytes > 0 && !segments.empty()) {
+        netsegment& seg = segments.front();
+
+        avail = seg.length - seg.index;
+        if (bytes < avail) {
+            seg.index += bytes;
+            bytes = 0;
+        } else {
+            seg.index = seg.length;
+            bytes -= avail;
+        }
+
+        //Segment is consumed: drop it, or rewind it if it's the only one
+        //  (and a pooled one)
+        if (seg.index == seg.length) {
+            if (segments.size() > 1 || seg.length == seg.size ||
+                seg.size != pool.get_segsize())
+            {
+                release(seg);
+                segments.pop_front();
+            } else {
+                seg.index = 0;
+                seg.length = 0;
+            }
+        }
+    }
+}
+
+//Join all unread bytes into one segment (large enough for all of them).
+//  Later reads fill its free space, so a message arriving in pieces is
+//  copied again only when it outgrows the segment.
+bool netchain::linearize( size_t space)
+{
+    netsegment joined;
+    size_t avail;
+    deque<netsegment>::iterator iter;
+
+    if (segments.size() < 2) {
+        return false;
+    }
+
+    //Oversized segments are not pooled
+    joined.size = pool.get_segsize();
+    if (unread + space > joined.size) {
+        joined.size = unread + space;
+        joined.data = new uint8_t[joined.size];
+    } else {
+        joined.data = pool.get();
+    }
+    joined.index = 0;
+    joined.length = 0;
+
+    //Copy unread bytes of every segment
+    for (iter = segments.begin(); iter != segments.end(); iter++) {
+        avail = iter->length - iter->index;
+        memcpy( joined.data + joined.length, iter->data + iter->index, avail);
+        joined.length += avail;
+        release(*iter);
+    }
+
+    segments.clear();
+    segments.push_back(joined);
+
+    return true;
+}
+
+//Pointer to first unread byte
+uint8_t* netchain::head() const
+{
+    if (segments.empty()) {
+        return NULL;
+    }
+    return segments.front().data + segments.front().index;
+}
+
+//Unread bytes that are contiguous at head()
+size_t netchain::headLength() const
+{
+    if (segments.empty()) {
+        return 0;
+    }
+    return segments.front().length - segments.front().index;
+}
+
+//Return segment memory to the pool
+void netchain::release( netsegment& seg)
+{
+    pool.put(seg.data, seg.size);
+    seg.data = NULL;
+}
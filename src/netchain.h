@@ -0,0 +1,105 @@
+//netchain.h
+#ifndef NETCHAIN_H
+#define NETCHAIN_H
+
+//
+// Chain of fixed size receive segments.  Incoming bytes are read (readv)
+//  into the free space of the chain, so large bursts never reallocate and
+//  copy the connection buffer.  Segments only get joined together when a
+//  message straddles two of them.
+//
+
+#include "netpacket.h"
+
+//STL classes
+#include <deque>
+#include <vector>
+
+namespace net__ {
+
+    //One block of received bytes
+    struct netsegment {
+        uint8_t* data;
+        size_t index;       //Consumed up to here
+        size_t length;      //Received up to here
+        size_t size;        //Allocated size
+    };
+
+    // Segment   Index   Length                 Size
+    // | (consumed) |       |                      |
+    // |-------------------------------------------|
+
+    //Free list of segments, shared by all chains of a netbase
+    class netsegpool {
+
+    public:
+        netsegpool( size_t segmentSize, size_t maxFree);
+        ~netsegpool();
+
+        //Take a segment from the free list, or allocate a new one
+        uint8_t* get();
+
+        //Return segment of *size* bytes to the free list (or delete it)
+        void put( uint8_t* seg, size_t size);
+
+        //Size of pooled segments
+        size_t get_segsize() const { return segSize; };
+
+        //Number of segments in free list
+        size_t get_free() const { return freeList.size(); };
+
+    protected:
+        size_t segSize;
+        size_t freeMax;
+        std::vector<uint8_t*> freeList;
+    };
+
+    //Received bytes for one connection
+    class netchain {
+
+    public:
+        netchain( netsegpool& segpool);
+        ~netchain();
+
+        //Point *bufs* and *lens* at free space for up to *max* reads.
+        //  Return number of buffers to read into.
+        size_t prepare( uint8_t** bufs, size_t* lens, size_t max);
+
+        //Record *bytes* received into the buffers from prepare()
+        void commit( size_t bytes);
+
+        //Mark *bytes* as consumed, releasing emptied segments
+        void consume( size_t bytes);
+
+        //Copy all unread bytes into one segment, with room for *space*
+        //  more to be read into it.  Return false if they were already
+        //  contiguous.
+        bool linearize( size_t space);
+
+        //Pointer to unread bytes in the first segment
+        uint8_t* head() const;
+
+        //Unread bytes in the first segment
+        size_t headLength() const;
+
+        //Unread bytes in all segments
+        size_t length() const { return unread; };
+
+        //Number of segments in chain
+        size_t count() const { return segments.size(); };
+
+        //Is there nothing left to read?
+        bool empty() const { return (unread == 0); };
+
+    protected:
+        netsegpool& pool;
+        std::deque<netsegment> segments;
+        size_t unread;      //Total unread bytes
+        size_t prepared;    //First segment index filled by prepare()
+
+        //Give segment back to the pool
+        void release( netsegment& seg);
+    };
+}
+
+#endif
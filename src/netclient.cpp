@@ -1,22 +1,28 @@
 #include "netclient.h"
 
+#include <cerrno>
+
 //STL namespace
+using std::map;
 using std::string;
+using std::vector;
 using std::endl;
 
 //net__ namespace
 using net__::netbase;
 using net__::netclient;
+using net__::nethandle;
+using net__::netstats;
 
 //
 //  netclient function implementations
 //
 
 // Constructor: Set maximum connections
-netclient::netclient( size_t max ) : netbase( max)
+netclient::netclient( unsigned int max ) : netbase( max)
 {
     openLog();
-    debugLog << "===Starting client===" << endl;
+    NETLOG_INFO("===Starting client===");
     
     //Set the timeout for connecting to a server...
     connTimeout.tv_sec = 3;
@@ -26,8 +32,16 @@ netclient::netclient( size_t max ) : netbase( max)
 // Destructor
 netclient::~netclient()
 {
+    //Give up on connections in progress
+    while (!connPending.empty()) {
+        cancelConnect(connPending.begin()->first);
+    }
+    while (!connResolving.empty()) {
+        cancelConnect(connResolving.begin()->first);
+    }
+
     openLog();
-    debugLog << "===Ending client===" << endl << endl;
+    NETLOG_INFO("===Ending client===");
     closeLog();
 
     //Now the base class destructor is invoked by C++
@@ -47,80 +61,221 @@ bool netclient::setConnTimeout( int seconds, int microsec)
 
 //connect to server "address:port", return socket number
 sock_t netclient::doConnect(const string& serverAddress,
-                            uint16_t port, uint16_t lport)
+                            uint16_t port, uint16_t lport,
+                            const string& localAddress)
 {
-	struct	sockaddr_in sad;   //Server address struct
-	sock_t sdServer;            //socket descriptor of connection
-	int rv;                    //Return value
-    struct hostent *host;       //Host name entry
+    struct sockaddr_storage sad;        //Server address struct
+    struct sockaddr_storage lad;        //Local address struct
+    struct sockaddr_storage resolved;   //Numeric or cached host address
+    socklen_t sad_len, lad_len = 0;
+    sock_t sdServer;            //socket descriptor of connection
+    uint64_t deadline;          //Connect timeout
+    int family = AF_UNSPEC;     //Of the socket
+    int v6only = 0;
+    bool resolving = false;
 
     openLog();
 
-    //Create a socket
-    sdServer = socket( AF_INET, SOCK_STREAM, 0);
+    //Time out the connection from now, including name resolution
+    deadline = getTime() + (connTimeout.tv_sec * 1000) +
+        (connTimeout.tv_usec / 1000);
+
+    //A local address picks the socket family
+    if (!localAddress.empty()) {
+        lad_len = inetAddress(localAddress, lport, lad);
+        if (lad_len == 0) {
+            lastError = string("Could not bind to ") + localAddress;
+            NETLOG_WARN("{}, not a numeric address", lastError);
+            return -1;
+        }
+        family = lad.ss_family;
+    }
+
+    //If not a numeric address, resolve it
+    if (inetAddress(serverAddress, port, resolved) == 0) {
+        switch (resolver.lookup(serverAddress, resolved)) {
+            case netresolver::RESOLVE_FOUND:
+                //Cached, connect right away
+                break;
+            case netresolver::RESOLVE_FAILED:
+                lastError = string("Unknown host ") + serverAddress;
+                NETLOG_WARN("{}", lastError);
+                return -1;
+            default:
+                //Connect when the resolver calls back
+                resolving = true;
+                break;
+        }
+    }
+    if (family == AF_UNSPEC && !resolving) {
+        family = resolved.ss_family;
+    }
+
+    //Create a socket.  Before the name is known, one that reaches IPv6
+    //  and IPv4, if this host has IPv6.
+    if (family == AF_UNSPEC) {
+        family = AF_INET6;
+        sdServer = socket( family, SOCK_STREAM, 0);
+        if ( sdServer == (sock_t)INVALID_SOCKET ) {
+            family = AF_INET;
+            sdServer = socket( family, SOCK_STREAM, 0);
+        }
+    } else {
+        sdServer = socket( family, SOCK_STREAM, 0);
+    }
     if ( sdServer == (sock_t)INVALID_SOCKET ) {
         lastError = "Could not create socket";
-        debugLog << lastError << endl;
+        NETLOG_WARN("{}", lastError);
+        return -1;
+    }
+    
+    //No room in the select() set
+    if (!canTrack(sdServer)) {
+        lastError = "Too many sockets";
+        NETLOG_WARN("#{} {}", sdServer, lastError);
+        removeSocket(sdServer);
         return -1;
     }
 
+    //IPv4 addresses too, as ::ffff:a.b.c.d
+    if (family == AF_INET6) {
+        setsockopt(sdServer, IPPROTO_IPV6, IPV6_V6ONLY, (char *)&v6only,
+            sizeof(v6only));
+    }
+
+    //Bind the local end, to pick the source address or port
+    if (lport != 0 || lad_len != 0) {
+        if (lad_len == 0) {
+            lad_len = inetAddress((family == AF_INET6 ? "::" : "0.0.0.0"),
+                lport, lad);
+        }
+
+        if (bind(sdServer, (const struct sockaddr*)&lad, lad_len) ==
+                SOCKET_ERROR)
+        {
+            lastError = string("Could not bind to ") + localAddress;
+            NETLOG_WARN("#{} {}:{} {}", sdServer, lastError, lport,
+                getSocketError());
+            closeSocket(sdServer);
+            return -1;
+        }
+    }
+
     //Set socket to be non-blocking
     if (unblockSocket( sdServer) < 0)
         return -1;
+    setSocketOptions(sdServer, conOptions);
+    newGeneration(sdServer);
 
-    //
-    //Load connection information
-    //
-    
-    // clear sockaddr structure
-	memset((char *)&sad,0,sizeof(sad));
-	
-	//Set family to Internet
-	sad.sin_family = AF_INET;
-	
-	//Set port (network int16_t format)
-	sad.sin_port = htons(port);
-		
-	//Convert the server address
-	sad.sin_addr.s_addr = inet_addr(serverAddress.c_str());
-
-    //If not a numeric address, resolve it
-	if (sad.sin_addr.s_addr == INADDR_NONE)
-	{
-        host = NULL;    //...
-        host = gethostbyname(serverAddress.c_str());
-        if (host == NULL) {
-          
-            //Set error message
-            lastError = string("Unknown host ") + serverAddress.c_str();
-            debugLog << lastError << endl;
-            
-            //Cleanup the socket
+    if (resolving) {
+        if (resolver.resolve(serverAddress) != netresolver::RESOLVE_PENDING) {
+            lastError = string("Unknown host ") + serverAddress;
+            NETLOG_WARN("{}", lastError);
             closeSocket(sdServer);
             return -1;
         }
-        memcpy( &sad.sin_addr, host->h_addr_list[0], host->h_length);
-	}
+        resolver.setResolveCB( resolvedCB, this);
+        connResolving[sdServer].host = serverAddress;
+        connResolving[sdServer].port = port;
+        connResolving[sdServer].family = family;
+        connResolving[sdServer].deadline = deadline;
+        NETLOG_INFO("#{} resolving {}", sdServer, serverAddress);
+        return sdServer;
+    }
 
+    //An IPv4 socket can't reach an IPv6 address
+    sad_len = inetAddress(&resolved, port, family, sad);
+    if (sad_len == 0) {
+        lastError = string("Cannot reach ") + serverAddress + " from " +
+            localAddress;
+        NETLOG_WARN("#{} {}", sdServer, lastError);
+        closeSocket(sdServer);
+        return -1;
+    }
 
     //Connect to the server
-	rv = connect(sdServer, (const struct sockaddr*)&sad,
-                 sizeof( struct sockaddr_in));
+    if (startConnect(sdServer, (const struct sockaddr*)&sad, sad_len,
+                     serverAddress, deadline) < 0)
+    {
+        return SOCKET_ERROR;
+    }
 
-    //Special case for blocking sockets
+    return sdServer;
+}
+
+//connect to Unix socket "path", return socket number
+sock_t netclient::doConnectUnix(const string& path)
+{
+#ifdef _WIN32
+    lastError = "No Unix sockets on Windows";
+    NETLOG_WARN("{}", lastError);
+    return -1;
+#else
+    struct sockaddr_un sad;     //Server address struct
+    socklen_t sad_len;
+    sock_t sdServer;            //socket descriptor of connection
+
+    openLog();
+
+    sad_len = unixAddress(path, sad);
+    if (sad_len == 0) {
+        lastError = "Bad Unix socket path " + path;
+        return -1;
+    }
+
+    sdServer = socket( AF_UNIX, SOCK_STREAM, 0);
+    if ( sdServer == (sock_t)INVALID_SOCKET ) {
+        lastError = "Could not create socket";
+        NETLOG_WARN("{}", lastError);
+        return -1;
+    }
+
+    //No room in the select() set
+    if (!canTrack(sdServer)) {
+        lastError = "Too many sockets";
+        NETLOG_WARN("#{} {}", sdServer, lastError);
+        removeSocket(sdServer);
+        return -1;
+    }
+
+    //Set socket to be non-blocking
+    if (unblockSocket( sdServer) < 0)
+        return -1;
+    setSocketOptions(sdServer, conOptions);
+    newGeneration(sdServer);
+
+    //Connects right away, and the connect callback comes from run(), as
+    //  for TCP.  Or fails right away (EAGAIN: backlog full, ECONNREFUSED,
+    //  ENOENT), with no callback.
+    if (startConnect(sdServer, (const struct sockaddr*)&sad, sad_len, path,
+                     getTime() + (connTimeout.tv_sec * 1000) +
+                     (connTimeout.tv_usec / 1000)) < 0)
+    {
+        return SOCKET_ERROR;
+    }
+
+    return sdServer;
+#endif
+}
+
+//Call connect() on non-blocking socket, add it to connPending
+int netclient::startConnect( sock_t sdServer, const struct sockaddr* sad,
+                             socklen_t sad_len, const string& serverAddress,
+                             uint64_t deadline)
+{
+	int rv;                    //Return value
+
+	rv = connect(sdServer, sad, sad_len);
+
+    //Non-blocking sockets finish connecting later
 	if (rv == SOCKET_ERROR) {
-        #ifdef WIN32
-        fd_set sdConnSet;
-        FD_ZERO(&sdConnSet);
-        FD_SET( (unsigned int)sdServer, &sdConnSet);
+        #ifdef _WIN32
         if (WSAGetLastError() == WSAEWOULDBLOCK) {
-             rv = select(sdMax+1, (fd_set *) 0, &sdConnSet,
-                         (fd_set *) 0, &connTimeout);
-             if (rv == 0) {
-                debugLog << "Timeout to " << serverAddress << endl;
-                lastError = "Timed out: " + serverAddress;
-                return SOCKET_ERROR;      //Try again later
-            }
+            rv = 0;
+        }
+        #else
+        if (errno == EINPROGRESS) {
+            rv = 0;
         }
         #endif
     }
@@ -129,9 +284,9 @@ sock_t netclient::doConnect(const string& serverAddress,
     if (rv == SOCKET_ERROR) {
       
         //Update error message
-        debugLog << "   " << getSocketError() << endl;
+        NETLOG_ERROR("   {}", getSocketError());
         lastError = string("Could not connect to ") + serverAddress;
-        debugLog << lastError << endl;
+        NETLOG_WARN("{}", lastError);
         
         //Cleanup the socket
         closeSocket(sdServer);
@@ -139,56 +294,323 @@ sock_t netclient::doConnect(const string& serverAddress,
         //Some problem connecting to the server
         return SOCKET_ERROR;    
     }
-    else if (rv > 0) {
-      
-        //namelen must be an "int"
-        int namelen = sizeof( struct sockaddr_in);
-        getsockname( sdServer, (struct sockaddr*)&sad, &namelen);
-        
-        //Write to debug log
-        debugLog << "#" << sdServer << " connected @ "
-                 << serverAddress << ":" << port
-                << " from " << inet_ntoa(sad.sin_addr) 
-                << ":" << ntohs(sad.sin_port) << endl;
-
-        //Add to sdSet
-        conSet.insert(sdServer);
-        buildSocketSet();
-        
-        //Allocate buffer for receiving packets
-        conBuffer[sdServer] = new uint8_t[NETMM_CON_BUFFER_SIZE];
-        conBufferIndex[sdServer] = 0;
-        conBufferLength[sdServer] = 0;
-        conBufferSize[sdServer] = NETMM_CON_BUFFER_SIZE;
-
-        //Increase sdMax if higher connection is made
-        if (sdMax < sdServer) {
-            sdMax = sdServer;
+
+    //Still connecting!!  run() will report back later...
+    connPending[sdServer] = deadline;
+    if (sad->sa_family == AF_INET || sad->sa_family == AF_INET6) {
+        NETLOG_INFO("#{} connecting to {} at {}", sdServer, serverAddress,
+            addressString((const struct sockaddr_storage*)sad, sad_len));
+    } else {
+        NETLOG_INFO("#{} connecting to {}", sdServer, serverAddress);
+    }
+
+    return 0;
+}
+
+//Resolver finished *host*: connect everything waiting for it
+void netclient::resolvedCB( const string& host,
+    const struct sockaddr_storage *addr, void *CBD)
+{
+    netclient *self = (netclient*)CBD;
+    map<sock_t, pendingResolve>::iterator iter;
+    vector<sock_t> waiting;
+    vector<sock_t>::const_iterator con_iter;
+    struct sockaddr_storage sad;
+    socklen_t sad_len;
+    pendingResolve info;
+    sock_t sd;
+
+    //Coalesced: many connections may wait for one name
+    for (iter = self->connResolving.begin();
+         iter != self->connResolving.end(); iter++)
+    {
+        if (iter->second.host == host) {
+            waiting.push_back(iter->first);
         }
+    }
 
-        return sdServer;
+    for (con_iter = waiting.begin(); con_iter != waiting.end(); con_iter++) {
+        sd = *con_iter;
+        info = self->connResolving[sd];
+        self->connResolving.erase(sd);
+
+        sad_len = (addr != NULL ?
+                   inetAddress(addr, info.port, info.family, sad) : 0);
+        if (sad_len != 0) {
+            if (self->startConnect(sd, (const struct sockaddr*)&sad,
+                                   sad_len, host, info.deadline) == 0)
+            {
+                continue;
+            }
+        } else if (addr != NULL) {
+            //Only an IPv6 address, and no IPv6 here
+            self->lastError = string("Cannot reach ") + host;
+            NETLOG_WARN("#{} {}", sd, self->lastError);
+            self->closeSocket(sd);
+        } else {
+            self->lastError = string("Unknown host ") + host;
+            NETLOG_WARN("#{} {}", sd, self->lastError);
+            self->closeSocket(sd);
+        }
+        self->stats.connectFailures++;
+        self->failCB( sd, self->failCBD);
+    }
+}
+
+//Resolve names, and fail connections that waited too long for them
+int netclient::checkResolves()
+{
+    map<sock_t, pendingResolve>::const_iterator iter;
+    vector<sock_t> expired;
+    vector<sock_t>::const_iterator con_iter;
+    const uint64_t now = getTime();
+    int rv;
+
+    //Finished lookups start connecting (or fail) from resolvedCB
+    rv = resolver.poll();
+
+    for (iter = connResolving.begin(); iter != connResolving.end(); iter++) {
+        if (now >= iter->second.deadline) {
+            expired.push_back(iter->first);
+        }
+    }
+    for (con_iter = expired.begin(); con_iter != expired.end(); con_iter++) {
+        lastError = "Timed out: " + connResolving[*con_iter].host;
+        NETLOG_WARN("#{} {}", *con_iter, lastError);
+        connResolving.erase(*con_iter);
+        closeSocket(*con_iter);
+        stats.connectFailures++;
+        failCB( *con_iter, failCBD);
     }
 
-    return 0;       //Still connecting!!  Try back later...
+    return rv + (int)expired.size();
 }
 
-//Read the network, handle any incoming data
-int netclient::run()
+//Connection was made: add to conSet, allocate buffer
+void netclient::addConnection( sock_t sdServer)
 {
-    int rv = 0;
+	struct	sockaddr_storage sad;   //Local address struct
+
+    //namelen must be an "int"
+#ifdef _WIN32
+    int namelen = sizeof( sad);
+#else
+    socklen_t namelen = sizeof( sad);
+#endif
+    memset(&sad, 0, sizeof(sad));
+    getsockname( sdServer, (struct sockaddr*)&sad, &namelen);
+    
+    //Write to debug log
+    if (sad.ss_family == AF_INET || sad.ss_family == AF_INET6) {
+        NETLOG_INFO("#{} connected from {}", sdServer,
+            addressString(&sad, namelen));
+    } else {
+        NETLOG_INFO("#{} connected on a Unix socket", sdServer);
+    }
 
-    try {
-        //RECEIVE DATA ON ALL INCOMING CONNECTIONS
-        if (conSet.size() > 0) {
-            rv = readIncomingSockets();
+    //Allocate buffer for receiving packets, generation from doConnect()
+    allocBuffer(sdServer, false);
+
+    //Add to sdSet
+    conSet.insert(sdServer);
+    buildSocketSet();
+
+    //Increase sdMax if higher connection is made
+    if (sdMax < sdServer) {
+        sdMax = sdServer;
+    }
+}
+
+//Select on connections in progress, FD_SETSIZE sockets at a time (or poll
+//  all of them).  Writable means connected, exception (Windows) or SO_ERROR
+//  means failed.
+int netclient::checkConnects()
+{
+    map<sock_t, uint64_t>::const_iterator iter, batch;
+    vector<sock_t> connected, failed;
+    vector<sock_t>::const_iterator con_iter;
+    sock_t sd;
+    int rv, err;
+#ifdef _WIN32
+    int errlen;
+#else
+    socklen_t errlen;
+#endif
+    const uint64_t now = getTime();
+
+#ifdef NETMM_USE_POLL
+    vector<struct pollfd> pollPending(connPending.size());
+    size_t index;
+
+    for (iter = connPending.begin(), index = 0; iter != connPending.end();
+         iter++, index++)
+    {
+        pollPending[index].fd = iter->first;
+        pollPending[index].events = POLLOUT;
+        pollPending[index].revents = 0;
+    }
+
+    rv = poll(&pollPending[0], pollPending.size(), 0);
+    stats.selectCalls++;
+    if (rv == SOCKET_ERROR) {
+        NETLOG_ERROR("Connect poll error:{}", getSocketError());
+    }
+
+    //Sort into connected, failed and still waiting
+    for (iter = connPending.begin(), index = 0; iter != connPending.end();
+         iter++, index++)
+    {
+        sd = iter->first;
+        if (rv > 0 && pollPending[index].revents != 0) {
+            err = 0;
+            errlen = sizeof(err);
+            getsockopt( sd, SOL_SOCKET, SO_ERROR, (char*)&err, &errlen);
+            if (err == 0 && (pollPending[index].revents & POLLOUT) &&
+                !(pollPending[index].revents & (POLLERR | POLLHUP)))
+            {
+                connected.push_back(sd);
+            } else {
+                failed.push_back(sd);
+            }
+        } else if (now >= iter->second) {
+            NETLOG_WARN("#{} connect timeout", sd);
+            failed.push_back(sd);
         }
-        
-        //Fire callbacks for unprocessed data
     }
-    catch(...) {
-        debugLog << "Unhandled exception!!" << endl;
-        rv = -1;
-    };
+#else
+    fd_set writeSet, errorSet;
+    sock_t sdBatchMax;
+    size_t count;
+
+    for (iter = connPending.begin(); iter != connPending.end(); ) {
+
+        //Build the next batch
+        FD_ZERO( &writeSet);
+        FD_ZERO( &errorSet);
+        sdBatchMax = 0;
+        for (batch = iter, count = 0;
+             iter != connPending.end() && count < FD_SETSIZE;
+             iter++, count++)
+        {
+            sd = iter->first;
+            FD_SET( (unsigned int)sd, &writeSet);
+            FD_SET( (unsigned int)sd, &errorSet);
+            if (sdBatchMax < sd) {
+                sdBatchMax = sd;
+            }
+        }
 
-    return rv;
+        rv = select(sdBatchMax+1, (fd_set *) 0, &writeSet, &errorSet,
+                    &timeout);
+        stats.selectCalls++;
+        if (rv == SOCKET_ERROR) {
+            NETLOG_ERROR("Connect select error:{}", getSocketError());
+            FD_ZERO( &writeSet);
+            FD_ZERO( &errorSet);
+        }
+
+        //Sort the batch into connected, failed and still waiting
+        for (; batch != iter; batch++) {
+            sd = batch->first;
+            if (FD_ISSET( sd, &errorSet)) {
+                failed.push_back(sd);
+            } else if (FD_ISSET( sd, &writeSet)) {
+                err = 0;
+                errlen = sizeof(err);
+                getsockopt( sd, SOL_SOCKET, SO_ERROR, (char*)&err, &errlen);
+                if (err == 0) {
+                    connected.push_back(sd);
+                } else {
+                    failed.push_back(sd);
+                }
+            } else if (now >= batch->second) {
+                NETLOG_WARN("#{} connect timeout", sd);
+                failed.push_back(sd);
+            }
+        }
+    }
+#endif
+
+    //Callbacks may start new connections, so fire them after the scan
+    for (con_iter = connected.begin(); con_iter != connected.end();
+         con_iter++)
+    {
+        sd = *con_iter;
+        connPending.erase(sd);
+        addConnection(sd);
+        stats.connects++;
+        conCB( sd, conCBD);
+    }
+    for (con_iter = failed.begin(); con_iter != failed.end(); con_iter++) {
+        sd = *con_iter;
+        connPending.erase(sd);
+        lastError = "Could not connect";
+        NETLOG_WARN("#{} {}", sd, lastError);
+        closeSocket(sd);
+        stats.connectFailures++;
+        failCB( sd, failCBD);
+    }
+
+    return (int)(connected.size() + failed.size());
+}
+
+//Is socket still waiting to connect (or for its host name)?
+bool netclient::isConnecting( sock_t sd) const
+{
+    return (connPending.count(sd) != 0 || connResolving.count(sd) != 0);
+}
+
+//Is this connect, not a later one on the same socket, still being made?
+bool netclient::isConnecting( nethandle h) const
+{
+    if (h.isNull() || h.index >= conTable.size() ||
+        conTable[h.index].generation != h.generation)
+    {
+        return false;
+    }
+    return isConnecting( (sock_t)h.index);
+}
+
+//Handle of a connection in progress, or of an open connection
+nethandle netclient::getConnectHandle( sock_t sd) const
+{
+    if (isConnecting(sd) && (size_t)sd < conTable.size()) {
+        return nethandle( (uint32_t)sd, conTable[sd].generation);
+    }
+    return getHandle(sd);
+}
+
+//Close this connection in progress, if it still is one
+bool netclient::cancelConnect( nethandle h)
+{
+    if (!isConnecting(h)) {
+        return false;
+    }
+    return cancelConnect( (sock_t)h.index);
+}
+
+//Close a connection in progress
+bool netclient::cancelConnect( sock_t sd)
+{
+    if (connPending.erase(sd) == 0 && connResolving.erase(sd) == 0) {
+        return false;
+    }
+    NETLOG_INFO("#{} connect cancelled", sd);
+    closeSocket(sd);
+    return true;
+}
+
+//Counters, connections in progress included
+netstats netclient::getStats() const
+{
+    netstats snapshot = netbase::getStats();
+
+    snapshot.connecting = connPending.size() + connResolving.size();
+    return snapshot;
+}
+
+//Read the network, handle any incoming data
+int netclient::run()
+{
+    return runWith( pktMap);
 }
@@ -5,6 +5,7 @@
 #define NETCLIENT_H
 
 #include "netbase.h"
+#include "netresolver.h"
 
 namespace net__ {
     class netclient : public netbase {
@@ -13,17 +14,125 @@ namespace net__ {
         netclient( unsigned int maxConnections);
         ~netclient();
     
-        //Open a connection and return connection ID
+        //Start connecting, and return connection ID.  The connect
+        //  callback fires from run() once connected, or the connect fail
+        //  callback if it could not connect within the connect timeout.
+        //  *address* is a numeric IPv4 or IPv6 address, or a host name,
+        //  resolved in the background (and cached) to whichever address
+        //  the system prefers.  A non-zero *localPort* or numeric
+        //  *localAddress* binds the local end.
         sock_t doConnect( const std::string& address,
-                          uint16_t remotePort, uint16_t localPort = 0);
+                          uint16_t remotePort, uint16_t localPort = 0,
+                          const std::string& localAddress = "");
+        
+        //Start connecting to Unix socket *path*: a file, or on Linux
+        //  "@name" in the abstract namespace.  Callbacks are the same as
+        //  for doConnect(), but a Unix socket that nobody listens on, or
+        //  whose backlog is full, fails here: INVALID_SOCKET, with no
+        //  connect fail callback.  POSIX only.
+        sock_t doConnectUnix( const std::string& path);
+        
         int run();      //Look for incoming messages
+
+        //The same, sending every event to *handler* (see nethandler.h)
+        template <class H> int run( H& handler) {
+            handlerScope scope( *this, handler);
+            return runWith( handler);
+        };
         bool setConnTimeout( int seconds=3, int microsec=0);
+        
+        //Is connection still being made?
+        bool isConnecting( sock_t sd) const;
+        bool isConnecting( nethandle h) const;
+        
+        //Handle of a connection in progress, from doConnect().  It stays
+        //  valid once connected, and stops matching if the connect fails
+        //  and its socket descriptor is reused.
+        nethandle getConnectHandle( sock_t sd) const;
+        
+        //Stop connecting, without any callbacks
+        bool cancelConnect( sock_t sd);
+        bool cancelConnect( nethandle h);
+        
+        //Counters, with connections in progress
+        netstats getStats() const;
     
     
     protected:
+        //One run() pass, packets go to handler.onData()
+        template <class H> int runWith( H& handler);
+        
         struct timeval connTimeout;     //Connection timeout
+        
+          //Connections in progress, and when they time out
+        std::map<sock_t, uint64_t> connPending;
+        
+          //Connections waiting for a host name, before connPending
+        struct pendingResolve {
+            std::string host;
+            uint16_t port;
+            int family;         //Of the socket already made
+            uint64_t deadline;
+        };
+        std::map<sock_t, pendingResolve> connResolving;
+        
+          //Resolves host names without blocking run()
+        netresolver resolver;
+        
+        //Check connections in progress, fire callbacks for finished ones
+        int checkConnects();
+        
+        //Start connecting *sd* to a resolved address
+        int startConnect( sock_t sd, const struct sockaddr* sad,
+                          socklen_t sad_len, const std::string& address,
+                          uint64_t deadline);
+        
+        //Time out connections still waiting for host names
+        int checkResolves();
+        
+        //Resolver callback, *CBD* is the netclient
+        static void resolvedCB( const std::string& host,
+                                const struct sockaddr_storage *addr,
+                                void *CBD);
+        
+        //Connection was made, start receiving on it
+        void addConnection( sock_t sd);
     
     };
+
+    //Finish connects, then read sockets and pass packets to handler
+    template <class H> int netclient::runWith( H& handler)
+    {
+        int rv = 0;
+
+        try {
+            //Timers that are due
+            if (!timers.empty()) {
+                fireTimers();
+            }
+
+            //Connect to host names that were resolved
+            if (connResolving.size() > 0) {
+                checkResolves();
+            }
+
+            //Finish connections in progress
+            if (connPending.size() > 0) {
+                checkConnects();
+            }
+
+            //RECEIVE DATA ON ALL INCOMING CONNECTIONS
+            if (conSet.size() > 0 || !watches.empty()) {
+                rv = readIncomingSockets( handler);
+            }
+        }
+        catch(...) {
+            NETLOG_ERROR("Unhandled exception!!");
+            rv = -1;
+        };
+
+        return rv;
+    }
 }
 
 #endif
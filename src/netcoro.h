@@ -0,0 +1,449 @@
+//netcoro.h
+#ifndef NETCORO_H
+#define NETCORO_H
+
+//
+// C++20 coroutines on a netserver or netclient event loop.  A protocol
+//  that takes several steps (a handshake, request then reply) can be
+//  written as sequential code, instead of a state machine behind a
+//  netPktCB.  Coroutines are resumed from run(), one thread, no thread per
+//  connection.  Their frames come from a pool, so starting one for each
+//  connection doesn't go to the heap every time.
+//
+//    nettask session( netcoro<netserver>& co, sock_t sd) {
+//        netpacket hello = co_await co.readFrame( sd, 4);
+//        ...
+//        co_await co.send( sd, reply);
+//    }
+//
+//    netcoro<netserver> co( server);
+//    co.setSession( [&co]( sock_t sd) { return session( co, sd); });
+//    while (...) server.run( co);
+//
+// Only compiled with coroutine support (-std=c++20); the library itself
+//  doesn't need it.
+//
+
+#if defined(__cpp_impl_coroutine) && __cpp_impl_coroutine >= 201902L
+
+#include "netbase.h"
+
+#include <coroutine>
+#include <functional>
+#include <map>
+#include <string>
+#include <vector>
+#include <cstring>
+
+namespace net__ {
+
+    //Free lists of coroutine frames, by size.  One per thread.
+    class netframepool {
+
+    public:
+        //Frame of *size* bytes, from the free list if there is one
+        static void* get( size_t size) {
+            size_t bucket = (size + NETMM_FRAME_ALIGN - 1) / NETMM_FRAME_ALIGN;
+            if (bucket >= NETMM_FRAME_CLASSES) {
+                return ::operator new(size);
+            }
+            std::vector<void*>& free = lists().free[bucket];
+            if (free.empty()) {
+                return ::operator new(bucket * NETMM_FRAME_ALIGN);
+            }
+            void *frame = free.back();
+            free.pop_back();
+            return frame;
+        };
+
+        //Give back a frame from get( size)
+        static void put( void *frame, size_t size) {
+            size_t bucket = (size + NETMM_FRAME_ALIGN - 1) / NETMM_FRAME_ALIGN;
+            if (bucket >= NETMM_FRAME_CLASSES ||
+                lists().free[bucket].size() >= NETMM_FRAME_FREE)
+            {
+                ::operator delete(frame);
+                return;
+            }
+            lists().free[bucket].push_back(frame);
+        };
+
+          //Frame sizes are rounded up to this
+        static const size_t NETMM_FRAME_ALIGN = 64;
+          //Frames up to 4KB are pooled
+        static const size_t NETMM_FRAME_CLASSES = 64;
+          //Free frames kept for each size
+        static const size_t NETMM_FRAME_FREE = 1024;
+
+    protected:
+        struct freeLists {
+            std::vector<void*> free[NETMM_FRAME_CLASSES];
+            ~freeLists() {
+                for (size_t bucket = 0; bucket < NETMM_FRAME_CLASSES; bucket++) {
+                    for (size_t index = 0; index < free[bucket].size(); index++) {
+                        ::operator delete(free[bucket][index]);
+                    }
+                }
+            };
+        };
+        static freeLists& lists() {
+            static thread_local freeLists pool;
+            return pool;
+        };
+    };
+
+    //Return type of a coroutine run by netcoro.  Starts right away, and
+    //  frees itself when it returns.
+    struct nettask {
+        struct promise_type {
+            nettask get_return_object() { return nettask(); };
+            std::suspend_never initial_suspend() noexcept { return {}; };
+            std::suspend_never final_suspend() noexcept { return {}; };
+            void return_void() {};
+            void unhandled_exception() {
+                NETLOG_ERROR("Unhandled exception in coroutine!!");
+            };
+
+            static void* operator new( size_t size) {
+                return netframepool::get(size);
+            };
+            static void operator delete( void *frame, size_t size) {
+                netframepool::put(frame, size);
+            };
+        };
+    };
+
+    //Event handler for run(), see nethandler.h, that resumes coroutines
+    //  waiting on the loop *L* (netserver or netclient)
+    template <class L> class netcoro : public nethandler {
+
+    public:
+        //Frame length at the start of *data*, 0 if it isn't all there yet
+        typedef size_t (*frameFP)( const uint8_t *data, size_t length);
+
+        //Coroutine started for each new connection
+        typedef std::function<nettask( sock_t sd)> sessionFn;
+
+        netcoro( L& loop): net(loop) {};
+
+        //Destroy coroutines that are still waiting
+        ~netcoro() {
+            typename std::map<sock_t, conState>::iterator con_iter;
+            for (con_iter = cons.begin(); con_iter != cons.end(); con_iter++) {
+                if (con_iter->second.reader != NULL) {
+                    con_iter->second.reader->handle.destroy();
+                }
+                if (con_iter->second.writer != NULL) {
+                    con_iter->second.writer->handle.destroy();
+                }
+            }
+            typename std::map<sock_t, connectAwaiter*>::iterator wait_iter;
+            for (wait_iter = connecting.begin(); wait_iter != connecting.end();
+                 wait_iter++)
+            {
+                if constexpr (requires( L& l) { l.cancelConnect( 0); }) {
+                    net.cancelConnect( wait_iter->first);
+                }
+                wait_iter->second->handle.destroy();
+            }
+            typename std::map<size_t, std::coroutine_handle<> >::iterator
+                timer_iter;
+            for (timer_iter = sleepers.begin(); timer_iter != sleepers.end();
+                 timer_iter++)
+            {
+                net.cancelTimer( timer_iter->first);
+                timer_iter->second.destroy();
+            }
+        };
+
+        //Start *session* for every connection not made by connect()
+        void setSession( sessionFn session) { sessionStart = session; };
+
+        //
+        // Awaitables
+        //
+
+        //Wait for the next frame on *sd*, as a packet ready to read.  The
+        //  bytes stay valid until the coroutine's next co_await.  An empty
+        //  packet (get_maxsize() == 0) means the connection closed.
+        struct frameAwaiter {
+            netcoro& co;
+            sock_t sd;
+            size_t size;                //Fixed frame size, 0 = any
+            frameFP framer;             //Or frame length function
+            const uint8_t *data;
+            size_t length;
+            std::coroutine_handle<> handle;
+
+            bool await_ready() { return co.takeStashed( *this); };
+            void await_suspend( std::coroutine_handle<> h) {
+                handle = h;
+                co.cons[sd].reader = this;
+            };
+            netpacket await_resume() {
+                netpacket frame( length, (uint8_t*)data);
+                frame.ID = sd;
+                return frame;
+            };
+        };
+
+        //Next *size* bytes, or whatever arrived if *size* is 0
+        frameAwaiter readFrame( sock_t sd, size_t size = 0) {
+            return frameAwaiter{ *this, sd, size, NULL, NULL, 0, {} };
+        };
+
+        //Next frame, as long as *framer* says
+        frameAwaiter readFrame( sock_t sd, frameFP framer) {
+            return frameAwaiter{ *this, sd, 0, framer, NULL, 0, {} };
+        };
+
+        //Send *pkt*, and wait until the send queue of *sd* is empty again.
+        //  Returns sendPacket()'s result, -1 if the connection closed.
+        struct sendAwaiter {
+            netcoro& co;
+            sock_t sd;
+            netpacket& pkt;
+            int rv;
+            std::coroutine_handle<> handle;
+
+            bool await_ready() {
+                rv = co.net.sendPacket( sd, pkt);
+                return (rv < 0 || co.net.getQueued( sd) == 0);
+            };
+            void await_suspend( std::coroutine_handle<> h) {
+                handle = h;
+                co.cons[sd].writer = this;
+            };
+            int await_resume() { return rv; };
+        };
+
+        sendAwaiter send( sock_t sd, netpacket& pkt) {
+            return sendAwaiter{ *this, sd, pkt, 0, {} };
+        };
+
+        //Connect to *host*:*port* (netclient).  Returns the socket, or
+        //  INVALID_SOCKET if it could not connect.
+        struct connectAwaiter {
+            netcoro& co;
+            std::string host;
+            uint16_t port;
+            sock_t sd;
+            std::coroutine_handle<> handle;
+
+            bool await_ready() {
+                sd = co.net.doConnect( host, port);
+                return (sd == (sock_t)INVALID_SOCKET);
+            };
+            void await_suspend( std::coroutine_handle<> h) {
+                handle = h;
+                co.connecting[sd] = this;
+            };
+            sock_t await_resume() { return sd; };
+        };
+
+        connectAwaiter connect( const std::string& host, uint16_t port) {
+            return connectAwaiter{ *this, host, port,
+                                   (sock_t)INVALID_SOCKET, {} };
+        };
+
+        //Resume after *milliseconds*, from a netbase timer
+        struct sleepAwaiter {
+            netcoro& co;
+            unsigned int milliseconds;
+            std::coroutine_handle<> handle;
+
+            bool await_ready() { return false; };
+            void await_suspend( std::coroutine_handle<> h) {
+                handle = h;
+                co.sleepers[co.net.setTimer( milliseconds, wakeCB, this)] = h;
+            };
+            void await_resume() {};
+
+            //Timer fired, *CBD* is the awaiter
+            static void wakeCB( size_t timerID, void *CBD) {
+                sleepAwaiter *waiter = (sleepAwaiter*)CBD;
+                waiter->co.sleepers.erase(timerID);
+                waiter->handle.resume();
+            };
+        };
+
+        sleepAwaiter sleep( unsigned int milliseconds) {
+            return sleepAwaiter{ *this, milliseconds, {} };
+        };
+
+        //
+        // nethandler hooks, called from run()
+        //
+
+        //Serve frames straight from the receive buffer while a reader is
+        //  waiting.  Bytes nobody is waiting for are copied aside.
+        size_t onData( sock_t sd, netpacket *pkt) {
+            conState& con = cons[sd];
+            const uint8_t *data = pkt->get_ptr();
+            size_t length = pkt->get_maxsize(), size;
+
+            if (con.reader != NULL && con.stash.size() == con.stashRead) {
+                frameAwaiter *reader = con.reader;
+                size = frameLength( *reader, data, length);
+                if (size == 0) {
+                    return 0;
+                }
+                con.reader = NULL;
+                reader->data = data;
+                reader->length = size;
+                reader->handle.resume();
+                return size;
+            }
+
+            //Drop frames already read, then keep these bytes
+            con.stash.erase( con.stash.begin(),
+                             con.stash.begin() + con.stashRead);
+            con.stashRead = 0;
+            con.stash.insert( con.stash.end(), data, data + length);
+            deliverStashed( con);
+
+            return length;
+        };
+
+        //Resume connect() or start a session
+        void onConnect( sock_t sd) {
+            typename std::map<sock_t, connectAwaiter*>::iterator wait_iter;
+
+            //Descriptor reused: whoever waited on the old connection is done
+            onDisconnect( sd);
+            cons[sd] = conState();
+            wait_iter = connecting.find(sd);
+            if (wait_iter != connecting.end()) {
+                connectAwaiter *waiter = wait_iter->second;
+                connecting.erase(wait_iter);
+                waiter->handle.resume();
+            } else if (sessionStart) {
+                sessionStart( sd);
+            }
+        };
+
+        //Wake the reader and writer of *sd* with nothing
+        void onDisconnect( sock_t sd) {
+            typename std::map<sock_t, conState>::iterator con_iter;
+
+            con_iter = cons.find(sd);
+            if (con_iter == cons.end()) {
+                return;
+            }
+            frameAwaiter *reader = con_iter->second.reader;
+            sendAwaiter *writer = con_iter->second.writer;
+            cons.erase(con_iter);
+
+            if (reader != NULL) {
+                reader->data = NULL;
+                reader->length = 0;
+                reader->handle.resume();
+            }
+            if (writer != NULL) {
+                writer->rv = -1;
+                writer->handle.resume();
+            }
+        };
+
+        //connect() failed or timed out
+        void onConnectFailed( sock_t sd) {
+            typename std::map<sock_t, connectAwaiter*>::iterator wait_iter;
+
+            wait_iter = connecting.find(sd);
+            if (wait_iter != connecting.end()) {
+                connectAwaiter *waiter = wait_iter->second;
+                connecting.erase(wait_iter);
+                waiter->sd = (sock_t)INVALID_SOCKET;
+                waiter->handle.resume();
+            }
+        };
+
+        //Send queue of *sd* emptied
+        void onWritable( sock_t sd) {
+            typename std::map<sock_t, conState>::iterator con_iter;
+
+            con_iter = cons.find(sd);
+            if (con_iter == cons.end() || con_iter->second.writer == NULL) {
+                return;
+            }
+            sendAwaiter *writer = con_iter->second.writer;
+            con_iter->second.writer = NULL;
+            writer->handle.resume();
+        };
+
+    protected:
+        //Coroutines waiting on one connection
+        struct conState {
+            frameAwaiter *reader;
+            sendAwaiter *writer;
+            std::vector<uint8_t> stash;     //Arrived with no reader
+            size_t stashRead;               //Frames read from stash
+
+            conState(): reader(NULL), writer(NULL), stashRead(0) {};
+        };
+
+        L& net;
+        sessionFn sessionStart;
+        std::map<sock_t, conState> cons;
+        std::map<sock_t, connectAwaiter*> connecting;
+        std::map<size_t, std::coroutine_handle<> > sleepers;
+
+        //Length of the frame *reader* wants, 0 if not all there
+        static size_t frameLength( const frameAwaiter& reader,
+                                   const uint8_t *data, size_t length) {
+            size_t size;
+
+            if (reader.framer != NULL) {
+                size = reader.framer( data, length);
+                return (size <= length ? size : 0);
+            }
+            if (reader.size == 0) {
+                return length;
+            }
+            return (reader.size <= length ? reader.size : 0);
+        };
+
+        //Take a frame from the stash, for await_ready().  Connections
+        //  that are already closed give an empty frame.
+        bool takeStashed( frameAwaiter& reader) {
+            typename std::map<sock_t, conState>::iterator con_iter;
+            size_t size = 0;
+
+            con_iter = cons.find(reader.sd);
+            if (con_iter != cons.end()) {
+                conState& con = con_iter->second;
+                size = frameLength( reader, con.stash.data() + con.stashRead,
+                                    con.stash.size() - con.stashRead);
+            }
+            if (size == 0) {
+                if (net.isClosed(reader.sd)) {
+                    reader.data = NULL;
+                    reader.length = 0;
+                    return true;
+                }
+                return false;
+            }
+            conState& con = con_iter->second;
+            reader.data = con.stash.data() + con.stashRead;
+            reader.length = size;
+            con.stashRead += size;
+            return true;
+        };
+
+        //Resume the reader of *con* with stashed frames while it waits
+        void deliverStashed( conState& con) {
+            while (con.reader != NULL) {
+                frameAwaiter *reader = con.reader;
+                if (!takeStashed( *reader)) {
+                    return;
+                }
+                con.reader = NULL;
+                reader->handle.resume();
+            }
+        };
+    };
+}
+
+#endif
+
+#endif
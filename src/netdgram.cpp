@@ -0,0 +1,751 @@
+// netdgram: UDP sockets on the netbase event loop, read and sent in batches
+
+//net__
+#include "netdgram.h"
+
+#ifdef _WIN32
+    #include <ws2tcpip.h>
+#endif
+
+#include <cerrno>
+#include <cstring>
+
+//STL namespace
+using std::map;
+using std::string;
+using std::vector;
+using std::set;
+
+//net__ namespace
+using net__::netdgram;
+using net__::netpacket;
+using net__::netstats;
+
+//Constructor, specify the maximum sockets
+netdgram::netdgram( size_t maxSockets): netbase( maxSockets), host(NULL),
+    offload(true), maxDatagram(NETMM_DGRAM_SIZE)
+{
+    openLog();
+    NETLOG_INFO("===Starting datagram endpoint===");
+}
+
+//Close every socket still open
+netdgram::~netdgram()
+{
+    map<sock_t, dgramSocket>::iterator sock_iter;
+
+    for (sock_iter = sockets.begin(); sock_iter != sockets.end();
+         sock_iter++)
+    {
+        if (sock_iter->second.open) {
+            if (host != NULL) {
+                host->unwatchSocket(sock_iter->first);
+            }
+            removeSocket(sock_iter->first);
+        }
+    }
+
+    openLog();
+    NETLOG_INFO("===Ending datagram endpoint===");
+    closeLog();
+
+    //Now the base class destructor is invoked by C++
+}
+
+//Open a UDP socket, bind it, and turn on offload
+sock_t netdgram::openPort( uint16_t port, datagramFP cbFunc, void *cbData,
+                           const string& address)
+{
+    struct sockaddr_storage sad;
+    socklen_t sad_len;
+    sock_t sd;
+    dgramSocket sock;
+
+    if (sockets.size() >= conMax) {
+        lastError = "Too many sockets";
+        NETLOG_ERROR("{}, maximum {}", lastError, conMax);
+        return INVALID_SOCKET;
+    }
+
+    //IPv4 unless the address says otherwise
+    sad_len = inetAddress((address.empty() ? "0.0.0.0" : address), port, sad);
+    if (sad_len == 0) {
+        lastError = "Not a numeric address: " + address;
+        NETLOG_ERROR("{}", lastError);
+        return INVALID_SOCKET;
+    }
+
+    sd = socket( sad.ss_family, SOCK_DGRAM, 0);
+    if (sd == (sock_t)INVALID_SOCKET) {
+        lastError = "Could not create socket";
+        NETLOG_ERROR("{}: {}", lastError, getSocketError());
+        return INVALID_SOCKET;
+    }
+
+    //Non-blocking.  Not reusable: a second bind of the port must fail.
+    if (unblockSocket( sd, false) < 0) {
+        return INVALID_SOCKET;
+    }
+
+    if (bind(sd, (sockaddr*)&sad, sad_len) == SOCKET_ERROR) {
+        lastError = "Could not bind to " + address;
+        NETLOG_ERROR("#{} {}:{} {}", sd, lastError, port, getSocketError());
+        removeSocket(sd);
+        return INVALID_SOCKET;
+    }
+
+    sock.cbFunc = cbFunc;
+    sock.cbData = cbData;
+    sock.open = true;
+    sock.gro = false;
+    sock.gso = false;
+    sock.outSent = 0;
+
+#ifdef NETMM_USE_MMSG
+    //Older kernels don't have GRO for UDP.  GSO is found out on first use.
+    if (offload) {
+        int flag = 1;
+        sock.gro = (setsockopt(sd, IPPROTO_UDP, UDP_GRO, (char*)&flag,
+                               sizeof(flag)) == 0);
+        sock.gso = true;
+    }
+#endif
+
+    if (host != NULL && !host->watchSocket(sd, watchCB, this)) {
+        lastError = "Could not add socket to the loop";
+        NETLOG_ERROR("#{} {}", sd, lastError);
+        removeSocket(sd);
+        return INVALID_SOCKET;
+    }
+
+    sockets[sd] = sock;
+    closedSocketSet.erase(sd);
+    if (sdMax < sd) {
+        sdMax = sd;
+    }
+
+    NETLOG_INFO("#{} ** UDP port {}, gro={} **", sd, port, sock.gro);
+    return sd;
+}
+
+//Close now, forget the socket at the end of run()
+bool netdgram::closePort( sock_t sd)
+{
+    map<sock_t, dgramSocket>::iterator sock_iter = sockets.find(sd);
+
+    if (sock_iter == sockets.end() || !sock_iter->second.open) {
+        NETLOG_WARN("#{} was already closed", sd);
+        return false;
+    }
+
+    sock_iter->second.open = false;
+    sock_iter->second.out.clear();
+    sock_iter->second.outList.clear();
+    sock_iter->second.outSent = 0;
+    closedSocketSet.insert(sd);
+    if (host != NULL) {
+        host->unwatchSocket(sd);
+    }
+    return (removeSocket(sd) != SOCKET_ERROR);
+}
+
+//Queue a datagram for *to*
+int netdgram::sendTo( sock_t sd, const netpacket& pkt,
+                      const struct sockaddr_storage* to)
+{
+    map<sock_t, dgramSocket>::iterator sock_iter = sockets.find(sd);
+    const size_t length = pkt.get_write();
+    outEntry entry;
+
+    if (sock_iter == sockets.end() || !sock_iter->second.open) {
+        NETLOG_WARN("#{} socket not found for sendTo()?", sd);
+        return -1;
+    }
+    dgramSocket& sock = sock_iter->second;
+
+    if (to == NULL || addressLength(to) == 0 || length > NETMM_DGRAM_MAX) {
+        NETLOG_ERROR("#{} bad datagram, {} bytes", sd, length);
+        return -1;
+    }
+    if (sock.out.size() + length > conPolicy.maxSize) {
+        NETLOG_ERROR("#{} send queue full, {} bytes waiting", sd,
+            sock.out.size());
+        return -1;
+    }
+
+    entry.offset = sock.out.size();
+    entry.length = length;
+    memset(&entry.to, 0, sizeof(entry.to));
+    memcpy(&entry.to, to, addressLength(to));
+
+    sock.out.insert(sock.out.end(), pkt.get_ptr(), pkt.get_ptr() + length);
+    sock.outList.push_back(entry);
+
+    //Attached: the host loop sends it once the socket is writable
+    if (host != NULL && sock.outList.size() == sock.outSent + 1) {
+        watchOutput(sd, sock);
+    }
+
+    return (int)length;
+}
+
+//Queue a datagram for a numeric address
+int netdgram::sendTo( sock_t sd, const netpacket& pkt,
+                      const string& address, uint16_t port)
+{
+    struct sockaddr_storage to;
+
+    if (inetAddress(address, port, to) == 0) {
+        lastError = "Not a numeric address: " + address;
+        NETLOG_ERROR("#{} {}", sd, lastError);
+        return -1;
+    }
+
+    return sendTo( sd, pkt, &to);
+}
+
+//Send every socket's queue
+int netdgram::flush()
+{
+    map<sock_t, dgramSocket>::iterator sock_iter;
+    int sent = 0;
+
+    for (sock_iter = sockets.begin(); sock_iter != sockets.end();
+         sock_iter++)
+    {
+        if (sock_iter->second.open &&
+            sock_iter->second.outSent < sock_iter->second.outList.size())
+        {
+            sent += flushSocket(sock_iter->first, sock_iter->second);
+        }
+    }
+
+    return sent;
+}
+
+//Timers, then datagrams in, then datagrams out
+int netdgram::run()
+{
+    int rv = 0;
+
+    try {
+        //Timers that are due
+        if (!timers.empty()) {
+            fireTimers();
+        }
+
+        //Read all sockets, then send what the callbacks queued
+        if (!sockets.empty()) {
+            rv = readDatagrams();
+            flush();
+        }
+
+        forgetClosed();
+    }
+    catch(...) {
+        NETLOG_ERROR("Unhandled exception!!");
+        rv = -1;
+    };
+
+    return rv;
+}
+
+//Poll the sockets in *loop* from now on
+bool netdgram::attach( netbase& loop)
+{
+    map<sock_t, dgramSocket>::iterator sock_iter;
+
+    if (host != NULL || &loop == this) {
+        NETLOG_WARN("Can't attach datagram sockets again");
+        return false;
+    }
+    host = &loop;
+
+    for (sock_iter = sockets.begin(); sock_iter != sockets.end();
+         sock_iter++)
+    {
+        if (sock_iter->second.open) {
+            host->watchSocket(sock_iter->first, watchCB, this);
+            watchOutput(sock_iter->first, sock_iter->second);
+        }
+    }
+
+    NETLOG_INFO("Datagram sockets polled by another loop");
+    return true;
+}
+
+//Drop entries of closed sockets, once no callback is using them
+void netdgram::forgetClosed()
+{
+    set<sock_t>::const_iterator con_iter;
+
+    for (con_iter = closedSocketSet.begin();
+         con_iter != closedSocketSet.end(); con_iter++)
+    {
+        sockets.erase(*con_iter);
+    }
+    closedSocketSet.clear();
+}
+
+//Poll for writable only while there is something to send
+void netdgram::watchOutput( sock_t sd, const dgramSocket& sock)
+{
+    host->watchSocket(sd, watchCB, this, (sock.outSent < sock.outList.size()));
+}
+
+//An attached socket has datagrams, or room to send its queue
+void netdgram::watchCB( sock_t sd, bool readable, bool writable, void *CBD)
+{
+    netdgram *self = (netdgram*)CBD;
+    map<sock_t, dgramSocket>::iterator sock_iter = self->sockets.find(sd);
+
+    if (sock_iter == self->sockets.end() || !sock_iter->second.open) {
+        return;
+    }
+    dgramSocket& sock = sock_iter->second;
+
+    if (readable) {
+        self->recvBatch(sd, sock);
+    }
+
+    //Replies from the callbacks, and whatever waited for room
+    if (sock.open && (writable || sock.outSent < sock.outList.size())) {
+        self->flushSocket(sd, sock);
+    }
+    if (sock.open) {
+        self->watchOutput(sd, sock);
+    }
+
+    self->forgetClosed();
+}
+
+//Wait for datagrams on any socket, then read them in batches
+int netdgram::readDatagrams()
+{
+    map<sock_t, dgramSocket>::iterator sock_iter;
+    vector<sock_t> ready;
+    vector<sock_t>::const_iterator ready_iter;
+    uint64_t started = 0;
+    int rv, received = 0;
+
+    stats.loops++;
+    if (timing) {
+        started = getNanoTime();
+    }
+
+#ifdef NETMM_USE_POLL
+    dgramPoll.clear();
+    for (sock_iter = sockets.begin(); sock_iter != sockets.end();
+         sock_iter++)
+    {
+        if (sock_iter->second.open) {
+            struct pollfd entry;
+            entry.fd = sock_iter->first;
+            entry.events = POLLIN;
+            entry.revents = 0;
+            dgramPoll.push_back(entry);
+        }
+    }
+    if (dgramPoll.empty()) {
+        return 0;
+    }
+    rv = poll(&dgramPoll[0], dgramPoll.size(),
+        (timeout.tv_sec * 1000) + (timeout.tv_usec / 1000));
+#else
+    FD_ZERO( &dgramSet);
+    for (sock_iter = sockets.begin(); sock_iter != sockets.end();
+         sock_iter++)
+    {
+        if (sock_iter->second.open) {
+            FD_SET( (unsigned int)sock_iter->first, &dgramSet);
+        }
+    }
+    rv = select(sdMax+1, &dgramSet, (fd_set *) 0, (fd_set *) 0, &timeout);
+#endif
+    stats.selectCalls++;
+    if (timing) {
+        loopHist[TIME_SELECT].record(getNanoTime() - started);
+    }
+
+    if (rv == SOCKET_ERROR) {
+        NETLOG_ERROR("Datagram select error:{}", getSocketError());
+        return -1;
+    }
+    if (rv == 0) {
+        return 0;
+    }
+
+    //Copy ready sockets, callbacks may close some
+#ifdef NETMM_USE_POLL
+    vector<struct pollfd>::const_iterator poll_iter;
+    for (poll_iter = dgramPoll.begin(); poll_iter != dgramPoll.end();
+         poll_iter++)
+    {
+        if (poll_iter->revents != 0) {
+            ready.push_back(poll_iter->fd);
+        }
+    }
+#else
+    for (sock_iter = sockets.begin(); sock_iter != sockets.end();
+         sock_iter++)
+    {
+        if (FD_ISSET( sock_iter->first, &dgramSet)) {
+            ready.push_back(sock_iter->first);
+        }
+    }
+#endif
+
+    for (ready_iter = ready.begin(); ready_iter != ready.end(); ready_iter++) {
+        sock_iter = sockets.find(*ready_iter);
+        if (sock_iter != sockets.end() && sock_iter->second.open) {
+            received += recvBatch(sock_iter->first, sock_iter->second);
+        }
+    }
+
+    if (timing) {
+        loopHist[TIME_LOOP].record(getNanoTime() - started);
+    }
+    return received;
+}
+
+#ifdef NETMM_USE_MMSG
+//Receive a batch of datagrams per system call, until the socket is empty
+int netdgram::recvBatch( sock_t sd, dgramSocket& sock)
+{
+    //GRO slots hold up to 64KB of joined datagrams each
+    const size_t slots = (sock.gro ? NETMM_DGRAM_BATCH / 8 :
+                          NETMM_DGRAM_BATCH);
+    const size_t slotSize = (sock.gro ? NETMM_DGRAM_MAX : maxDatagram);
+    struct mmsghdr msgs[NETMM_DGRAM_BATCH];
+    struct iovec iovs[NETMM_DGRAM_BATCH];
+    struct sockaddr_storage addrs[NETMM_DGRAM_BATCH];
+    union {
+        struct cmsghdr align;
+        char space[CMSG_SPACE(sizeof(int))];
+    } cmsgs[NETMM_DGRAM_BATCH];
+    struct cmsghdr *header;
+    size_t round, index, segment;
+    int rv, received = 0;
+
+    if (recvBuf.size() < slots * slotSize) {
+        recvBuf.resize(slots * slotSize);
+    }
+
+    for (round = 0; round < NETMM_DGRAM_ROUNDS && sock.open; round++) {
+        memset(msgs, 0, sizeof(msgs[0]) * slots);
+        for (index = 0; index < slots; index++) {
+            iovs[index].iov_base = &recvBuf[index * slotSize];
+            iovs[index].iov_len = slotSize;
+            msgs[index].msg_hdr.msg_iov = &iovs[index];
+            msgs[index].msg_hdr.msg_iovlen = 1;
+            msgs[index].msg_hdr.msg_name = &addrs[index];
+            msgs[index].msg_hdr.msg_namelen = sizeof(addrs[index]);
+            if (sock.gro) {
+                msgs[index].msg_hdr.msg_control = cmsgs[index].space;
+                msgs[index].msg_hdr.msg_controllen =
+                    sizeof(cmsgs[index].space);
+            }
+        }
+
+        rv = recvmmsg(sd, msgs, slots, MSG_DONTWAIT, NULL);
+        stats.recvCalls++;
+        if (rv == SOCKET_ERROR) {
+            if (isWouldBlock()) {
+                stats.wouldBlock++;
+            } else {
+                NETLOG_WARN("#{} recvmmsg error: {}", sd, getSocketError());
+            }
+            break;
+        }
+
+        for (index = 0; index < (size_t)rv && sock.open; index++) {
+            if (msgs[index].msg_hdr.msg_flags & MSG_TRUNC) {
+                NETLOG_WARN("#{} datagram longer than {} dropped", sd,
+                    slotSize);
+                continue;
+            }
+
+            //Size of the datagrams GRO joined together
+            segment = 0;
+            for (header = CMSG_FIRSTHDR(&msgs[index].msg_hdr);
+                 header != NULL;
+                 header = CMSG_NXTHDR(&msgs[index].msg_hdr, header))
+            {
+                if (header->cmsg_level == IPPROTO_UDP &&
+                    header->cmsg_type == UDP_GRO)
+                {
+                    int size;
+                    memcpy(&size, CMSG_DATA(header), sizeof(size));
+                    segment = size;
+                }
+            }
+
+            deliver(sd, sock, &recvBuf[index * slotSize], msgs[index].msg_len,
+                segment, &addrs[index]);
+        }
+        received += rv;
+
+        //Socket is empty
+        if ((size_t)rv < slots) {
+            break;
+        }
+    }
+
+    return received;
+}
+
+//Send queued datagrams in batches, runs to one address as one GSO send
+int netdgram::flushSocket( sock_t sd, dgramSocket& sock)
+{
+    struct mmsghdr msgs[NETMM_DGRAM_BATCH];
+    struct iovec iovs[NETMM_DGRAM_BATCH];
+    size_t counts[NETMM_DGRAM_BATCH];
+    union {
+        struct cmsghdr align;
+        char space[CMSG_SPACE(sizeof(uint16_t))];
+    } cmsgs[NETMM_DGRAM_BATCH];
+    struct cmsghdr *header;
+    size_t count, index, run, sentIndex;
+    int rv, sent = 0, error;
+
+    while (sock.outSent < sock.outList.size()) {
+
+        //Fill a batch, starting from the first unsent datagram
+        memset(msgs, 0, sizeof(msgs));
+        index = sock.outSent;
+        for (count = 0; count < NETMM_DGRAM_BATCH &&
+             index < sock.outList.size(); count++)
+        {
+            outEntry& entry = sock.outList[index];
+            run = (sock.gso ? runLength(sock, index) : 1);
+            outEntry& last = sock.outList[index + run - 1];
+
+            //Queued datagrams are contiguous in sock.out
+            iovs[count].iov_base = &sock.out[entry.offset];
+            iovs[count].iov_len = last.offset + last.length - entry.offset;
+            msgs[count].msg_hdr.msg_iov = &iovs[count];
+            msgs[count].msg_hdr.msg_iovlen = 1;
+            msgs[count].msg_hdr.msg_name = &entry.to;
+            msgs[count].msg_hdr.msg_namelen = addressLength(&entry.to);
+
+            if (run > 1) {
+                uint16_t segment = (uint16_t)entry.length;
+                memset(&cmsgs[count], 0, sizeof(cmsgs[count]));
+                msgs[count].msg_hdr.msg_control = cmsgs[count].space;
+                msgs[count].msg_hdr.msg_controllen =
+                    sizeof(cmsgs[count].space);
+                header = CMSG_FIRSTHDR(&msgs[count].msg_hdr);
+                header->cmsg_level = IPPROTO_UDP;
+                header->cmsg_type = UDP_SEGMENT;
+                header->cmsg_len = CMSG_LEN(sizeof(segment));
+                memcpy(CMSG_DATA(header), &segment, sizeof(segment));
+            }
+            counts[count] = run;
+            index += run;
+        }
+
+        rv = sendmmsg(sd, msgs, count, NETMM_SEND_FLAGS);
+        stats.sendCalls++;
+        if (rv == SOCKET_ERROR) {
+            error = errno;
+            if (isWouldBlock()) {
+                stats.wouldBlock++;
+                break;
+            }
+
+            //No GSO here after all: send them one by one from now on
+            if (counts[0] > 1 && (error == EIO || error == EINVAL)) {
+                NETLOG_WARN("#{} no UDP segmentation offload: {}", sd,
+                    getSocketError());
+                sock.gso = false;
+                continue;
+            }
+
+            //Unreachable, or refused by an earlier ICMP.  Drop the first.
+            NETLOG_WARN("#{} datagram dropped: {}", sd, getSocketError());
+            sock.outSent += counts[0];
+            continue;
+        }
+
+        for (sentIndex = 0; sentIndex < (size_t)rv; sentIndex++) {
+            sock.outSent += counts[sentIndex];
+            sent += counts[sentIndex];
+            stats.messagesOut += counts[sentIndex];
+            stats.bytesOut += iovs[sentIndex].iov_len;
+        }
+    }
+
+    //All sent, or keep the rest for the next run()
+    if (sock.outSent == sock.outList.size()) {
+        sock.out.clear();
+        sock.outList.clear();
+        sock.outSent = 0;
+    } else if (sock.outSent > 0) {
+        size_t start = sock.outList[sock.outSent].offset;
+        sock.out.erase(sock.out.begin(), sock.out.begin() + start);
+        sock.outList.erase(sock.outList.begin(),
+                           sock.outList.begin() + sock.outSent);
+        for (index = 0; index < sock.outList.size(); index++) {
+            sock.outList[index].offset -= start;
+        }
+        sock.outSent = 0;
+    }
+
+    return sent;
+}
+#else
+//One datagram per system call
+int netdgram::recvBatch( sock_t sd, dgramSocket& sock)
+{
+    struct sockaddr_storage from;
+#ifdef _WIN32
+    int fromLen;
+#else
+    socklen_t fromLen;
+#endif
+    size_t count;
+    int rv, received = 0;
+
+    if (recvBuf.size() < maxDatagram) {
+        recvBuf.resize(maxDatagram);
+    }
+
+    for (count = 0; count < NETMM_DGRAM_BATCH * NETMM_DGRAM_ROUNDS &&
+         sock.open; count++)
+    {
+        fromLen = sizeof(from);
+        rv = recvfrom(sd, (char*)&recvBuf[0], maxDatagram, 0,
+                      (sockaddr*)&from, &fromLen);
+        stats.recvCalls++;
+        if (rv == SOCKET_ERROR) {
+            if (isWouldBlock()) {
+                stats.wouldBlock++;
+            } else {
+                NETLOG_WARN("#{} recvfrom error: {}", sd, getSocketError());
+            }
+            break;
+        }
+        deliver(sd, sock, &recvBuf[0], rv, 0, &from);
+        received++;
+    }
+
+    return received;
+}
+
+//Send queued datagrams one at a time
+int netdgram::flushSocket( sock_t sd, dgramSocket& sock)
+{
+    int rv, sent = 0;
+
+    while (sock.outSent < sock.outList.size()) {
+        outEntry& entry = sock.outList[sock.outSent];
+        rv = sendto(sd, (const char*)&sock.out[entry.offset], entry.length,
+                    NETMM_SEND_FLAGS, (sockaddr*)&entry.to,
+                    addressLength(&entry.to));
+        stats.sendCalls++;
+        if (rv == SOCKET_ERROR) {
+            if (isWouldBlock()) {
+                stats.wouldBlock++;
+                break;
+            }
+            NETLOG_WARN("#{} datagram dropped: {}", sd, getSocketError());
+        } else {
+            sent++;
+            stats.messagesOut++;
+            stats.bytesOut += rv;
+        }
+        sock.outSent++;
+    }
+
+    if (sock.outSent == sock.outList.size()) {
+        sock.out.clear();
+        sock.outList.clear();
+        sock.outSent = 0;
+    }
+
+    return sent;
+}
+#endif
+
+//Split what GRO joined, and run the callback for each datagram
+void netdgram::deliver( sock_t sd, dgramSocket& sock, uint8_t *data,
+                        size_t length, size_t segment,
+                        const struct sockaddr_storage *from)
+{
+    size_t offset, size;
+    uint64_t called = 0;
+
+    if (segment == 0 || segment > length) {
+        segment = length;
+    }
+
+    stats.bytesIn += length;
+    offset = 0;
+    do {
+        size = (length - offset < segment ? length - offset : segment);
+
+        netpacket pkt( size, data + offset);
+        pkt.ID = sd;
+        stats.messagesIn++;
+        stats.callbacks++;
+        if (timing) {
+            called = getNanoTime();
+        }
+        sock.cbFunc( &pkt, from, sock.cbData);
+        if (timing) {
+            loopHist[TIME_HANDLER].record(getNanoTime() - called);
+        }
+
+        offset += size;
+    } while (offset < length && sock.open);
+}
+
+//Same address, same size (the last may be shorter), within GSO limits
+size_t netdgram::runLength( const dgramSocket& sock, size_t first) const
+{
+    const outEntry& head = sock.outList[first];
+    const int headLength = addressLength(&head.to);
+    size_t count = 1, total = head.length;
+
+    while (first + count < sock.outList.size() &&
+           count < NETMM_DGRAM_SEGMENTS)
+    {
+        const outEntry& next = sock.outList[first + count];
+
+        //One UDP datagram carries all the segments
+        if (next.length == 0 || next.length > head.length ||
+            total + next.length > NETMM_DGRAM_MAX - 0x200 ||
+            memcmp(&next.to, &head.to, headLength) != 0)
+        {
+            break;
+        }
+        total += next.length;
+        count++;
+
+        //A shorter datagram ends the run
+        if (next.length < head.length) {
+            break;
+        }
+    }
+
+    return count;
+}
+
+//Counters, with open sockets and queued datagrams
+netstats netdgram::getStats() const
+{
+    netstats snapshot = netbase::getStats();
+    map<sock_t, dgramSocket>::const_iterator sock_iter;
+
+    snapshot.connections = 0;
+    for (sock_iter = sockets.begin(); sock_iter != sockets.end();
+         sock_iter++)
+    {
+        if (sock_iter->second.open) {
+            snapshot.connections++;
+            snapshot.queuedBytes += sock_iter->second.out.size();
+        }
+    }
+
+    return snapshot;
+}
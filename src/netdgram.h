@@ -0,0 +1,156 @@
+//netdgram.h
+#ifndef NETDGRAM_H
+#define NETDGRAM_H
+
+//
+// UDP endpoints on the netbase event loop: timers, stats and logging work
+//  the same as for netserver and netclient.  Datagrams are read and sent
+//  in batches, with recvmmsg()/sendmmsg() where there are (Linux).  With
+//  offload on, the kernel joins received datagrams (UDP_GRO) and splits
+//  sent runs of same size datagrams (UDP_SEGMENT), so a batch of 64 can
+//  be one system call each way.  Other systems use recvfrom()/sendto().
+//
+//  A netdgram polls its sockets in its own run().  Next to a netserver or
+//  netclient, attach() it to that loop instead, so one poll() waits for
+//  connections and datagrams alike:
+//
+//    netserver server(100);
+//    netdgram udp(4);
+//    udp.attach( server);
+//    udp.openPort( 5000, onDatagram, NULL);
+//    while (...) server.run();
+//
+
+#include "netbase.h"
+
+namespace net__ {
+    class netdgram : public netbase {
+
+    public:
+        //Datagram callback.  *pkt* is one datagram, ready to read, only
+        //  valid until the callback returns.  pkt->ID is the socket.
+        typedef void (*datagramFP)( netpacket* pkt,
+                                    const struct sockaddr_storage* from,
+                                    void *cb_data);
+
+        netdgram( size_t maxSockets);
+        ~netdgram();
+
+        //Open a UDP socket on local *port* (0 = any) and numeric IPv4 or
+        //  IPv6 *address* ("" = any IPv4, "::" = any IPv6).  Datagrams go
+        //  to *cbFunc*.  Returns the socket, INVALID_SOCKET if the port
+        //  is already bound.
+        sock_t openPort( uint16_t port, datagramFP cbFunc, void *cbData,
+                         const std::string& address = "");
+
+        //Close a socket from openPort(), dropping anything unsent
+        bool closePort( sock_t sd);
+
+        //Queue datagram *pkt* to *to*, or to numeric *address*:*port*,
+        //  of the same family as the socket.
+        //  Queued datagrams go out together at the end of run(), or on
+        //  flush().  Returns the datagram length, -1 on error.
+        int sendTo( sock_t sd, const netpacket& pkt,
+                    const struct sockaddr_storage* to);
+        int sendTo( sock_t sd, const netpacket& pkt,
+                    const std::string& address, uint16_t port);
+
+        //Send queued datagrams now.  Returns the number sent.
+        int flush();
+
+        //Fire timers, read datagrams and send what was queued
+        int run();
+
+        //Have *loop*'s run() poll the sockets, read them and send their
+        //  queues, instead of run().  Timers then go on *loop* too.
+        //  *loop* must outlive this netdgram.
+        bool attach( netbase& loop);
+
+        //Use GRO/GSO for sockets opened after this, if the system has
+        //  them.  On by default.
+        void setOffload( bool enable) { offload = enable; };
+
+        //Largest datagram received without offload.  Longer ones are
+        //  dropped as truncated.  Default NETMM_DGRAM_SIZE.
+        void setMaxDatagram( size_t size) { maxDatagram = size; };
+
+        //Counters, with queued datagrams
+        netstats getStats() const;
+
+          //Datagrams per recvmmsg()/sendmmsg() call
+        static const size_t NETMM_DGRAM_BATCH = 64;
+          //Default largest datagram, and the most there can be
+        static const size_t NETMM_DGRAM_SIZE = 0x800;
+        static const size_t NETMM_DGRAM_MAX = 0x10000;
+          //Receive batches per socket in one run()
+        static const size_t NETMM_DGRAM_ROUNDS = 8;
+          //Most segments the kernel splits one send into
+        static const size_t NETMM_DGRAM_SEGMENTS = 64;
+
+    protected:
+        //Datagram waiting to be sent, in dgramSocket::out
+        struct outEntry {
+            size_t offset;
+            size_t length;
+            struct sockaddr_storage to;
+        };
+
+        //One socket from openPort()
+        struct dgramSocket {
+            datagramFP cbFunc;
+            void *cbData;
+            bool open;          //False once closePort() is called
+            bool gro;           //Kernel joins received datagrams
+            bool gso;           //Kernel splits sent runs
+            std::vector<uint8_t> out;
+            std::vector<outEntry> outList;
+            size_t outSent;     //Entries of outList already sent
+        };
+        std::map<sock_t, dgramSocket> sockets;
+#ifdef NETMM_USE_POLL
+        std::vector<struct pollfd> dgramPoll;
+#else
+        fd_set dgramSet;
+#endif
+
+          //Loop the sockets are polled in, NULL for run()
+        netbase *host;
+          //GRO/GSO for new sockets
+        bool offload;
+          //Receive slot size without GRO
+        size_t maxDatagram;
+          //Receive slots, shared by all sockets
+        std::vector<uint8_t> recvBuf;
+
+        //Read every socket that has datagrams waiting
+        int readDatagrams();
+
+        //Forget sockets closed by closePort()
+        void forgetClosed();
+
+        //Ask the host loop to tell us when *sd* can send, if it has a queue
+        void watchOutput( sock_t sd, const dgramSocket& sock);
+
+        //Host loop callback for a socket, *CBD* is the netdgram
+        static void watchCB( sock_t sd, bool readable, bool writable,
+                             void *CBD);
+
+        //Read up to NETMM_DGRAM_ROUNDS batches from *sd*
+        int recvBatch( sock_t sd, dgramSocket& sock);
+
+        //Pass one received buffer to the callback, split into datagrams
+        //  of *segment* bytes if GRO joined them
+        void deliver( sock_t sd, dgramSocket& sock, uint8_t *data,
+                      size_t length, size_t segment,
+                      const struct sockaddr_storage *from);
+
+        //Send the queue of one socket.  Returns datagrams sent.
+        int flushSocket( sock_t sd, dgramSocket& sock);
+
+        //Datagrams from *first* to the same address with the same length
+        //  (the last may be shorter), that GSO can send as one
+        size_t runLength( const dgramSocket& sock, size_t first) const;
+    };
+}
+
+#endif
@@ -0,0 +1,42 @@
+//nethandle.h
+#ifndef NETHANDLE_H
+#define NETHANDLE_H
+
+//
+// Handle to one connection: its socket descriptor, and which connection
+//  on that descriptor it was.  Descriptors are reused as soon as a socket
+//  is closed, so work queued for an old connection could otherwise reach
+//  a new one.  netbase checks the generation on every handle call, and
+//  rejects handles to connections that are gone.
+//
+
+#ifdef _MSC_VER
+    #include "ms_stdint.h"
+#else
+    #include <stdint.h>
+#endif
+
+namespace net__ {
+    struct nethandle {
+        uint32_t index;         //Socket descriptor
+        uint32_t generation;    //Connection on that descriptor, 0 = none
+
+        //Null handle, never valid
+        nethandle(): index(0), generation(0) {};
+        nethandle( uint32_t i, uint32_t g): index(i), generation(g) {};
+
+        bool isNull() const { return (generation == 0); };
+
+        bool operator==( const nethandle& other) const {
+            return (index == other.index && generation == other.generation); };
+        bool operator!=( const nethandle& other) const {
+            return !(*this == other); };
+
+        //Order for std::map and std::set
+        bool operator<( const nethandle& other) const {
+            return (index < other.index ||
+                (index == other.index && generation < other.generation)); };
+    };
+}
+
+#endif
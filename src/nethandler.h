@@ -0,0 +1,46 @@
+//nethandler.h
+#ifndef NETHANDLER_H
+#define NETHANDLER_H
+
+//
+// Event handler for netserver::run(H&) and netclient::run(H&).  Derive from
+//  nethandler and hide the hooks you need; the rest do nothing.  Nothing is
+//  virtual: run() is a template on the handler type, so onData() is called
+//  directly and can be inlined into the receive loop, with no callback map
+//  lookups.  Connect, connect failed, disconnect and writable events are
+//  rare, and go through connectionFP callbacks pointed at the handler for
+//  that run() only: the callbacks set before it are back once it returns.
+//
+//    struct echo : public nethandler {
+//        netserver *server;
+//        size_t onData( sock_t sd, netpacket *pkt) {
+//            server->sendPacket( sd, *pkt);
+//            return pkt->get_maxsize(); };
+//    };
+//
+
+#include "netpacket.h"
+
+namespace net__ {
+    struct nethandler {
+        //Bytes arrived on *sd*.  Return the number of bytes read from
+        //  *pkt*, the same as a netPktCB.  Called again with the rest of
+        //  the bytes while it returns more than 0.
+        size_t onData( sock_t sd, netpacket *pkt) { return 0; };
+
+        //Connection *sd* was accepted, or finished connecting
+        void onConnect( sock_t sd) {};
+
+        //Connect *sd*, from doConnect(), failed or timed out.  *sd* is
+        //  already closed.
+        void onConnectFailed( sock_t sd) {};
+
+        //Connection *sd* closed on the other side, or failed
+        void onDisconnect( sock_t sd) {};
+
+        //Everything queued by sendPacket() on *sd* has been sent
+        void onWritable( sock_t sd) {};
+    };
+}
+
+#endif
@@ -0,0 +1,138 @@
+// nethistogram: Log-bucketed value histogram with percentiles
+
+#include "nethistogram.h"
+
+#include <string.h>
+
+//STL namespace
+using std::ostream;
+
+//net__ namespace
+using net__::nethistogram;
+
+//Constructor, empty
+nethistogram::nethistogram()
+{
+    clear();
+}
+
+//Count one value
+void nethistogram::record( uint64_t value)
+{
+    buckets[bucketOf(value)]++;
+    count++;
+    total += value;
+    if (value < minimum) {
+        minimum = value;
+    }
+    if (value > maximum) {
+        maximum = value;
+    }
+}
+
+//Forget all values
+void nethistogram::clear()
+{
+    memset(buckets, 0, sizeof(buckets));
+    count = total = maximum = 0;
+    minimum = ~(uint64_t)0;
+}
+
+//Add another histogram's counts to this one
+void nethistogram::merge( const nethistogram& other)
+{
+    unsigned int bucket;
+
+    for (bucket = 0; bucket < NETMM_HIST_BUCKETS; bucket++) {
+        buckets[bucket] += other.buckets[bucket];
+    }
+    count += other.count;
+    total += other.total;
+    if (other.minimum < minimum) {
+        minimum = other.minimum;
+    }
+    if (other.maximum > maximum) {
+        maximum = other.maximum;
+    }
+}
+
+//Walk the buckets until *percent* of the values are counted
+uint64_t nethistogram::percentile( double percent) const
+{
+    uint64_t target, seen = 0, value;
+    unsigned int bucket;
+
+    if (count == 0) {
+        return 0;
+    }
+    if (percent >= 100.0) {
+        return maximum;
+    }
+
+    target = (uint64_t)((percent / 100.0) * (double)count + 0.5);
+    if (target == 0) {
+        target = 1;
+    }
+
+    for (bucket = 0; bucket < NETMM_HIST_BUCKETS; bucket++) {
+        seen += buckets[bucket];
+        if (seen >= target) {
+            value = bucketMax(bucket);
+            return (value > maximum ? maximum : value);
+        }
+    }
+
+    return maximum;
+}
+
+//Export summary lines
+void nethistogram::write( ostream& out, const char *name) const
+{
+    out << name << "_count " << count << "\n"
+        << name << "_min " << getMin() << "\n"
+        << name << "_p50 " << percentile(50.0) << "\n"
+        << name << "_p90 " << percentile(90.0) << "\n"
+        << name << "_p99 " << percentile(99.0) << "\n"
+        << name << "_p999 " << percentile(99.9) << "\n"
+        << name << "_max " << maximum << "\n";
+}
+
+//Values below NETMM_HIST_SUB have their own bucket.  Above that, the
+//  highest bit picks the power of 2 and the next 4 bits the sub-bucket.
+unsigned int nethistogram::bucketOf( uint64_t value)
+{
+    unsigned int msb, shift;
+
+    if (value < NETMM_HIST_SUB) {
+        return (unsigned int)value;
+    }
+
+#ifdef __GNUC__
+    msb = 63 - __builtin_clzll(value);
+#else
+    for (msb = 0; (value >> msb) > 1; msb++) {
+        ;
+    }
+#endif
+
+    shift = msb - NETMM_HIST_SUB_BITS;
+    return ((shift + 1) << NETMM_HIST_SUB_BITS) +
+           (unsigned int)((value >> shift) - NETMM_HIST_SUB);
+}
+
+//Largest value that falls in *bucket*
+uint64_t nethistogram::bucketMax( unsigned int bucket)
+{
+    unsigned int shift;
+    uint64_t top;
+
+    if (bucket < NETMM_HIST_SUB) {
+        return bucket;
+    }
+
+    shift = (bucket >> NETMM_HIST_SUB_BITS) - 1;
+    top = NETMM_HIST_SUB + (bucket & (NETMM_HIST_SUB - 1));
+
+    //Wraps to the largest uint64_t for the last bucket
+    return ((top + 1) << shift) - 1;
+}
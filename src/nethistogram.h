@@ -0,0 +1,64 @@
+//nethistogram.h
+#ifndef NETHISTOGRAM_H
+#define NETHISTOGRAM_H
+
+//
+// Log-bucketed histogram of durations (or any non-negative values).
+//  Each power of 2 is split into 16 linear buckets, so any value is
+//  reported within 1/16 (6.25%) of what was recorded, from 1 up to 2^64,
+//  in a fixed 8KB of counts.  record() is a few shifts and an increment.
+//
+
+#ifdef _MSC_VER
+    #include "ms_stdint.h"
+#else
+    #include <stdint.h>
+#endif
+
+#include <iostream>
+
+namespace net__ {
+    class nethistogram {
+
+    public:
+        nethistogram();
+
+        //Count one value
+        void record( uint64_t value);
+
+        //Forget all values
+        void clear();
+
+        //Add the counts of *other*
+        void merge( const nethistogram& other);
+
+        //Smallest value that *percent* of the recorded values are <= to
+        //  (within the bucket resolution).  0 if nothing was recorded.
+        uint64_t percentile( double percent) const;
+
+        uint64_t getCount() const { return count; };
+        uint64_t getMin() const { return (count > 0 ? minimum : 0); };
+        uint64_t getMax() const { return maximum; };
+        uint64_t getMean() const { return (count > 0 ? total / count : 0); };
+
+        //Write "<name>_count", _min, _p50, _p90, _p99, _p999, _max lines
+        void write( std::ostream& out, const char *name) const;
+
+        //
+        // Public constants
+        //
+        static const unsigned int NETMM_HIST_SUB_BITS = 4;
+        static const unsigned int NETMM_HIST_SUB = (1 << NETMM_HIST_SUB_BITS);
+        static const unsigned int NETMM_HIST_BUCKETS = 64 * NETMM_HIST_SUB;
+
+    protected:
+        uint64_t buckets[NETMM_HIST_BUCKETS];
+        uint64_t count, total, minimum, maximum;
+
+        //Bucket for *value*, and the largest value in a bucket
+        static unsigned int bucketOf( uint64_t value);
+        static uint64_t bucketMax( unsigned int bucket);
+    };
+}
+
+#endif
@@ -0,0 +1,265 @@
+// netlog: Lock-free log ring, written to disk by a background thread
+
+#include "netlog.h"
+
+//STL namespace
+using std::ofstream;
+using std::ios;
+
+//net__ namespace
+using net__::netlog;
+using net__::netlogArg;
+using net__::netlock;
+using net__::netmutex;
+using net__::netsemaphore;
+using net__::netthread;
+
+//Atomic operations on ring positions
+#ifdef _MSC_VER
+    #define NETLOG_CAS(ptr, oldval, newval) \
+        (InterlockedCompareExchange((volatile LONG*)(ptr), \
+            (LONG)(newval), (LONG)(oldval)) == (LONG)(oldval))
+    #define NETLOG_INCREMENT(ptr) InterlockedIncrement((volatile LONG*)(ptr))
+    #define NETLOG_BARRIER() MemoryBarrier()
+#else
+    #define NETLOG_CAS(ptr, oldval, newval) \
+        __sync_bool_compare_and_swap((ptr), (oldval), (newval))
+    #define NETLOG_INCREMENT(ptr) __sync_fetch_and_add((ptr), 1)
+    #define NETLOG_BARRIER() __sync_synchronize()
+#endif
+
+//Static members
+netlog::record *netlog::ring = NULL;
+volatile uint32_t netlog::head = 0;
+volatile uint32_t netlog::tail = 0;
+volatile uint32_t netlog::dropped = 0;
+volatile bool netlog::running = false;
+int netlog::minLevel = NETMM_LOG_LEVEL;
+unsigned int netlog::users = 0;
+netmutex netlog::openLock;
+netsemaphore netlog::wakeup;
+netthread netlog::writer;
+ofstream netlog::file;
+
+//Copy text inline if it fits, otherwise to the heap
+void netlogArg::setText( const char *val, size_t length)
+{
+    if (length < NETMM_LOG_TEXT) {
+        type = ARG_TEXT;
+        memcpy(value.text, val, length + 1);
+    } else {
+        type = ARG_HEAPTEXT;
+        value.heap = new char[length + 1];
+        memcpy(value.heap, val, length + 1);
+    }
+}
+
+//Open log file, start writer thread if it isn't running
+bool netlog::open( const char *filename)
+{
+    netlock lock(openLock);
+    uint32_t slot;
+
+    if (users > 0) {
+        users++;
+        return running;
+    }
+
+    //Ring is never freed: a late caller may still be writing to it
+    if (ring == NULL) {
+        ring = new record[NETMM_LOG_RING];
+        for (slot = 0; slot < NETMM_LOG_RING; slot++) {
+            ring[slot].sequence = slot;
+        }
+        head = tail = 0;
+    }
+
+    file.open(filename, ios::out | ios::app);
+    if (!file.is_open()) {
+        return false;
+    }
+
+    dropped = 0;
+    running = true;
+    NETLOG_BARRIER();
+    if (!writer.start(writerMain, NULL)) {
+        running = false;
+        file.close();
+        return false;
+    }
+
+    users = 1;
+    return true;
+}
+
+//Stop writer thread after the last user closes
+void netlog::close()
+{
+    netlock lock(openLock);
+
+    if (users == 0 || --users > 0) {
+        return;
+    }
+
+    if (running) {
+        running = false;
+        NETLOG_BARRIER();
+        wakeup.post();
+        writer.join();
+    }
+    if (file.is_open()) {
+        file.close();
+    }
+}
+
+//Claim a slot and copy the record in, or count it dropped
+void netlog::write( int level, const char *format, const netlogArg& a1,
+    const netlogArg& a2, const netlogArg& a3, const netlogArg& a4)
+{
+    const netlogArg *args[NETMM_LOG_ARGS] = { &a1, &a2, &a3, &a4 };
+    record *slot;
+    uint32_t pos, sequence;
+    int32_t diff;
+    size_t arg;
+    bool claimed = false;
+
+    //Slot is free when its sequence equals the write position
+    pos = tail;
+    while (running && level >= minLevel) {
+        slot = &ring[pos & (NETMM_LOG_RING - 1)];
+        sequence = slot->sequence;
+        NETLOG_BARRIER();
+        diff = (int32_t)(sequence - pos);
+
+        if (diff == 0) {
+            if (NETLOG_CAS(&tail, pos, pos + 1)) {
+                claimed = true;
+                break;
+            }
+        } else if (diff < 0) {
+            //Writer thread is behind a full ring
+            NETLOG_INCREMENT(&dropped);
+            break;
+        }
+        pos = tail;
+    }
+
+    //Not logging, or no room
+    if (!claimed) {
+        for (arg = 0; arg < NETMM_LOG_ARGS; arg++) {
+            freeArgs(args[arg], 1);
+        }
+        return;
+    }
+
+    slot->format = format;
+    for (arg = 0; arg < NETMM_LOG_ARGS; arg++) {
+        slot->args[arg] = *args[arg];
+    }
+
+    //Publish to the writer thread
+    NETLOG_BARRIER();
+    slot->sequence = pos + 1;
+}
+
+//Drop records below *level* at run time
+void netlog::setLevel( int level)
+{
+    minLevel = level;
+}
+
+//Records lost since open()
+uint32_t netlog::getDropped()
+{
+    return dropped;
+}
+
+//Format records as they are published, flush whenever the ring is empty
+void netlog::writerMain( void *)
+{
+    uint32_t reported = 0, lost;
+    const netlogArg *arg;
+    const char *format;
+    record *slot;
+    bool stopping;
+    size_t count, next;
+
+    for (;;) {
+        stopping = !running;
+        NETLOG_BARRIER();
+        count = 0;
+
+        for (;;) {
+            slot = &ring[head & (NETMM_LOG_RING - 1)];
+            if ((int32_t)(slot->sequence - (head + 1)) < 0) {
+                break;
+            }
+            NETLOG_BARRIER();
+
+            //Replace each {} with the next argument
+            next = 0;
+            for (format = slot->format; *format != '\0'; format++) {
+                if (format[0] != '{' || format[1] != '}' ||
+                    next >= NETMM_LOG_ARGS)
+                {
+                    file.put(*format);
+                    continue;
+                }
+                arg = &slot->args[next++];
+                switch (arg->type) {
+                    case netlogArg::ARG_INT:
+                        file << (long long)arg->value.i;
+                        break;
+                    case netlogArg::ARG_UINT:
+                        file << (unsigned long long)arg->value.u;
+                        break;
+                    case netlogArg::ARG_TEXT:
+                        file << arg->value.text;
+                        break;
+                    case netlogArg::ARG_HEAPTEXT:
+                        file << arg->value.heap;
+                        break;
+                    default:
+                        break;
+                }
+                format++;
+            }
+            file << '\n';
+            freeArgs(slot->args, NETMM_LOG_ARGS);
+
+            //Hand slot back to the writers, one lap ahead
+            NETLOG_BARRIER();
+            slot->sequence = head + NETMM_LOG_RING;
+            head = head + 1;
+            count++;
+        }
+
+        lost = dropped;
+        if (lost != reported) {
+            file << "netlog: " << (lost - reported) << " records dropped\n";
+            reported = lost;
+        }
+
+        if (count > 0) {
+            file.flush();
+        }
+        if (stopping) {
+            break;
+        }
+        if (count == 0) {
+            wakeup.wait(NETMM_LOG_FLUSH_TIME);
+        }
+    }
+}
+
+//Heap text is owned by the record until written or dropped
+void netlog::freeArgs( const netlogArg *args, size_t count)
+{
+    size_t arg;
+
+    for (arg = 0; arg < count; arg++) {
+        if (args[arg].type == netlogArg::ARG_HEAPTEXT) {
+            delete[] args[arg].value.heap;
+        }
+    }
+}
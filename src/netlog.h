@@ -0,0 +1,177 @@
+//netlog.h
+#ifndef NETLOG_H
+#define NETLOG_H
+
+//
+// Asynchronous log.  Callers copy a binary record (format string pointer
+//  and up to 4 arguments) into a lock-free ring; a background thread
+//  formats the records and writes them to network.log.  When the ring is
+//  full, records are dropped and counted instead of blocking the caller.
+//
+//  Use the NETLOG_* macros.  Levels below NETMM_LOG_LEVEL compile to
+//  nothing, arguments included.  Format strings must be literals; each
+//  {} is replaced by the next argument:
+//
+//      NETLOG_DEBUG("#{} recv {} bytes", sd, rv);
+//
+
+#include "netthread.h"
+
+#ifdef _MSC_VER
+    #include "ms_stdint.h"
+#else
+    #include <stdint.h>
+#endif
+
+#include <string.h>
+
+//STL classes
+#include <string>
+#include <fstream>
+
+//Log levels
+#define NETMM_LOG_DEBUG     1
+#define NETMM_LOG_INFO      2
+#define NETMM_LOG_WARN      3
+#define NETMM_LOG_ERROR     4
+#define NETMM_LOG_NONE      5
+
+//Lowest level compiled in.  Debug builds log everything, others nothing.
+#ifndef NETMM_LOG_LEVEL
+  #ifdef DEBUG
+    #define NETMM_LOG_LEVEL NETMM_LOG_DEBUG
+  #else
+    #define NETMM_LOG_LEVEL NETMM_LOG_NONE
+  #endif
+#endif
+
+#if NETMM_LOG_LEVEL <= NETMM_LOG_DEBUG
+  #define NETLOG_DEBUG(...) net__::netlog::write(NETMM_LOG_DEBUG, __VA_ARGS__)
+#else
+  #define NETLOG_DEBUG(...) ((void)0)
+#endif
+
+#if NETMM_LOG_LEVEL <= NETMM_LOG_INFO
+  #define NETLOG_INFO(...) net__::netlog::write(NETMM_LOG_INFO, __VA_ARGS__)
+#else
+  #define NETLOG_INFO(...) ((void)0)
+#endif
+
+#if NETMM_LOG_LEVEL <= NETMM_LOG_WARN
+  #define NETLOG_WARN(...) net__::netlog::write(NETMM_LOG_WARN, __VA_ARGS__)
+#else
+  #define NETLOG_WARN(...) ((void)0)
+#endif
+
+#if NETMM_LOG_LEVEL <= NETMM_LOG_ERROR
+  #define NETLOG_ERROR(...) net__::netlog::write(NETMM_LOG_ERROR, __VA_ARGS__)
+#else
+  #define NETLOG_ERROR(...) ((void)0)
+#endif
+
+namespace net__ {
+
+    //One tagged log argument, copied into the record
+    struct netlogArg {
+
+        //Argument types
+        enum argType {
+            ARG_NONE,
+            ARG_INT,
+            ARG_UINT,
+            ARG_TEXT,       //Short text, inline
+            ARG_HEAPTEXT    //Longer text, freed by the writer thread
+        };
+
+        static const size_t NETMM_LOG_TEXT = 24;
+
+        uint8_t type;
+        union {
+            int64_t i;
+            uint64_t u;
+            char *heap;
+            char text[NETMM_LOG_TEXT];
+        } value;
+
+        netlogArg(): type(ARG_NONE) { ; };
+        netlogArg( int val): type(ARG_INT) { value.i = val; };
+        netlogArg( long val): type(ARG_INT) { value.i = val; };
+        netlogArg( long long val): type(ARG_INT) { value.i = val; };
+        netlogArg( unsigned int val): type(ARG_UINT) { value.u = val; };
+        netlogArg( unsigned long val): type(ARG_UINT) { value.u = val; };
+        netlogArg( unsigned long long val): type(ARG_UINT) { value.u = val; };
+        netlogArg( const char *val) {
+            if (val == NULL) {
+                val = "(null)";         //As printf() shows it
+            }
+            setText(val, strlen(val)); };
+        netlogArg( const std::string& val) {
+            setText(val.c_str(), val.length()); };
+
+        //Copy text inline if it fits, otherwise to the heap
+        void setText( const char *val, size_t length);
+    };
+
+    class netlog {
+
+    public:
+        //Start the writer thread (first caller), appending to *filename*
+        static bool open( const char *filename = "network.log");
+
+        //Stop the writer thread (last caller), after writing every record
+        static void close();
+
+        //Queue a record.  Use the NETLOG_* macros instead.
+        static void write( int level, const char *format,
+                           const netlogArg& a1 = netlogArg(),
+                           const netlogArg& a2 = netlogArg(),
+                           const netlogArg& a3 = netlogArg(),
+                           const netlogArg& a4 = netlogArg());
+
+        //Ignore levels below *level* (NETMM_LOG_LEVEL is the lowest)
+        static void setLevel( int level);
+
+        //Records lost to a full ring since open()
+        static uint32_t getDropped();
+
+        //
+        // Public constants
+        //
+          //Ring slots, must be a power of 2
+        static const uint32_t NETMM_LOG_RING = 0x2000;
+          //Writer thread wakes up at least this often (ms)
+        static const unsigned int NETMM_LOG_FLUSH_TIME = 50;
+        static const size_t NETMM_LOG_ARGS = 4;
+
+    protected:
+        //Ring slot.  *sequence* says whether it is free or full.
+        struct record {
+            volatile uint32_t sequence;
+            const char *format;
+            netlogArg args[NETMM_LOG_ARGS];
+        };
+
+        static record *ring;
+        static volatile uint32_t head, tail;    //Read, write positions
+        static volatile uint32_t dropped;
+        static volatile bool running;
+        static int minLevel;
+        static unsigned int users;
+
+        static netmutex openLock;
+        static netsemaphore wakeup;
+        static netthread writer;
+        static std::ofstream file;
+
+        //Writer thread: format and write records until close()
+        static void writerMain( void *data);
+
+        //Free heap text owned by a record that won't be written
+        static void freeArgs( const netlogArg *args, size_t count);
+
+    private:
+        netlog();
+    };
+}
+
+#endif
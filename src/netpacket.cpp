@@ -1,6 +1,6 @@
 
 #include "netpacket.h"
-#include <winsock2.h>
+#include "netplatform.h"
 #include <cstring>
 
 //
@@ -13,7 +13,7 @@ using net__::netpacket;
 //Destructor
 netpacket::~netpacket() {
     if (delete_data) {
-        delete data;
+        delete[] data;
         data = NULL;
     }
 }
@@ -35,11 +35,12 @@ void netpacket::set_write( size_t p) { pos_write = p;}
 //Read arbitrary class in network byte order
 template <class T> size_t netpacket::read( T& val)
 {
-    static uint32_t x = 0xFFFF0000;
+    const uint32_t order = 0xFFFF0000;
     const size_t size = sizeof(T);
+    size_t x;
 
     //Check if byte order needs to be reversed
-    if ( ntohl(x) == x ) {
+    if ( ntohl(order) == order ) {
         //Copy the data with no change
         memcpy( &val, data + pos_read, size); //copy all bytes
     } else {
@@ -176,6 +177,32 @@ size_t netpacket::read(uint8_t *val, size_t size)
     return pos_read;
 }
 
+//Point at character string in packet, no copy
+size_t netpacket::read_view(const char* &val, size_t size)
+{
+    if (size > get_unread()) {
+        val = NULL;
+        return pos_read;
+    }
+    val = (const char*)(data + pos_read);
+    pos_read += size;
+
+    return pos_read;
+}
+
+//Point at byte array in packet, no copy
+size_t netpacket::read_view(const uint8_t* &val, size_t size)
+{
+    if (size > get_unread()) {
+        val = NULL;
+        return pos_read;
+    }
+    val = data + pos_read;
+    pos_read += size;
+
+    return pos_read;
+}
+
 //short array.. use network to host conversion
 size_t netpacket::read (uint16_t *val, size_t count)
 {
@@ -189,17 +216,24 @@ size_t netpacket::read (uint16_t *val, size_t count)
     return pos_read;
 }
 
+//int array, through the generic template
+size_t netpacket::read (uint32_t *val, size_t count)
+{
+    return netpacket::read<uint32_t>( val, count);
+}
+
 //
 //Append data to packet in "network byte order".  int16_t, int32_t, float, double.
 //
 
 //Append any class (reverse its bytes on x86)
 template <class T> size_t netpacket::append(T val) {
-        static uint32_t x = 0xFFFF0000;
+        const uint32_t order = 0xFFFF0000;
         const size_t size = sizeof(T);
+        size_t x;
 
         //Check if byte order needs to be reversed
-        if ( htonl(x) == x ) {
+        if ( htonl(order) == order ) {
                 //Copy the data with no change
                 memcpy( data + pos_write, &val, size); //copy all bytes
         } else {
@@ -223,8 +257,7 @@ template <class T> size_t netpacket::append( const T *val_array, size_t size)
         netpacket::append<T>( val_array[n] );
     }
     
-    //pos_write was incremented by netpacket::append<T>()
-    pos_write += size;
+    //pos_write was already incremented by netpacket::append<T>()
     return pos_write;
 }
 
@@ -248,6 +281,15 @@ size_t netpacket::append (uint8_t val)
         return pos_write;
 }
 
+//8 bit signed byte
+size_t netpacket::append (int8_t& val)
+{
+        data[pos_write] = (uint8_t)val;
+        pos_write++;
+        
+        return pos_write;
+}
+
 //8 bit character                     
 size_t netpacket::append (char val)
 {
@@ -339,7 +381,13 @@ size_t netpacket::append (const uint16_t *val, size_t count)
     for (index = 0; index < count; index++, pos_write += sizeof(uint16_t)) {
         *(int16_t*)(data + pos_write) = htons(val[index]);
     }
-    return count;
+    return pos_write;
+}
+
+//int array, through the generic template
+size_t netpacket::append (const uint32_t *val, size_t count)
+{
+    return netpacket::append<uint32_t>( val, count);
 }
 
 //TODO: wchar_t array
@@ -91,6 +91,13 @@ namespace net__ {
             
             //Return pointer to entire packet data
             const uint8_t* get_ptr() const { return data; };
+            
+            //Return pointer to unread packet data
+            const uint8_t* get_read_ptr() const { return data + pos_read; };
+            
+            //Return bytes left to read (received packets: up to maxsize)
+            size_t get_unread() const {
+                return (pos_read < maxsize ? maxsize - pos_read : 0); };
         
         //Read from packet
             size_t read (bool& val);      //1 bit integer (uses 8 bits)
@@ -107,6 +114,14 @@ namespace net__ {
             size_t read (char *val, size_t size);     //Character string
             size_t read (uint8_t *val, size_t size);  //byte array
             size_t read (uint16_t *val, size_t size); //short array
+            size_t read (uint32_t *val, size_t size); //int array
+
+        //Read from packet without copying.  *val* points into the packet
+        //  data, and is only valid as long as the packet's buffer is (for
+        //  received packets: until the callback returns).  If fewer than
+        //  *size* bytes remain, *val* is set to NULL and nothing is read.
+            size_t read_view (const char* &val, size_t size);    //String
+            size_t read_view (const uint8_t* &val, size_t size); //Byte array
     
         //Append to packet
     
@@ -124,6 +139,7 @@ namespace net__ {
             size_t append (const char *val, size_t size);    //Char array
             size_t append (const uint8_t *val, size_t size); //byte array
             size_t append (const uint16_t *val, size_t size);//short array
+            size_t append (const uint32_t *val, size_t size);//int array
     
         //Reset position (to reuse the packet without resizing)
             void set_read( size_t p=0);
@@ -0,0 +1,64 @@
+//netplatform.h
+#ifndef NETPLATFORM_H
+#define NETPLATFORM_H
+
+//
+// Socket headers for Windows (winsock) and POSIX systems.  Defines the
+//  winsock names that netbase uses on POSIX, so both share one code path:
+//  INVALID_SOCKET, SOCKET_ERROR.  Readiness is select() on Windows, and
+//  poll() everywhere else (NETMM_USE_POLL), which has no FD_SETSIZE limit.
+//
+
+#ifdef _WIN32
+    #include <winsock2.h>
+    #include <ws2tcpip.h>     //socklen_t
+#else
+    #include <sys/types.h>
+    #include <sys/socket.h>
+    #include <sys/select.h>
+    #include <sys/uio.h>
+    #include <sys/un.h>
+    #include <netinet/in.h>
+    #include <netinet/tcp.h>
+    #include <arpa/inet.h>
+    #include <netdb.h>
+    #include <fcntl.h>
+    #include <unistd.h>
+    #include <poll.h>
+
+    #ifndef INVALID_SOCKET
+        #define INVALID_SOCKET  (-1)
+    #endif
+    #ifndef SOCKET_ERROR
+        #define SOCKET_ERROR    (-1)
+    #endif
+
+    #define NETMM_USE_POLL
+#endif
+
+//Linux reads and sends datagrams in batches (recvmmsg, sendmmsg), and
+//  can join and split them in the kernel (UDP_GRO, UDP_SEGMENT).  It has
+//  memfd and eventfd for shared memory connections (netshm).
+#ifdef __linux__
+    #include <netinet/udp.h>
+    #include <sys/mman.h>
+    #include <sys/eventfd.h>
+
+    #define NETMM_USE_MMSG
+    #define NETMM_USE_SHM
+    #ifndef UDP_SEGMENT
+        #define UDP_SEGMENT     103
+    #endif
+    #ifndef UDP_GRO
+        #define UDP_GRO         104
+    #endif
+#endif
+
+//Don't raise SIGPIPE when sending to a closed connection
+#ifdef MSG_NOSIGNAL
+    #define NETMM_SEND_FLAGS MSG_NOSIGNAL
+#else
+    #define NETMM_SEND_FLAGS 0
+#endif
+
+#endif
@@ -0,0 +1,230 @@
+// netpool: Reuse connections to one endpoint
+
+#include "netpool.h"
+
+//STL namespace
+using std::map;
+using std::set;
+using std::string;
+using std::endl;
+
+//net__ namespace
+using net__::netclient;
+using net__::nethandle;
+using net__::netpacket;
+using net__::netpool;
+
+//Constructor, nothing connects until warm(), checkout() or run()
+netpool::netpool( netclient& cl, const string& addr, uint16_t p,
+    size_t minimum, size_t maximum): client(cl), address(addr), port(p),
+    minSize(minimum), maxSize(maximum), idleTime(NETMM_POOL_IDLE_TIME),
+    backoffMin(NETMM_BACKOFF_MIN), backoffMax(NETMM_BACKOFF_MAX),
+    backoff(NETMM_BACKOFF_MIN), retryTime(0)
+{
+    if (maxSize < minSize) {
+        maxSize = minSize;
+    }
+}
+
+//Destructor, close everything the pool owns
+netpool::~netpool()
+{
+    set<nethandle>::const_iterator iter;
+    set<nethandle>::const_iterator busy_iter;
+    map<nethandle, uint64_t>::const_iterator idle_iter;
+
+    for (iter = connecting.begin(); iter != connecting.end(); iter++) {
+        client.cancelConnect(*iter);
+    }
+    for (idle_iter = idle.begin(); idle_iter != idle.end(); idle_iter++) {
+        if (client.isValid(idle_iter->first)) {
+            client.disconnect(idle_iter->first);
+        }
+    }
+    for (busy_iter = busy.begin(); busy_iter != busy.end(); busy_iter++) {
+        if (client.isValid(*busy_iter)) {
+            client.disconnect(*busy_iter);
+        }
+    }
+}
+
+//Pre-connect up to minSize
+int netpool::warm()
+{
+    int started = 0;
+
+    while (getSize() < minSize && connectOne()) {
+        started++;
+    }
+
+    return started;
+}
+
+//Hand out an idle connection
+nethandle netpool::checkout()
+{
+    map<nethandle, uint64_t>::iterator iter;
+    nethandle h;
+
+    while (!idle.empty()) {
+        iter = idle.begin();
+        h = iter->first;
+        idle.erase(iter);
+
+        //Peer may have closed it while idle
+        if (!client.isValid(h)) {
+            continue;
+        }
+
+        client.unsetConPktCB(client.getSocket(h));
+        busy.insert(h);
+        return h;
+    }
+
+    //Nothing idle: grow the pool for the next caller
+    if (getSize() < maxSize) {
+        connectOne();
+    }
+
+    return nethandle();
+}
+
+//Take connection back from the caller
+void netpool::checkin( nethandle h, bool healthy)
+{
+    if (busy.erase(h) == 0) {
+        NETLOG_WARN("#{} not checked out of pool", h.index);
+        return;
+    }
+
+    if (!client.isValid(h)) {
+        return;
+    }
+    if (!healthy) {
+        client.disconnect(h);
+        return;
+    }
+
+    client.unsetConPktCB(client.getSocket(h));
+    makeIdle(h);
+}
+
+//Promote finished connects, evict idle and dead connections, refill
+int netpool::run()
+{
+    set<nethandle>::iterator iter;
+    set<nethandle>::iterator busy_iter;
+    map<nethandle, uint64_t>::iterator idle_iter;
+    const uint64_t now = netbase::getTime();
+    int changed = 0;
+    nethandle h;
+
+    //Connections in progress
+    for (iter = connecting.begin(); iter != connecting.end(); ) {
+        h = *iter;
+        if (client.isConnecting(h)) {
+            iter++;
+            continue;
+        }
+        connecting.erase(iter++);
+        changed++;
+
+        //Closed, or closed and reused for someone else's connection
+        if (!client.isValid(h)) {
+            //Failed: wait before trying again, a little longer each time
+            retryTime = now + backoff;
+            backoff = (backoff << 1);
+            if (backoff > backoffMax) {
+                backoff = backoffMax;
+            }
+            NETLOG_WARN("#{} pool connect to {} failed, retry in {}ms",
+                h.index, address, (retryTime - now));
+        } else {
+            backoff = backoffMin;
+            makeIdle(h);
+        }
+    }
+
+    //Idle connections: drop dead ones, and old ones above minSize
+    for (idle_iter = idle.begin(); idle_iter != idle.end(); ) {
+        h = idle_iter->first;
+        if (!client.isValid(h)) {
+            idle.erase(idle_iter++);
+            changed++;
+        } else if (idleTime > 0 && now - idle_iter->second >= idleTime &&
+                   getSize() > minSize)
+        {
+            idle.erase(idle_iter++);
+            client.disconnect(h);
+            changed++;
+        } else {
+            idle_iter++;
+        }
+    }
+
+    //Checked out connections the peer closed
+    for (busy_iter = busy.begin(); busy_iter != busy.end(); ) {
+        if (!client.isValid(*busy_iter)) {
+            busy.erase(busy_iter++);
+            changed++;
+        } else {
+            busy_iter++;
+        }
+    }
+
+    //Lazily reconnect up to minSize
+    changed += warm();
+
+    return changed;
+}
+
+//Set idle eviction time
+void netpool::setIdleTime( unsigned int milliseconds)
+{
+    idleTime = milliseconds;
+}
+
+//Set reconnect backoff
+void netpool::setBackoff( unsigned int minDelay, unsigned int maxDelay)
+{
+    backoffMin = minDelay;
+    backoffMax = (maxDelay < minDelay ? minDelay : maxDelay);
+    backoff = backoffMin;
+}
+
+//Start a connection, unless still backing off from a failure
+bool netpool::connectOne()
+{
+    sock_t sd;
+
+    if (netbase::getTime() < retryTime) {
+        return false;
+    }
+
+    sd = client.doConnect(address, port);
+    if (sd == (sock_t)INVALID_SOCKET) {
+        retryTime = netbase::getTime() + backoff;
+        return false;
+    }
+
+    connecting.insert(client.getConnectHandle(sd));
+    return true;
+}
+
+//Park connection in the idle set, with a callback that watches it
+void netpool::makeIdle( nethandle h)
+{
+    idle[h] = netbase::getTime();
+    client.setConPktCB(client.getSocket(h), idleCB, &client);
+}
+
+//Nobody asked for this data: drop the connection
+size_t netpool::idleCB( netpacket* pkt, void *CBD)
+{
+    netclient *cl = (netclient*)CBD;
+
+    NETLOG_WARN("#{} data on idle pool connection", pkt->ID);
+    cl->disconnect(pkt->ID);
+
+    return 0;
+}
@@ -0,0 +1,104 @@
+//netpool.h
+#ifndef NETPOOL_H
+#define NETPOOL_H
+
+//
+// Pool of warm connections to one endpoint, on top of a netclient.
+//  Check out a connection, use it, check it back in for the next caller.
+//  run() keeps the pool between its minimum and maximum size, evicts
+//  idle connections and reconnects with exponential backoff.
+//
+//  Idle connections get a pool callback: any data arriving while idle
+//  means the connection is out of step, so it is dropped.
+//
+//  Connections are handed out as nethandles, so a caller holding on to a
+//  connection the pool already dropped can't reach whoever reused its
+//  socket descriptor.
+//
+
+#include "netclient.h"
+
+//STL classes
+#include <map>
+#include <set>
+#include <string>
+
+namespace net__ {
+    class netpool {
+
+    public:
+        //Pool of connections to address:port, made through *client*
+        netpool( netclient& client, const std::string& address,
+                 uint16_t port, size_t minSize = 0,
+                 size_t maxSize = NETMM_POOL_SIZE);
+        ~netpool();     //Disconnects every pooled connection
+
+        //Start connecting until minSize connections exist
+        int warm();
+
+        //Take an idle connection, or a null handle if none is ready
+        //  (a new one is started if the pool is below maxSize)
+        nethandle checkout();
+
+        //Give connection back.  Unhealthy connections are closed.
+        void checkin( nethandle h, bool healthy = true);
+
+        //Maintain the pool.  Call after client.run()
+        int run();
+
+        //Milliseconds idle before a connection above minSize is closed
+        void setIdleTime( unsigned int milliseconds);
+
+        //Reconnect delay after a failure, doubled up to maxDelay
+        void setBackoff( unsigned int minDelay, unsigned int maxDelay);
+
+        //Pool sizes
+        size_t getIdle() const { return idle.size(); };
+        size_t getBusy() const { return busy.size(); };
+        size_t getConnecting() const { return connecting.size(); };
+        size_t getSize() const {
+            return idle.size() + busy.size() + connecting.size(); };
+
+        //
+        // Public constants
+        //
+        static const size_t NETMM_POOL_SIZE = 8;
+        static const unsigned int NETMM_POOL_IDLE_TIME = 60000;
+        static const unsigned int NETMM_BACKOFF_MIN = 100;
+        static const unsigned int NETMM_BACKOFF_MAX = 30000;
+
+    protected:
+        netclient& client;
+        std::string address;
+        uint16_t port;
+        size_t minSize, maxSize;
+
+          //Idle connections, and when they were checked in
+        std::map<nethandle, uint64_t> idle;
+          //Checked out connections
+        std::set<nethandle> busy;
+          //Connections in progress, by handle: a failed connect's socket
+          //  descriptor may be reused before run() looks at it
+        std::set<nethandle> connecting;
+
+          //Eviction and reconnect timing
+        unsigned int idleTime;
+        unsigned int backoffMin, backoffMax, backoff;
+        uint64_t retryTime;
+
+        //Start one new connection, unless backing off
+        bool connectOne();
+
+        //Connection is ready for reuse
+        void makeIdle( nethandle h);
+
+        //Callback for data on idle connections, *CBD* is the netclient
+        static size_t idleCB( netpacket* pkt, void *CBD);
+
+    private:
+        netpool( const netpool&);
+        netpool& operator=( const netpool&);
+    };
+}
+
+#endif
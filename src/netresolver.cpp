@@ -0,0 +1,257 @@
+// netresolver: Resolve host names on worker threads, cache the results
+
+#include "netresolver.h"
+
+//Platform support
+#ifdef _WIN32
+    #include <ws2tcpip.h>
+#else
+    #include <netdb.h>
+#endif
+
+#include <cstring>
+
+//STL namespace
+using std::deque;
+using std::map;
+using std::string;
+using std::vector;
+
+//net__ namespace
+using net__::netbase;
+using net__::netlock;
+using net__::netresolver;
+using net__::netthread;
+
+//Constructor, workers are started by the first resolve()
+netresolver::netresolver( size_t threads): cacheTime(NETMM_CACHE_TIME),
+    failCacheTime(NETMM_FAIL_CACHE_TIME), lastPurge(0), resolveCB(NULL),
+    resolveCBD(NULL), stopping(false), workerCount(threads)
+{
+    if (workerCount == 0) {
+        workerCount = 1;
+    }
+}
+
+//Destructor, waits for lookups in progress
+netresolver::~netresolver()
+{
+    stopWorkers();
+}
+
+//Check cache and lookups in progress
+netresolver::resolveState netresolver::lookup( const string& host,
+    struct sockaddr_storage& addr)
+{
+    map<string, cacheEntry>::iterator iter = cache.find(host);
+
+    if (iter != cache.end()) {
+        if (iter->second.expires <= netbase::getTime()) {
+            cache.erase(iter);
+        } else if (iter->second.found) {
+            addr = iter->second.addr;
+            return RESOLVE_FOUND;
+        } else {
+            return RESOLVE_FAILED;
+        }
+    }
+
+    if (inflight.count(host) != 0) {
+        return RESOLVE_PENDING;
+    }
+    return RESOLVE_UNKNOWN;
+}
+
+//Queue *host* for the workers
+netresolver::resolveState netresolver::resolve( const string& host)
+{
+    struct sockaddr_storage addr;
+    resolveState state = lookup(host, addr);
+
+    //Already known, or someone asked first
+    if (state != RESOLVE_UNKNOWN) {
+        return state;
+    }
+
+    if (workers.empty() && !startWorkers()) {
+        return RESOLVE_FAILED;
+    }
+
+    inflight.insert(host);
+    {
+        netlock lock(queueLock);
+        requests.push_back(host);
+    }
+    requestSignal.post();
+
+    return RESOLVE_PENDING;
+}
+
+//Move finished lookups into the cache, then tell the callback
+int netresolver::poll()
+{
+    deque<resolveResult> finished;
+    deque<resolveResult>::const_iterator iter;
+    cacheEntry entry;
+    uint64_t now;
+
+    if (inflight.empty()) {
+        return 0;
+    }
+
+    //Take everything the workers finished
+    {
+        netlock lock(queueLock);
+        finished.swap(results);
+    }
+    if (finished.empty()) {
+        return 0;
+    }
+
+    now = netbase::getTime();
+    purgeCache(now);
+
+    for (iter = finished.begin(); iter != finished.end(); iter++) {
+        entry.addr = iter->addr;
+        entry.found = iter->found;
+        entry.expires = now + (iter->found ? cacheTime : failCacheTime);
+        cache[iter->host] = entry;
+        inflight.erase(iter->host);
+
+        if (resolveCB != NULL) {
+            resolveCB( iter->host, (iter->found ? &(iter->addr) : NULL),
+                       resolveCBD);
+        }
+    }
+
+    return (int)finished.size();
+}
+
+//Set callback for finished lookups
+void netresolver::setResolveCB( resolveFP cbFunc, void *cbData)
+{
+    resolveCB = cbFunc;
+    resolveCBD = cbData;
+}
+
+//Set cache times in milliseconds
+void netresolver::setCacheTime( unsigned int found, unsigned int failed)
+{
+    cacheTime = found;
+    failCacheTime = failed;
+}
+
+//Forget all cached names
+void netresolver::clearCache()
+{
+    cache.clear();
+}
+
+//Drop expired entries, at most once per cacheTime
+void netresolver::purgeCache( uint64_t now)
+{
+    map<string, cacheEntry>::iterator iter;
+
+    if (now - lastPurge < cacheTime) {
+        return;
+    }
+    lastPurge = now;
+
+    for (iter = cache.begin(); iter != cache.end(); ) {
+        if (iter->second.expires <= now) {
+            cache.erase(iter++);
+        } else {
+            iter++;
+        }
+    }
+}
+
+//Start workerCount threads
+bool netresolver::startWorkers()
+{
+    size_t index;
+    netthread *worker;
+
+    for (index = 0; index < workerCount; index++) {
+        worker = new netthread();
+        if (!worker->start(workerMain, this)) {
+            delete worker;
+            break;
+        }
+        workers.push_back(worker);
+    }
+
+    return !workers.empty();
+}
+
+//Tell workers to quit, then wait for them
+void netresolver::stopWorkers()
+{
+    vector<netthread*>::iterator iter;
+
+    {
+        netlock lock(queueLock);
+        stopping = true;
+    }
+    for (iter = workers.begin(); iter != workers.end(); iter++) {
+        requestSignal.post();
+    }
+    for (iter = workers.begin(); iter != workers.end(); iter++) {
+        (*iter)->join();
+        delete (*iter);
+    }
+    workers.clear();
+}
+
+//Worker: take a name, resolve it, post the result
+void netresolver::workerMain( void *data)
+{
+    netresolver *self = (netresolver*)data;
+    resolveResult result;
+
+    for (;;) {
+        self->requestSignal.wait();
+        {
+            netlock lock(self->queueLock);
+            if (self->stopping) {
+                return;
+            }
+            if (self->requests.empty()) {
+                continue;
+            }
+            result.host = self->requests.front();
+            self->requests.pop_front();
+        }
+
+        result.found = getAddress(result.host, result.addr);
+        {
+            netlock lock(self->queueLock);
+            self->results.push_back(result);
+        }
+    }
+}
+
+//Blocking getaddrinfo() lookup.  The first address is the one the system
+//  prefers (RFC 6724), IPv6 or IPv4: destinations it has no route to sort
+//  last.
+bool netresolver::getAddress( const string& host,
+    struct sockaddr_storage& addr)
+{
+    struct addrinfo hints, *info = NULL;
+    bool found = false;
+
+    memset(&hints, 0, sizeof(hints));
+    memset(&addr, 0, sizeof(addr));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+
+    if (getaddrinfo(host.c_str(), NULL, &hints, &info) == 0 && info != NULL) {
+        memcpy(&addr, info->ai_addr, info->ai_addrlen);
+        found = true;
+    }
+    if (info != NULL) {
+        freeaddrinfo(info);
+    }
+
+    return found;
+}
@@ -0,0 +1,132 @@
+//netresolver.h
+#ifndef NETRESOLVER_H
+#define NETRESOLVER_H
+
+//
+// Host name resolution off the event loop.  getaddrinfo() runs on a small
+//  pool of worker threads; results are cached and handed back to the loop
+//  thread by poll().  Concurrent requests for one name share one lookup.
+//
+
+#include "netbase.h"
+#include "netthread.h"
+
+//Platform support
+#include "netplatform.h"
+
+//STL classes
+#include <deque>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+namespace net__ {
+    class netresolver {
+
+    public:
+        //State of a name, from lookup() or resolve()
+        enum resolveState {
+            RESOLVE_UNKNOWN,    //Not cached, not being resolved
+            RESOLVE_PENDING,    //Being resolved
+            RESOLVE_FOUND,      //Cached address
+            RESOLVE_FAILED      //Cached failure
+        };
+
+        //Callback when a name is resolved.  *addr* is NULL if it failed.
+        typedef void (*resolveFP)( const std::string& host,
+                                   const struct sockaddr_storage *addr,
+                                   void *cb_data);
+
+        //Constructor, number of worker threads (started on first resolve)
+        netresolver( size_t threads = NETMM_RESOLVER_THREADS);
+        ~netresolver();
+
+        //Look for *host* in the cache.  Sets *addr* if RESOLVE_FOUND.
+        resolveState lookup( const std::string& host,
+                             struct sockaddr_storage& addr);
+
+        //Start resolving *host*, unless it is cached or already pending
+        resolveState resolve( const std::string& host);
+
+        //Cache results and fire callbacks for finished lookups.
+        //  Call from the event loop thread.  Returns number finished.
+        int poll();
+
+        //Any lookups still running?
+        bool isBusy() const { return !inflight.empty(); };
+
+        //Set callback for finished lookups
+        void setResolveCB( resolveFP cbFunc, void *cbData);
+
+        //Milliseconds to cache found addresses and failures
+        void setCacheTime( unsigned int found, unsigned int failed);
+
+        //Forget all cached names
+        void clearCache();
+
+        //
+        // Public constants
+        //
+        static const size_t NETMM_RESOLVER_THREADS = 2;
+          //getaddrinfo() has no TTL, so cache for a fixed time
+        static const unsigned int NETMM_CACHE_TIME = 60000;
+        static const unsigned int NETMM_FAIL_CACHE_TIME = 5000;
+
+    protected:
+        //Cached result for one name
+        struct cacheEntry {
+            struct sockaddr_storage addr;
+            bool found;
+            uint64_t expires;
+        };
+
+        //Finished lookup, from a worker thread
+        struct resolveResult {
+            std::string host;
+            struct sockaddr_storage addr;
+            bool found;
+        };
+
+          //Loop thread only
+        std::map<std::string, cacheEntry> cache;
+        std::set<std::string> inflight;
+        unsigned int cacheTime, failCacheTime;
+        uint64_t lastPurge;
+        resolveFP resolveCB;
+        void *resolveCBD;
+
+          //Shared with the workers, guarded by queueLock
+        std::deque<std::string> requests;
+        std::deque<resolveResult> results;
+        bool stopping;
+        netmutex queueLock;
+        netsemaphore requestSignal;
+
+          //Worker threads
+        size_t workerCount;
+        std::vector<netthread*> workers;
+
+        //Start worker threads
+        bool startWorkers();
+
+        //Stop and join worker threads
+        void stopWorkers();
+
+        //Drop expired cache entries
+        void purgeCache( uint64_t now);
+
+        //Worker thread function, data is the netresolver
+        static void workerMain( void *data);
+
+        //Blocking lookup of *host* (runs on worker thread)
+        static bool getAddress( const std::string& host,
+                                struct sockaddr_storage& addr);
+
+    private:
+        netresolver( const netresolver&);
+        netresolver& operator=( const netresolver&);
+    };
+}
+
+#endif
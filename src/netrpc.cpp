@@ -0,0 +1,221 @@
+// netrpc: Framed request/response calls with correlation IDs
+
+#include "netrpc.h"
+
+//STL namespace
+using std::map;
+using std::set;
+using std::vector;
+using std::endl;
+
+//net__ namespace
+using net__::netbase;
+using net__::netpacket;
+using net__::netrpc;
+
+//Constructor
+netrpc::netrpc( netbase& b): base(b), lastCall(0), requestCB(NULL),
+    requestCBD(NULL)
+{
+    ;
+}
+
+//Destructor, nobody will answer the pending calls now
+netrpc::~netrpc()
+{
+    set<sock_t>::const_iterator con_iter;
+
+    while (!pending.empty()) {
+        finish(pending.begin()->first, NULL);
+    }
+
+    //frameCB must not be called with this netrpc any more
+    for (con_iter = attached.begin(); con_iter != attached.end();
+         con_iter++)
+    {
+        base.unsetConPktCB(*con_iter);
+    }
+}
+
+//Take over packet callback of *sd*
+bool netrpc::attach( sock_t sd)
+{
+    if (!base.setConPktCB(sd, frameCB, this)) {
+        return false;
+    }
+    attached.insert(sd);
+    return true;
+}
+
+//Fail pending calls on *sd*, release its packet callback
+void netrpc::detach( sock_t sd)
+{
+    map< uint32_t, pendingCall >::const_iterator iter;
+    vector<uint32_t> failed;
+    vector<uint32_t>::const_iterator call_iter;
+
+    base.unsetConPktCB(sd);
+    attached.erase(sd);
+
+    for (iter = pending.begin(); iter != pending.end(); iter++) {
+        if (iter->second.sd == sd) {
+            failed.push_back(iter->first);
+        }
+    }
+    for (call_iter = failed.begin(); call_iter != failed.end(); call_iter++) {
+        finish(*call_iter, NULL);
+    }
+}
+
+//Send a request, remember its callback until the response or deadline
+uint32_t netrpc::call( sock_t sd, const netpacket& request,
+    unsigned int timeout, responseFP cbFunc, void *cbData)
+{
+    pendingCall entry;
+    uint32_t callID;
+
+    //Call ID 0 means failure
+    callID = ++lastCall;
+    if (callID == 0) {
+        callID = ++lastCall;
+    }
+
+    if (sendFrame(sd, callID, RPC_REQUEST, request) <= 0) {
+        return 0;
+    }
+
+    entry.sd = sd;
+    entry.cbFunc = cbFunc;
+    entry.cbData = cbData;
+    entry.timerID = base.setTimer(timeout, timeoutCB, this);
+    pending[callID] = entry;
+    timeouts[entry.timerID] = callID;
+
+    return callID;
+}
+
+//Answer request *callID*
+int netrpc::reply( sock_t sd, uint32_t callID, const netpacket& response)
+{
+    return sendFrame(sd, callID, RPC_RESPONSE, response);
+}
+
+//Set incoming request callback
+void netrpc::setRequestCB( requestFP cbFunc, void *cbData)
+{
+    requestCB = cbFunc;
+    requestCBD = cbData;
+}
+
+//Header and payload go out in one packet
+int netrpc::sendFrame( sock_t sd, uint32_t callID, rpcType type,
+    const netpacket& payload)
+{
+    const uint32_t length = (uint32_t)payload.get_write();
+    netpacket frame(NETMM_RPC_HEADER + length);
+
+    frame.append(length);
+    frame.append(callID);
+    frame.append((uint8_t)type);
+    frame.append(payload.get_ptr(), length);
+    frame.ID = sd;
+
+    return base.sendPacket(sd, frame);
+}
+
+//Remove pending call, then tell its callback
+void netrpc::finish( uint32_t callID, netpacket *response)
+{
+    map< uint32_t, pendingCall >::iterator iter;
+    pendingCall entry;
+
+    iter = pending.find(callID);
+    if (iter == pending.end()) {
+        NETLOG_WARN("RPC response for unknown call {}", callID);
+        return;
+    }
+    entry = iter->second;
+    pending.erase(iter);
+
+    //Deadline still armed: stop it
+    if (timeouts.erase(entry.timerID) > 0) {
+        base.cancelTimer(entry.timerID);
+    }
+
+    if (entry.cbFunc != NULL) {
+        entry.cbFunc( entry.sd, callID, response, entry.cbData);
+    }
+}
+
+//Read one frame, dispatch it, return bytes used (0 for partial frames)
+size_t netrpc::frameCB( netpacket* pkt, void *CBD)
+{
+    netrpc *self = (netrpc*)CBD;
+    const sock_t sd = pkt->ID;
+    const uint8_t *body;
+    uint32_t length, callID;
+    uint8_t type;
+
+    //Wait for the whole header
+    if (pkt->get_unread() < NETMM_RPC_HEADER) {
+        return 0;
+    }
+    pkt->read(length);
+    pkt->read(callID);
+    pkt->read(type);
+
+    if (length > NETMM_RPC_MAX_SIZE) {
+        NETLOG_WARN("#{} RPC frame too large: {}", sd, length);
+        self->detach(sd);
+        self->base.disconnect(sd);
+        return 0;
+    }
+
+    //Wait for the whole payload
+    if (pkt->read_view(body, length) == 0 || body == NULL) {
+        return 0;
+    }
+
+    //Payload packet points into the connection buffer, no copy
+    netpacket message(length, (uint8_t*)body);
+    message.ID = sd;
+
+    switch (type) {
+        case RPC_REQUEST:
+            if (self->requestCB != NULL) {
+                self->requestCB( sd, callID, &message, self->requestCBD);
+            }
+            break;
+        case RPC_RESPONSE:
+            self->finish(callID, &message);
+            break;
+        default:
+            NETLOG_WARN("#{} RPC unknown type {}", sd, (int)type);
+            break;
+    }
+
+    //Callback disconnected: nothing was read
+    if (self->base.isClosed(sd)) {
+        return 0;
+    }
+
+    return NETMM_RPC_HEADER + length;
+}
+
+//Deadline passed, fail the call
+void netrpc::timeoutCB( size_t timerID, void *CBD)
+{
+    netrpc *self = (netrpc*)CBD;
+    map< size_t, uint32_t >::iterator iter;
+    uint32_t callID;
+
+    iter = self->timeouts.find(timerID);
+    if (iter == self->timeouts.end()) {
+        return;
+    }
+    callID = iter->second;
+    self->timeouts.erase(iter);
+
+    NETLOG_WARN("RPC call {} timed out", callID);
+    self->finish(callID, NULL);
+}
@@ -0,0 +1,110 @@
+//netrpc.h
+#ifndef NETRPC_H
+#define NETRPC_H
+
+//
+// Request/response calls over netbase connections.  Each message is framed
+//  with its length and a call ID, so many calls can be in flight on one
+//  connection and responses may come back in any order.
+//
+//  Frame:  uint32 length | uint32 callID | uint8 type | length bytes
+//
+//  Call detach() from the disconnect callback, so calls waiting on that
+//  connection fail right away instead of timing out.
+//
+
+#include "netbase.h"
+
+//STL classes
+#include <map>
+#include <set>
+
+namespace net__ {
+    class netrpc {
+
+    public:
+        //Response callback.  *response* is NULL if the call timed out,
+        //  or the connection was detached.
+        typedef void (*responseFP)( sock_t sd, uint32_t callID,
+                                    netpacket *response, void *cb_data);
+
+        //Request callback.  Answer with reply(), now or later.
+        typedef void (*requestFP)( sock_t sd, uint32_t callID,
+                                   netpacket *request, void *cb_data);
+
+        //Message types
+        enum rpcType {
+            RPC_REQUEST = 1,
+            RPC_RESPONSE = 2
+        };
+
+        //Calls are made on connections of *base*
+        netrpc( netbase& base);
+        ~netrpc();      //Fails all pending calls, detaches connections
+
+        //Use RPC framing on connection *sd* (takes its packet callback)
+        bool attach( sock_t sd);
+
+        //Stop using connection *sd*, failing its pending calls
+        void detach( sock_t sd);
+
+        //Send *request* on *sd*.  cbFunc gets the response, or NULL after
+        //  *timeout* milliseconds.  Returns call ID, or 0 if not sent.
+        uint32_t call( sock_t sd, const netpacket& request,
+                       unsigned int timeout, responseFP cbFunc, void *cbData);
+
+        //Send *response* to request *callID*
+        int reply( sock_t sd, uint32_t callID, const netpacket& response);
+
+        //Set callback for incoming requests
+        void setRequestCB( requestFP cbFunc, void *cbData);
+
+        //Calls waiting for a response
+        size_t getPending() const { return pending.size(); };
+
+        //
+        // Public constants
+        //
+        static const size_t NETMM_RPC_HEADER = 9;
+          //Larger frames are a protocol error, connection is dropped
+        static const uint32_t NETMM_RPC_MAX_SIZE = 0x1000000;
+
+    protected:
+        //Call waiting for its response
+        struct pendingCall {
+            sock_t sd;
+            responseFP cbFunc;
+            void *cbData;
+            size_t timerID;
+        };
+
+        netbase& base;
+        std::map< uint32_t, pendingCall > pending;
+        std::map< size_t, uint32_t > timeouts;  //timer ID -> call ID
+        std::set< sock_t > attached;            //Connections using frameCB
+        uint32_t lastCall;
+
+        //Incoming request callback
+        requestFP requestCB;
+        void *requestCBD;
+
+        //Frame and send a message
+        int sendFrame( sock_t sd, uint32_t callID, rpcType type,
+                       const netpacket& payload);
+
+        //Remove pending call and fire its callback
+        void finish( uint32_t callID, netpacket *response);
+
+        //Packet callback for attached connections, *CBD* is the netrpc
+        static size_t frameCB( netpacket* pkt, void *CBD);
+
+        //Timer callback for call deadlines, *CBD* is the netrpc
+        static void timeoutCB( size_t timerID, void *CBD);
+
+    private:
+        netrpc( const netrpc&);
+        netrpc& operator=( const netrpc&);
+    };
+}
+
+#endif
@@ -9,6 +9,9 @@
 #include <iostream>
 #include <iomanip>
 
+#include <cstring>
+#include <cerrno>
+
 //STL namespace
 using std::cerr;
 using std::endl;
@@ -29,124 +32,635 @@ using net__::netserver;
 
 //Constructor, specify the maximum client connections
 netserver::netserver(unsigned int max): netbase( max), ready(false),
-    serverPort(-1), sdListen(INVALID_SOCKET)
+    draining(false),
+    drainDeadline(0), sdHandoff(INVALID_SOCKET), handoffDrain(0),
+    handoffConnections(false), reserveFd(-1), acceptResume(0),
+    acceptBackoff(0)
 {
     //Everything else should have been taken care of by
     //     the netbase constructor
     openLog();
-    debugLog << "===Starting server===" << endl;
+    NETLOG_INFO("===Starting server===");
+#ifndef NETMM_USE_POLL
     FD_ZERO( &listenSet);
+#endif
 }
 
 //Destructor... was virtual
 netserver::~netserver()
 {
-    if ( (sdListen != (sock_t)INVALID_SOCKET) || ready)
+    if ( !listeners.empty() || ready)
         closePort();
+#ifndef _WIN32
+    if (sdHandoff != (sock_t)INVALID_SOCKET) {
+        close(sdHandoff);
+        unlinkPath(handoffPath);
+    }
+#endif
     openLog();
-    debugLog << "===Ending server===" << endl << endl;
+    NETLOG_INFO("===Ending server===");
     closeLog();
     //Now the base class destructor is invoked by C++
 }
 
 
 //Open a socket, bind, and listen on specified port
-sock_t netserver::openPort(int16_t port) {
-	sock_t sd;	 // socket descriptors
-	struct sockaddr_in sad; // structure to hold server's address
-	int rv;    //Return value
+sock_t netserver::openPort(int16_t port, const std::string& address) {
+    listenEntry entry;
+    sock_t sd;
 
-    if (ready)
-        debugLog << "Warning: Opening port while server ready" << endl;
-    ready = false;  //Assume not ready until port is opened
+    //Restart the log if it was closed
+    openLog();
+
+    //Every address: IPv6 with IPv4 mapped in, if this host has IPv6
+    entry.options = conOptions;
+    entry.dualStack = address.empty();
+    entry.addrLength = inetAddress((entry.dualStack ? "::" : address),
+        (uint16_t)port, entry.addr);
+    if (entry.addrLength == 0) {
+        lastError = "Not a numeric address: " + address;
+        NETLOG_ERROR("{}", lastError);
+        return -1;
+    }
+
+    sd = openListener(entry);
+    if (sd == (sock_t)INVALID_SOCKET)
+        return -1;
+
+    //Set the class members
+    listeners.push_back(entry);
+    ready = true;
+    reserveDescriptor(true);
+
+    return sd;
+}
+
+//Open a Unix socket, bind, and listen on *path*
+sock_t netserver::openUnix(const std::string& path) {
+#ifdef _WIN32
+    lastError = "No Unix sockets on Windows";
+    NETLOG_ERROR("{}", lastError);
+    return -1;
+#else
+    listenEntry entry;
+    sock_t sd;
 
     //Restart the log if it was closed
     openLog();
 
+    memset(&entry.addr, 0, sizeof(entry.addr));
+    entry.addrLength = unixAddress(path, *(struct sockaddr_un*)&entry.addr);
+    if (entry.addrLength == 0) {
+        lastError = "Bad Unix socket path " + path;
+        return -1;
+    }
+    entry.dualStack = false;
+    entry.path = path;
+    entry.options = conOptions;
+
+    sd = openListener(entry);
+    if (sd == (sock_t)INVALID_SOCKET)
+        return -1;
+
+    //Set the class members
+    listeners.push_back(entry);
+    ready = true;
+    reserveDescriptor(true);
+
+    return sd;
+#endif
+}
+
+//Get a socket for entry.addr, bind it, and listen
+sock_t netserver::openListener( listenEntry& entry)
+{
+    const std::string name = (entry.path.empty() ?
+        addressString(&entry.addr, entry.addrLength) : entry.path);
+    int v6only = (entry.dualStack ? 0 : 1);
+    socklen_t bound_len;
+    sock_t sd;
+
     //Get a socket
-    sd = socket( AF_INET, SOCK_STREAM, 0);
+    sd = socket( entry.addr.ss_family, SOCK_STREAM, 0);
+    if ( sd == (sock_t)INVALID_SOCKET && entry.dualStack)
+    {
+        //No IPv6 here, every IPv4 address will do
+        NETLOG_WARN("No IPv6 socket, listening on IPv4 only: {}",
+            getSocketError());
+        entry.dualStack = false;
+        entry.addrLength = inetAddress("0.0.0.0",
+            ntohs(((struct sockaddr_in6*)&entry.addr)->sin6_port),
+            entry.addr);
+        sd = socket( AF_INET, SOCK_STREAM, 0);
+    }
     if ( sd == (sock_t)INVALID_SOCKET )
     {
-        debugLog << "#" << sd << " socket error: " << getSocketError() << endl;
-        return -1;
+        NETLOG_ERROR("#{} socket error: {}", sd, getSocketError());
+        return INVALID_SOCKET;
     }
 
     if (unblockSocket( sd) < 0)
-        return -1;
-        
-    // clear sockaddr structure
-	memset((char *)&sad,0,sizeof(sad));
-	  // set family to Internet
-	sad.sin_family = AF_INET;
-	  // set the local IP address
-	sad.sin_addr.s_addr = INADDR_ANY;
-	sad.sin_port = htons(port);
-
-    //Bind to the socket
-	rv = bind(sd, (sockaddr*)&sad, sizeof( struct sockaddr_in));
-	if (rv == -1) {
-        debugLog << "#" << sd << " cannot bind localhost:" << port << endl;
+        return INVALID_SOCKET;
+
+    //Accepted sockets inherit the buffer sizes, which must be set before
+    //  listen() to scale the TCP window
+    setSocketOptions(sd, entry.options);
+#ifdef TCP_DEFER_ACCEPT
+    if (entry.options.deferAccept > 0 && entry.path.empty()) {
+        setOption(sd, IPPROTO_TCP, TCP_DEFER_ACCEPT,
+            entry.options.deferAccept, "TCP_DEFER_ACCEPT");
+    }
+#endif
+
+    //"::" is IPv6 only, so "0.0.0.0" can listen on the same port
+    if (entry.addr.ss_family == AF_INET6 &&
+        setsockopt(sd, IPPROTO_IPV6, IPV6_V6ONLY, (char *)&v6only,
+                   sizeof(v6only)) == -1)
+    {
+        NETLOG_WARN("#{} cannot set IPV6_V6ONLY: {}", sd, getSocketError());
+    }
+
+    //Left over from an earlier server
+    if (!removeStale(entry.path)) {
+        NETLOG_ERROR("#{} {}", sd, lastError);
         closeSocket(sd);
-        return -1;    //Cannot bind socket
+        return INVALID_SOCKET;
     }
-    
-    //List on port... allow MAX_CON clients
-    rv  = listen(sd, conMax);
-    if (rv == -1) {
-        debugLog << "#" << sd << " cannot listen on " << port << endl;
+
+    //Bind to the socket, and listen... allow MAX_CON clients
+    if (bind(sd, (sockaddr*)&entry.addr, entry.addrLength) == -1) {
+        lastError = "Cannot bind " + name + ": " + getSocketError();
+        NETLOG_ERROR("#{} {}", sd, lastError);
         closeSocket(sd);
-        return -1;    //Cannot listen on port
+        return INVALID_SOCKET;
+    }
+    if (listen(sd, conMax) == -1) {
+        lastError = "Cannot listen on " + name + ": " + getSocketError();
+        NETLOG_ERROR("#{} {}", sd, lastError);
+        closeSocket(sd);
+        unlinkPath(entry.path);
+        return INVALID_SOCKET;
+    }
+
+    //Port 0 picked one: open the same one again after a failure
+    if (entry.path.empty()) {
+        bound_len = sizeof(entry.addr);
+        if (getsockname(sd, (sockaddr*)&entry.addr, &bound_len) == 0) {
+            entry.addrLength = bound_len;
+        }
     }
 
     //Add to sdSet
+#ifndef NETMM_USE_POLL
     FD_SET( (unsigned int)sd, &sdSet);
+#endif
     if (sdMax < sd)
         sdMax = sd;
+    entry.sd = sd;
 
-    //Set the class members
-    sdListen = sd;
-    serverPort = port;
-    ready = true;
-
-    debugLog << "#" << sd << " ** Listening on port " << port
-                << ", limit " << conMax << " clients **" << endl;
+    NETLOG_INFO("#{} ** Listening on {}, limit {} clients **", sd,
+        (entry.path.empty() ? addressString(&entry.addr, entry.addrLength) :
+         entry.path), conMax);
 
     return sd;
 }
 
-//Stop listening on the port
+//Listening socket *sd*
+netserver::listenEntry* netserver::findListener( sock_t sd)
+{
+    size_t index;
+
+    for (index = 0; index < listeners.size(); index++) {
+        if (listeners[index].sd == sd && sd != (sock_t)INVALID_SOCKET) {
+            return &listeners[index];
+        }
+    }
+    return NULL;
+}
+
+//Stop listening on one socket, keep the rest
+bool netserver::closePort( sock_t sd)
+{
+    std::vector<listenEntry>::iterator iter;
+
+    for (iter = listeners.begin(); iter != listeners.end(); iter++) {
+        if (iter->sd == sd && sd != (sock_t)INVALID_SOCKET) {
+            break;
+        }
+    }
+    if (iter == listeners.end()) {
+        NETLOG_WARN("#{} Warning: not a listening socket", sd);
+        return false;
+    }
+
+    NETLOG_DEBUG("#{} Server port closing.", sd);
+    closeSocket(sd);
+    unlinkPath(iter->path);
+    listeners.erase(iter);
+
+    if (listeners.empty()) {
+        ready = false;
+        reserveDescriptor(false);
+    }
+    return true;
+}
+
+//Stop listening on every port
 void netserver::closePort()
 {
+    size_t index;
+
     openLog();
     if (ready)
-        debugLog << "#" << sdListen << " Server port " << serverPort
-                 << " closing." << endl << endl;
+        NETLOG_DEBUG("Server closing {} ports.", listeners.size());
     else
-        debugLog << "#" << sdListen
-                  << " Warning: Closing port, may already be closed!" << endl;
+        NETLOG_WARN("Warning: Closing port, may already be closed!");
 
     ready = false;
     
-    //Close the socket.  ready MUST be set to FALSE or there will be a loop
-    if (sdListen != (sock_t)INVALID_SOCKET)
-        closeSocket( sdListen);
-    sdListen = (sock_t)INVALID_SOCKET;
+    //Close the sockets.  ready MUST be set to FALSE or there will be a loop
+    for (index = 0; index < listeners.size(); index++) {
+        if (listeners[index].sd != (sock_t)INVALID_SOCKET) {
+            NETLOG_DEBUG("#{} Server port closing.", listeners[index].sd);
+            closeSocket( listeners[index].sd);
+        }
+        
+        //Nobody else can listen on it now
+        unlinkPath(listeners[index].path);
+    }
+    listeners.clear();
+    reserveDescriptor(false);
     
     closeLog();
     
 }
 
+//Stop accepting, let connections finish
+void netserver::drain( unsigned int milliseconds)
+{
+    NETLOG_INFO("Draining {} connections for {} ms", conSet.size(),
+        milliseconds);
+
+    if (!listeners.empty()) {
+        closePort();
+    }
+    draining = true;
+    drainDeadline = getTime() + milliseconds;
+}
+
+//Close connections with nothing left to do, or everything at the deadline
+int netserver::checkDrain()
+{
+    std::set<sock_t>::const_iterator con_iter;
+    std::set<sock_t> open( conSet);
+    const uint64_t now = getTime();
+    int closed = 0;
+
+    for (con_iter = open.begin(); con_iter != open.end(); con_iter++) {
+        if (now >= drainDeadline || isIdle(*con_iter, now)) {
+            pendDisconnect(*con_iter);
+            closed++;
+        }
+    }
+
+    if (closed > 0) {
+        NETLOG_INFO("Drain closed {}, {} left", closed, conSet.size());
+        fireDisconnects();
+    }
+    return closed;
+}
+
+//Nothing received for a while, nothing waiting either way
+bool netserver::isIdle( sock_t sd, uint64_t now) const
+{
+    const conEntry& con = conTable[sd];
+
+    if (con.chain != NULL ? !con.chain->empty() : con.index != con.length) {
+        return false;
+    }
+    if (con.sendQueue != NULL && !con.sendQueue->empty()) {
+        return false;
+    }
+    return (now - con.time >= NETMM_DRAIN_IDLE);
+}
+
+//Wait for a successor on a Unix socket
+bool netserver::listenHandoff( const std::string& path,
+                               unsigned int milliseconds, bool connections)
+{
+#ifdef _WIN32
+    lastError = "Socket handoff needs Unix sockets";
+    NETLOG_ERROR("{}", lastError);
+    return false;
+#else
+    struct sockaddr_un addr;
+    socklen_t addr_len;
+    sock_t sd;
+
+    addr_len = unixAddress(path, addr);
+    if (addr_len == 0) {
+        return false;
+    }
+
+    sd = socket( AF_UNIX, SOCK_STREAM, 0);
+    if (sd == (sock_t)INVALID_SOCKET) {
+        NETLOG_ERROR("Handoff socket error: {}", getSocketError());
+        return false;
+    }
+
+    //Left over from an earlier server
+    if (!removeStale(path)) {
+        NETLOG_ERROR("#{} {}", sd, lastError);
+        close(sd);
+        return false;
+    }
+    if (bind(sd, (sockaddr*)&addr, addr_len) == -1 ||
+        listen(sd, 1) == -1 ||
+        fcntl(sd, F_SETFL, fcntl(sd, F_GETFL, 0) | O_NONBLOCK) == -1)
+    {
+        NETLOG_ERROR("#{} cannot listen on {}: {}", sd, path,
+            getSocketError());
+        close(sd);
+        return false;
+    }
+
+    if (sdHandoff != (sock_t)INVALID_SOCKET) {
+        close(sdHandoff);
+    }
+    sdHandoff = sd;
+    handoffPath = path;
+    handoffDrain = milliseconds;
+    handoffConnections = connections;
+
+    NETLOG_INFO("#{} Waiting for successor on {}", sd, path);
+    return true;
+#endif
+}
+
+//Successor connected: pass it the listening socket and idle connections,
+//  then drain the rest
+int netserver::checkHandoff()
+{
+#ifdef _WIN32
+    return 0;
+#else
+    std::set<sock_t>::const_iterator con_iter;
+    std::set<sock_t> open;
+    sock_t control;
+    uint64_t now;
+    size_t index;
+    int sent = 0;
+
+    control = accept(sdHandoff, NULL, NULL);
+    if (control == (sock_t)INVALID_SOCKET) {
+        if (!isWouldBlock()) {
+            NETLOG_ERROR("#{} Handoff accept error: {}", sdHandoff,
+                getSocketError());
+        }
+        return 0;
+    }
+    NETLOG_INFO("#{} Successor connected on {}", control, handoffPath);
+
+    //Keep serving if the listening sockets didn't make it
+    if (listeners.empty()) {
+        close(control);
+        return -1;
+    }
+    for (index = 0; index < listeners.size(); index++) {
+        if (listeners[index].sd == (sock_t)INVALID_SOCKET) {
+            continue;
+        }
+        if (!sendDescriptor(control, 'L', listeners[index].sd)) {
+            close(control);
+            return -1;
+        }
+        sent++;
+    }
+
+    //The successor listens on the Unix socket files now, leave them be
+    for (index = 0; index < listeners.size(); index++) {
+        listeners[index].path.clear();
+    }
+
+    //Connections in the middle of something stay, and drain here
+    if (handoffConnections) {
+        open = conSet;
+        now = getTime();
+        for (con_iter = open.begin(); con_iter != open.end(); con_iter++) {
+            if (isIdle(*con_iter, now) &&
+                sendDescriptor(control, 'C', *con_iter))
+            {
+                pendDisconnect(*con_iter);
+                sent++;
+            }
+        }
+    }
+
+    close(control);
+    close(sdHandoff);
+    unlinkPath(handoffPath);
+    sdHandoff = (sock_t)INVALID_SOCKET;
+
+    NETLOG_INFO("Handed off {} sockets", sent);
+
+    //Closing our copies leaves the successor's open
+    fireDisconnects();
+    drain(handoffDrain);
+
+    return sent;
+#endif
+}
+
+//Take over from the server waiting on *path*
+sock_t netserver::takeover( const std::string& path,
+                            unsigned int milliseconds)
+{
+#ifdef _WIN32
+    lastError = "Socket handoff needs Unix sockets";
+    NETLOG_ERROR("{}", lastError);
+    return INVALID_SOCKET;
+#else
+    struct sockaddr_un addr;
+    socklen_t addr_len, opt_len;
+    sock_t control, sd, first = INVALID_SOCKET;
+    uint64_t deadline = getTime() + milliseconds, now;
+    listenEntry entry;
+    char type;
+    int adopted = 0, v6only;
+
+    addr_len = unixAddress(path, addr);
+    if (addr_len == 0) {
+        return INVALID_SOCKET;
+    }
+
+    control = socket( AF_UNIX, SOCK_STREAM, 0);
+    if (control == (sock_t)INVALID_SOCKET) {
+        NETLOG_ERROR("Handoff socket error: {}", getSocketError());
+        return INVALID_SOCKET;
+    }
+    if (connect(control, (sockaddr*)&addr, addr_len) == -1) {
+        lastError = "Cannot connect to " + path + ": " + getSocketError();
+        NETLOG_ERROR("#{} {}", control, lastError);
+        close(control);
+        return INVALID_SOCKET;
+    }
+
+    //Sockets until the other end closes
+    for (;;) {
+        now = getTime();
+        sd = recvDescriptor(control, type,
+            (unsigned int)(deadline > now ? deadline - now : 0));
+        if (sd == (sock_t)INVALID_SOCKET) {
+            break;
+        }
+
+        if (type == 'L') {
+            //Where it listens, to open it again after a failure
+            entry.sd = sd;
+            entry.dualStack = false;
+            entry.path.clear();
+            entry.options = conOptions;
+            entry.addrLength = sizeof(entry.addr);
+            memset(&entry.addr, 0, sizeof(entry.addr));
+            if (getsockname(sd, (sockaddr*)&entry.addr,
+                            &entry.addrLength) == -1)
+            {
+                entry.addrLength = 0;
+            }
+            if (entry.addr.ss_family == AF_UNIX) {
+                entry.path = unixPath((sockaddr_un*)&entry.addr,
+                                      entry.addrLength);
+            } else if (entry.addr.ss_family == AF_INET6) {
+                opt_len = sizeof(v6only);
+                entry.dualStack = (getsockopt(sd, IPPROTO_IPV6, IPV6_V6ONLY,
+                                   &v6only, &opt_len) == 0 && v6only == 0);
+            }
+            listeners.push_back(entry);
+            if (first == (sock_t)INVALID_SOCKET) {
+                first = sd;
+            }
+            if (sdMax < sd) {
+                sdMax = sd;
+            }
+            ready = true;
+            reserveDescriptor(true);
+            NETLOG_INFO("#{} ** Took over {} **", sd,
+                (entry.path.empty() ?
+                 addressString(&entry.addr, entry.addrLength) : entry.path));
+        } else if (type == 'C' && addConnection(sd)) {
+            setSocketOptions(sd, conOptions);
+            adopted++;
+            conCB( sd, conCBD);
+        }
+    }
+    close(control);
+
+    if (first == (sock_t)INVALID_SOCKET) {
+        lastError = "No listening socket from " + path;
+        NETLOG_ERROR("{}", lastError);
+        return INVALID_SOCKET;
+    }
+    NETLOG_INFO("Took over {} connections", adopted);
+
+    return first;
+#endif
+}
+
+#ifndef _WIN32
+//Pass a socket with SCM_RIGHTS, one type byte as the message
+bool netserver::sendDescriptor( sock_t control, char type, sock_t sd)
+{
+    struct msghdr msg;
+    struct iovec iov;
+    struct cmsghdr *header;
+    union {
+        struct cmsghdr align;
+        char space[CMSG_SPACE(sizeof(int))];
+    } cmsg;
+
+    memset(&msg, 0, sizeof(msg));
+    memset(&cmsg, 0, sizeof(cmsg));
+    iov.iov_base = &type;
+    iov.iov_len = 1;
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = cmsg.space;
+    msg.msg_controllen = sizeof(cmsg.space);
+
+    header = CMSG_FIRSTHDR(&msg);
+    header->cmsg_level = SOL_SOCKET;
+    header->cmsg_type = SCM_RIGHTS;
+    header->cmsg_len = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(header), &sd, sizeof(int));
+
+    if (sendmsg(control, &msg, NETMM_SEND_FLAGS) != 1) {
+        NETLOG_ERROR("#{} cannot pass #{}: {}", control, sd,
+            getSocketError());
+        return false;
+    }
+    return true;
+}
+
+//Receive one socket passed by sendDescriptor()
+sock_t netserver::recvDescriptor( sock_t control, char& type,
+                                  unsigned int milliseconds)
+{
+    struct msghdr msg;
+    struct iovec iov;
+    struct cmsghdr *header;
+    struct pollfd wait;
+    union {
+        struct cmsghdr align;
+        char space[CMSG_SPACE(sizeof(int))];
+    } cmsg;
+    sock_t sd = INVALID_SOCKET;
+
+    wait.fd = control;
+    wait.events = POLLIN;
+    wait.revents = 0;
+    if (poll(&wait, 1, milliseconds) <= 0) {
+        NETLOG_ERROR("#{} Timed out waiting for sockets", control);
+        return INVALID_SOCKET;
+    }
+
+    memset(&msg, 0, sizeof(msg));
+    memset(&cmsg, 0, sizeof(cmsg));
+    iov.iov_base = &type;
+    iov.iov_len = 1;
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = cmsg.space;
+    msg.msg_controllen = sizeof(cmsg.space);
+
+    if (recvmsg(control, &msg, 0) != 1) {
+        return INVALID_SOCKET;
+    }
+    header = CMSG_FIRSTHDR(&msg);
+    if (header == NULL || header->cmsg_level != SOL_SOCKET ||
+        header->cmsg_type != SCM_RIGHTS)
+    {
+        NETLOG_WARN("#{} Handoff message without a socket", control);
+        return INVALID_SOCKET;
+    }
+    memcpy(&sd, CMSG_DATA(header), sizeof(int));
+
+    return sd;
+}
+
+#endif
+
 //Inherited function for closing a network socket
 int netserver::closeSocket( sock_t sd)
 {
+    listenEntry *entry = findListener( sd);
     int rv;
 
     //Do normal base class closing
     rv = netbase::closeSocket( sd);
 
-    //Special test case for listening port
-    if (sd == sdListen) {
-        sdListen = (sock_t)INVALID_SOCKET;
+    //Special test case for listening ports
+    if (entry != NULL) {
+        entry->sd = (sock_t)INVALID_SOCKET;
     }
     return rv;
 }
@@ -154,71 +668,131 @@ int netserver::closeSocket( sock_t sd)
 //Read the network, handle any incoming data
 int netserver::run()
 {
-    int rv=0;
-
-    try {
-    
-        //First, look for incoming connections
-        checkPort();
-
-        //We have more than 0 clients, check for data
-        if (conSet.size() > 0) {
-            rv = readIncomingSockets();
-        }
-        
-        //Fire callbacks for unprocessed data
-    }
-    catch(...) {
-        debugLog << "Unhandled exception!!" << endl;
-        rv = -1;
-    };
-
-    return rv;
+    return runWith( pktMap);
 }
 
 //This creates an FD_SET from the server port listening sockets only
-int netserver::buildListenSet()
+sock_t netserver::buildListenSet()
 {
+    sock_t sdHigh = 0;
+    size_t index;
+
+#ifdef NETMM_USE_POLL
+    struct pollfd entry;
+
+    listenSet.clear();
+    entry.events = POLLIN;
+    entry.revents = 0;
+#else
     FD_ZERO( &listenSet );
-    FD_SET( (unsigned int)sdListen, &listenSet );
+#endif
+    for (index = 0; index < listeners.size(); index++) {
+        if (listeners[index].sd == (sock_t)INVALID_SOCKET) {
+            continue;
+        }
+#ifdef NETMM_USE_POLL
+        entry.fd = listeners[index].sd;
+        listenSet.push_back(entry);
+#else
+        FD_SET( (unsigned int)listeners[index].sd, &listenSet );
+#endif
+        if (sdHigh < listeners[index].sd) {
+            sdHigh = listeners[index].sd;
+        }
+    }
 
-    return 0;
+    return sdHigh;
 }
 
-//Check sdListen for new incoming connections
+//Check the listening sockets for new incoming connections
 int netserver::checkPort()
 {
     sock_t sd=0, rv;
+    bool more;
+    size_t count, index, ready_index;
+    std::vector<sock_t> readable;
 
-    //Rebuild the server socket set
+    //Not listening, or draining
+    if (listeners.empty()) {
+        return 0;
+    }
+
+    //Ran out of descriptors, give them time to close
+    if (acceptResume != 0) {
+        if (getTime() < acceptResume) {
+            return 0;
+        }
+        acceptResume = 0;
+    }
+
+    //Rebuild the server socket set, and check each listen socket for
+    //  incoming data
+#ifdef NETMM_USE_POLL
     buildListenSet();
-    
-    //Check each listen socket for incoming data
-    rv = select(sdListen+1, &listenSet, (fd_set *) 0, (fd_set *) 0, &timeout);
+    if (listenSet.empty()) {
+        return 0;
+    }
+    rv = poll(&listenSet[0], listenSet.size(), 0);
+#else
+    sock_t sdHigh = buildListenSet();
+    rv = select(sdHigh+1, &listenSet, (fd_set *) 0, (fd_set *) 0, &timeout);
+#endif
+    stats.selectCalls++;
     
     if (rv == SOCKET_ERROR) {
         //Socket select failed with error
-        debugLog << "Listen select error:"  << getSocketError() << endl;
+        NETLOG_ERROR("Listen select error:{}", getSocketError());
+        return rv;
     }
-    else if (rv > 0)
-    {
-        //Something pending on a socket
 
-        //Check the incoming server socket
-        //  (dedicated to listening for new connections)
-        if (FD_ISSET(sdListen, &listenSet)) {
-            sd = acceptConnection();
-            
+    //Sockets with connections waiting.  Callbacks may open or close
+    //  listeners, so they are found again by socket each time.
+    for (index = 0; rv > 0 && index < listeners.size(); index++) {
+#ifdef NETMM_USE_POLL
+        for (ready_index = 0; ready_index < listenSet.size(); ready_index++) {
+            if (listenSet[ready_index].fd == listeners[index].sd &&
+                listenSet[ready_index].revents != 0)
+            {
+                readable.push_back(listeners[index].sd);
+            }
+        }
+#else
+        if (listeners[index].sd != (sock_t)INVALID_SOCKET &&
+            FD_ISSET(listeners[index].sd, &listenSet))
+        {
+            readable.push_back(listeners[index].sd);
+        }
+#endif
+    }
+
+    for (ready_index = 0; ready_index < readable.size(); ready_index++) {
+        //Take what is queued, a batch at a time
+        more = true;
+        for (count = 0; more && count < NETMM_ACCEPT_BATCH; count++) {
+            for (index = 0; index < listeners.size(); index++) {
+                if (listeners[index].sd == readable[ready_index]) {
+                    break;
+                }
+            }
+            if (index == listeners.size()) {
+                //Closed by a callback
+                break;
+            }
+
+            sd = acceptConnection(index, more);
             if (sd == (sock_t)INVALID_SOCKET) {
                 //Connection refused or failed
             }
             else {
                 //Report new connection
-                debugLog << "#" << sd << " CONNECTED!" << endl;
+                NETLOG_INFO("#{} CONNECTED!", sd);
                 conCB( sd, conCBD);
             }
-        } else {
-          ;//Existing connection has something to say
+        }
+        
+        //Out of descriptors: the other listeners wait too
+        if (acceptResume != 0) {
+            break;
         }
     }
     
@@ -226,55 +800,178 @@ int netserver::checkPort()
 }
 
 //Accept new connection, add connection descriptor to conSet
-sock_t netserver::acceptConnection()
+sock_t netserver::acceptConnection( size_t index, bool& more)
 {
     sock_t sd;
-    struct sockaddr_in addr;
-    int addr_len = sizeof(struct sockaddr_in);
+    struct sockaddr_storage addr;
+#ifdef _WIN32
+    int addr_len = sizeof(addr);
+#else
+    socklen_t addr_len = sizeof(addr);
+#endif
 
     openLog();
     
     //Non blocking accept call
-    sd = accept(sdListen, (sockaddr*)&addr, &addr_len); 
+    sd = accept(listeners[index].sd, (sockaddr*)&addr, &addr_len); 
     if (sd == (sock_t)INVALID_SOCKET) {
-        debugLog << "Client connection failed:" << getSocketError() << endl;
+        acceptFailed(index, more);
+        return -1;
+    }
 
-        //Cleanup the listen port if its not already
-        if (sdListen != (sock_t)INVALID_SOCKET) {
-            closeSocket(sdListen);
-        }
-        
-        //Don't give up, try to restart it
-        if (openPort(serverPort) == (sock_t)INVALID_SOCKET)
-            debugLog << "Cannot restart socket!" << endl;
-        else
-            debugLog << "Listening socket restarted" << endl;
+    //accept() doesn't pass on O_NONBLOCK
+    if (unblockSocket(sd) < 0) {
         return -1;
     }
 
-    //Prevent more than conMax connections
-    if (conSet.size() >= conMax) {
-        debugLog << "Connection refused, maximum "
-                 << conMax << " connections" << endl;
+    //Refused connections are closed, keep taking the rest
+    if (!addConnection(sd)) {
         return -1;
     }
+    setSocketOptions(sd, listeners[index].options);
+    stats.accepts++;
+    acceptBackoff = 0;
     
+    if (addr.ss_family == AF_INET || addr.ss_family == AF_INET6) {
+        NETLOG_INFO("#{} connected!  address={}", sd,
+            addressString(&addr, addr_len));
+    } else {
+        NETLOG_INFO("#{} connected!  on {}", sd, listeners[index].path);
+    }
+
+    return sd;
+}
+
+//Most accept() failures are about one connection, or none at all.  Only
+//  reopen the port when the listening socket itself is broken.
+void netserver::acceptFailed( size_t index, bool& more)
+{
+#ifdef _WIN32
+    const int error = WSAGetLastError();
+    const bool fdLimit = (error == WSAEMFILE || error == WSAENOBUFS);
+    const bool transient = (error == WSAECONNRESET || error == WSAEINTR ||
+                            error == WSAENETDOWN);
+#else
+    const int error = errno;
+    const bool fdLimit = (error == EMFILE || error == ENFILE ||
+                          error == ENOBUFS || error == ENOMEM);
+    //Errors of the new connection are passed on by accept() (Linux)
+    bool transient = (error == ECONNABORTED || error == EINTR ||
+                      error == EPROTO || error == EPERM ||
+                      error == ENETDOWN || error == ENETUNREACH ||
+                      error == EHOSTUNREACH || error == ENOPROTOOPT ||
+                      error == EOPNOTSUPP || error == ETIMEDOUT);
+#ifdef ENONET
+    transient = (transient || error == ENONET);
+#endif
+#ifdef EHOSTDOWN
+    transient = (transient || error == EHOSTDOWN);
+#endif
+#endif
+
+    //Nothing left in the queue (or a spurious wakeup)
+    if (isWouldBlock()) {
+        stats.wouldBlock++;
+        more = false;
+        return;
+    }
+
+    //Connection went away before it was accepted, try the next one
+    if (transient) {
+        NETLOG_WARN("Client connection failed: {}", getSocketError());
+        stats.acceptErrors++;
+        return;
+    }
+
+    //Out of descriptors.  Use the spare one to accept and close a single
+    //  connection, so its client isn't left hanging, then wait a little.
+    if (fdLimit) {
+        NETLOG_ERROR("Cannot accept, out of descriptors: {}",
+            getSocketError());
+        stats.acceptFdLimit++;
+#ifndef _WIN32
+        if (reserveFd != -1) {
+            sock_t sd;
+
+            reserveDescriptor(false);
+            sd = accept(listeners[index].sd, NULL, NULL);
+            if (sd != (sock_t)INVALID_SOCKET) {
+                close(sd);
+                stats.acceptRejects++;
+            }
+            reserveDescriptor(true);
+        }
+#endif
+        acceptBackoff = (acceptBackoff == 0 ? NETMM_ACCEPT_BACKOFF :
+                         acceptBackoff * 2);
+        if (acceptBackoff > NETMM_ACCEPT_BACKOFF_MAX) {
+            acceptBackoff = NETMM_ACCEPT_BACKOFF_MAX;
+        }
+        acceptResume = getTime() + acceptBackoff;
+        more = false;
+        return;
+    }
+
+    NETLOG_ERROR("Listening socket failed: {}", getSocketError());
+    more = false;
+
+    //Cleanup the listen port if its not already
+    if (listeners[index].sd != (sock_t)INVALID_SOCKET) {
+        closeSocket(listeners[index].sd);
+    }
     
-    debugLog << "#" << sd
-            << " connected!  address=" << inet_ntoa( addr.sin_addr )
-            << "  port=" << ntohs(addr.sin_port) << endl;
+    //Don't give up, try to restart it on the same address
+    stats.listenRestarts++;
+    if (openListener(listeners[index]) == (sock_t)INVALID_SOCKET) {
+        NETLOG_ERROR("Cannot restart socket!");
+        listeners.erase(listeners.begin() + index);
+    } else {
+        NETLOG_INFO("Listening socket restarted");
+    }
+}
+
+//Keep a descriptor for when accept() runs out of them
+void netserver::reserveDescriptor( bool open)
+{
+#ifndef _WIN32
+    if (reserveFd != -1) {
+        close(reserveFd);
+        reserveFd = -1;
+    }
+    if (open) {
+        reserveFd = ::open("/dev/null", O_RDONLY);
+    }
+#endif
+}
+
+//Add an accepted (or taken over) socket to the set of connections
+bool netserver::addConnection( sock_t sd)
+{
+    //Prevent more than conMax connections
+    if (conSet.size() >= conMax) {
+        NETLOG_ERROR("#{} Connection refused, maximum {} connections", sd,
+            conMax);
+        removeSocket(sd);
+        stats.acceptRejects++;
+        return false;
+    }
+    
+    //No room in the select() set
+    if (!canTrack(sd)) {
+        NETLOG_ERROR("#{} Connection refused, socket out of range", sd);
+        removeSocket(sd);
+        stats.acceptRejects++;
+        return false;
+    }
 
     //Add to the set of connection descriptors
     conSet.insert( sd );
+    if (sdMax < sd) {
+        sdMax = sd;
+    }
     
     //Allocate buffer for receiving packets
-    conBuffer[sd] = new uint8_t[NETMM_CON_BUFFER_SIZE];
-    conBufferIndex[sd] = 0;
-    conBufferLength[sd] = 0;
-    conBufferSize[sd] = NETMM_CON_BUFFER_SIZE;
-
-    //unblockSocket( connection );
-    //Do something with FD_SET ???
+    allocBuffer(sd);
 
-    return sd;
+    return true;
 }
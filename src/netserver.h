@@ -25,37 +25,188 @@ namespace net__ {
         netserver(unsigned int max);
         ~netserver();
         
-        //open *port*, return socket descriptor
-        sock_t openPort(int16_t port);
+        //Listen on *port* of numeric IPv4 or IPv6 *address*, return
+        //  socket descriptor.  "" is every address, IPv6 and IPv4 (only
+        //  IPv4 on hosts without IPv6), "0.0.0.0" every IPv4 one, "::"
+        //  every IPv6 one.  Call again for more addresses or ports: one
+        //  run() takes connections from all of them.
+        sock_t openPort(int16_t port, const std::string& address = "");
         
-        //close the server (and server.log)
+        //Listen on Unix socket *path* too: a file, or on Linux "@name"
+        //  in the abstract namespace.  A file left over from an earlier
+        //  server is replaced.  Return socket descriptor.  POSIX only.
+        sock_t openUnix(const std::string& path);
+        
+        //Stop listening on *sd*, from openPort() or openUnix()
+        bool closePort( sock_t sd);
+        
+        //close every listening socket (and server.log)
         void closePort();
         
+        //Stop accepting, and close connections as they go idle: nothing
+        //  left to read or send for NETMM_DRAIN_IDLE.  Whatever is still
+        //  open after *milliseconds* is closed anyway.
+        void drain( unsigned int milliseconds);
+        
+        //Draining, and every connection closed?
+        bool isDraining() const { return draining; };
+        bool isDrained() const { return (draining && conSet.empty()); };
+        
+        //Listen on Unix socket *path* for a successor process.  When it
+        //  calls takeover(), it gets the listening sockets, and with
+        //  *connections*, every connection with nothing left to read or
+        //  send.  Then this server drains for *milliseconds*.  POSIX only.
+        bool listenHandoff( const std::string& path,
+                            unsigned int milliseconds,
+                            bool connections = true);
+        
+        //Take the listening sockets (and connections) from the server
+        //  listening on Unix socket *path*, instead of openPort().  Fires
+        //  the connect callback for each connection.  Waits up to
+        //  *milliseconds*.  Returns a listening socket, or INVALID_SOCKET.
+        sock_t takeover( const std::string& path, unsigned int milliseconds);
+        
         //Check the network: read sockets, handle callbacks
         int run();
+
+        //The same, sending every event to *handler* (see nethandler.h)
+        template <class H> int run( H& handler) {
+            handlerScope scope( *this, handler);
+            return runWith( handler);
+        };
     
     protected:
+        //One run() pass, packets go to handler.onData()
+        template <class H> int runWith( H& handler);
+        
           //Ready to continue?
         bool ready;
+          //One listening socket, and what to open it on again
+        struct listenEntry {
+            sock_t sd;                      //INVALID_SOCKET once closed
+            struct sockaddr_storage addr;   //Bound address
+            socklen_t addrLength;
+            bool dualStack;                 //IPv6, taking IPv4 too
+            std::string path;               //Unix socket file to remove
+            socketOptions options;          //Of the port and its connections
+        };
+        std::vector<listenEntry> listeners;
           //set of port listening file descriptors
+#ifdef NETMM_USE_POLL
+        std::vector<struct pollfd> listenSet;
+#else
         fd_set listenSet;
-          //Listening port number
-        int16_t serverPort;
-          //Listening socket number
-        sock_t sdListen;
+#endif
+        
+          //Closing connections as they go idle, until drainDeadline
+        bool draining;
+        uint64_t drainDeadline;
+        
+          //Unix socket a successor connects to for the listening socket
+        sock_t sdHandoff;
+        std::string handoffPath;
+        unsigned int handoffDrain;      //Drain time after handing off
+        bool handoffConnections;
+        
+          //Quiet time before a draining connection is closed
+        static const unsigned int NETMM_DRAIN_IDLE = 500;
+        
+          //Spare descriptor, closed to shed a connection when out of them
+        int reserveFd;
+          //Out of descriptors: don't accept until acceptResume
+        uint64_t acceptResume;
+        unsigned int acceptBackoff;
+        
+          //Most connections accepted by one run()
+        static const size_t NETMM_ACCEPT_BATCH = 64;
+          //First and longest wait after running out of descriptors (ms)
+        static const unsigned int NETMM_ACCEPT_BACKOFF = 10;
+        static const unsigned int NETMM_ACCEPT_BACKOFF_MAX = 1000;
         
         //Overloaded function from netbase....
         int closeSocket(sock_t);
         
-        //Rebuild listenSet
-        int buildListenSet();
+        //Rebuild listenSet, return the highest socket
+        sock_t buildListenSet();
         
-        //Examine port for connections
+        //Examine ports for connections
         int checkPort();
         
-         //Handle an incoming connection, return socket number
-        sock_t acceptConnection();
+        //Make, bind and listen on the socket of *entry*
+        sock_t openListener( listenEntry& entry);
+        
+        //Listening socket *sd*, or NULL
+        listenEntry* findListener( sock_t sd);
+        
+        //Handle an incoming connection on listeners[*index*], return
+        //  socket number.  *more* is false when there is no point calling
+        //  it again right now.
+        sock_t acceptConnection( size_t index, bool& more);
+        
+        //Deal with a failed accept(): retry, shed, or reopen the port
+        void acceptFailed( size_t index, bool& more);
+        
+        //Open (or close) the spare descriptor
+        void reserveDescriptor( bool open);
+        
+        //Add connected socket *sd* to the connection set.  False if it
+        //  was refused.
+        bool addConnection( sock_t sd);
+        
+        //Close idle connections, or all of them after the deadline
+        int checkDrain();
+        
+        //Answer a successor connecting to the handoff socket
+        int checkHandoff();
+        
+        //Nothing unread, nothing queued, quiet since *now* - idle?
+        bool isIdle( sock_t sd, uint64_t now) const;
+        
+        //Pass *sd* to another process over Unix socket *control*.
+        //  *type* says what it is.
+        bool sendDescriptor( sock_t control, char type, sock_t sd);
+        
+        //Receive a socket from *control*: INVALID_SOCKET at the end.
+        sock_t recvDescriptor( sock_t control, char& type,
+                               unsigned int milliseconds);
         
     };
+
+    //Accept connections, then read sockets and pass packets to handler
+    template <class H> int netserver::runWith( H& handler)
+    {
+        int rv=0;
+
+        try {
+            //Timers that are due
+            if (!timers.empty()) {
+                fireTimers();
+            }
+
+            //First, look for incoming connections
+            checkPort();
+            
+            //Successor wants the listening socket
+            if (sdHandoff != (sock_t)INVALID_SOCKET) {
+                checkHandoff();
+            }
+            
+            //Close connections that are done
+            if (draining) {
+                checkDrain();
+            }
+
+            //RECEIVE DATA ON ALL INCOMING CONNECTIONS
+            if (conSet.size() > 0 || !watches.empty()) {
+                rv = readIncomingSockets( handler);
+            }
+        }
+        catch(...) {
+            NETLOG_ERROR("Unhandled exception!!");
+            rv = -1;
+        };
+
+        return rv;
+    }
 }
 #endif
@@ -0,0 +1,812 @@
+// netshm: connections through shared memory rings, woken by eventfd
+
+//net__
+#include "netshm.h"
+
+#ifdef NETMM_USE_SHM
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <sched.h>
+#include <sys/stat.h>
+
+//STL namespace
+using std::map;
+using std::string;
+using std::vector;
+
+//net__ namespace
+using net__::netshm;
+using net__::netpacket;
+using net__::netstats;
+using net__::nethandle;
+
+//Segment layout this code understands
+static const uint32_t NETSHM_MAGIC = 0x6e73686d;   //"nshm"
+static const uint32_t NETSHM_VERSION = 1;
+
+//Constructor, specify the maximum connections
+netshm::netshm( size_t maxConnections): netbase( maxConnections),
+    sdListen(INVALID_SOCKET), ringSize(NETMM_SHM_SIZE), busyRuns(0)
+{
+    openLog();
+    NETLOG_INFO("===Starting shared memory endpoint===");
+}
+
+//Close every connection, and stop offering new ones
+netshm::~netshm()
+{
+    map<sock_t, pendingConnect>::const_iterator wait_iter;
+
+    for (wait_iter = connWaiting.begin(); wait_iter != connWaiting.end();
+         wait_iter++)
+    {
+        removeSocket(wait_iter->second.control);
+        close(wait_iter->first);
+    }
+    while (!channels.empty()) {
+        closeSocket(channels.begin()->first);
+    }
+    if (sdListen != (sock_t)INVALID_SOCKET) {
+        closePort();
+    }
+
+    openLog();
+    NETLOG_INFO("===Ending shared memory endpoint===");
+    closeLog();
+
+    //Now the base class destructor is invoked by C++
+}
+
+//Listen on a Unix socket for processes that want a connection
+sock_t netshm::openUnix( const string& path)
+{
+    struct sockaddr_un addr;
+    socklen_t addr_len;
+    sock_t sd;
+
+    openLog();
+    if (sdListen != (sock_t)INVALID_SOCKET) {
+        closePort();
+    }
+
+    addr_len = unixAddress(path, addr);
+    if (addr_len == 0) {
+        lastError = "Bad Unix socket path " + path;
+        return INVALID_SOCKET;
+    }
+
+    sd = socket( AF_UNIX, SOCK_STREAM, 0);
+    if (sd == (sock_t)INVALID_SOCKET) {
+        NETLOG_ERROR("#{} socket error: {}", sd, getSocketError());
+        return INVALID_SOCKET;
+    }
+    if (unblockSocket( sd) < 0) {
+        return INVALID_SOCKET;
+    }
+
+    //Left over from an earlier process
+    if (!removeStale(path)) {
+        NETLOG_ERROR("#{} {}", sd, lastError);
+        removeSocket(sd);
+        return INVALID_SOCKET;
+    }
+    if (bind(sd, (sockaddr*)&addr, addr_len) == -1 ||
+        listen(sd, conMax) == -1)
+    {
+        lastError = "Cannot listen on " + path + ": " + getSocketError();
+        NETLOG_ERROR("#{} {}", sd, lastError);
+        removeSocket(sd);
+        return INVALID_SOCKET;
+    }
+
+    sdListen = sd;
+    listenPath = path;
+    if (sdMax < sd) {
+        sdMax = sd;
+    }
+
+    NETLOG_INFO("#{} ** Offering shared memory on {}, {} byte rings **", sd,
+        path, ringSize);
+    return sd;
+}
+
+//Stop listening, remove the socket file
+void netshm::closePort()
+{
+    if (sdListen == (sock_t)INVALID_SOCKET) {
+        NETLOG_WARN("Shared memory port already closed");
+        return;
+    }
+
+    NETLOG_DEBUG("#{} Closing {}", sdListen, listenPath);
+    removeSocket(sdListen);
+    sdListen = (sock_t)INVALID_SOCKET;
+    unlinkPath(listenPath);
+    listenPath.clear();
+}
+
+//Ask the process on *path* for a connection.  Its run() answers later.
+sock_t netshm::doConnect( const string& path, unsigned int milliseconds)
+{
+    struct sockaddr_un addr;
+    socklen_t addr_len;
+    pendingConnect entry;
+    sock_t control, sd;
+
+    openLog();
+
+    if (channels.size() + connWaiting.size() >= conMax) {
+        lastError = "Too many connections";
+        NETLOG_WARN("{}, maximum {}", lastError, conMax);
+        return INVALID_SOCKET;
+    }
+
+    addr_len = unixAddress(path, addr);
+    if (addr_len == 0) {
+        lastError = "Bad Unix socket path " + path;
+        return INVALID_SOCKET;
+    }
+
+    control = socket( AF_UNIX, SOCK_STREAM, 0);
+    if (control == (sock_t)INVALID_SOCKET) {
+        lastError = "Could not create socket";
+        NETLOG_WARN("{}: {}", lastError, getSocketError());
+        return INVALID_SOCKET;
+    }
+    fcntl(control, F_SETFL, fcntl(control, F_GETFL, 0) | O_NONBLOCK);
+
+    //A Unix socket connects at once, or not at all (EAGAIN: backlog full)
+    if (connect(control, (sockaddr*)&addr, addr_len) == -1) {
+        lastError = "Could not connect to " + path + ": " + getSocketError();
+        NETLOG_WARN("#{} {}", control, lastError);
+        removeSocket(control);
+        return INVALID_SOCKET;
+    }
+
+    //The connection is known by the eventfd it waits on, and the other
+    //  side sends that.  Hold the number with one of ours until then.
+    sd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (sd == (sock_t)INVALID_SOCKET) {
+        lastError = "Could not create eventfd";
+        NETLOG_WARN("#{} {}: {}", control, lastError, getSocketError());
+        removeSocket(control);
+        return INVALID_SOCKET;
+    }
+
+    entry.control = control;
+    entry.path = path;
+    entry.deadline = getTime() + milliseconds;
+    connWaiting[sd] = entry;
+
+    NETLOG_INFO("#{} connecting to {}", sd, path);
+    return sd;
+}
+
+//Take the segment, our eventfd, and theirs, from the answer on *control*
+bool netshm::answerConnect( sock_t sd, const pendingConnect& entry)
+{
+    struct msghdr msg;
+    struct iovec iov;
+    struct cmsghdr *header;
+    union {
+        struct cmsghdr align;
+        char space[CMSG_SPACE(3 * sizeof(int))];
+    } cmsg;
+    int fds[3];
+    char type = 0;
+    ssize_t rv;
+
+    memset(&msg, 0, sizeof(msg));
+    memset(&cmsg, 0, sizeof(cmsg));
+    iov.iov_base = &type;
+    iov.iov_len = 1;
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = cmsg.space;
+    msg.msg_controllen = sizeof(cmsg.space);
+
+    rv = recvmsg(entry.control, &msg, MSG_CMSG_CLOEXEC);
+    header = CMSG_FIRSTHDR(&msg);
+    if (rv != 1 || type != 'S' || header == NULL ||
+        header->cmsg_level != SOL_SOCKET ||
+        header->cmsg_type != SCM_RIGHTS ||
+        header->cmsg_len != CMSG_LEN(3 * sizeof(int)))
+    {
+        lastError = "Bad answer from " + entry.path;
+        NETLOG_WARN("#{} {}", sd, lastError);
+        if (header != NULL && header->cmsg_type == SCM_RIGHTS) {
+            size_t count = (header->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+            count = (count < 3 ? count : 3);
+            memcpy(fds, CMSG_DATA(header), count * sizeof(int));
+            while (count > 0) {
+                close(fds[--count]);
+            }
+        }
+        removeSocket(entry.control);
+        return false;
+    }
+    memcpy(fds, CMSG_DATA(header), sizeof(fds));
+
+    //Their eventfd takes the number doConnect() returned
+    if (dup3(fds[1], sd, O_CLOEXEC) == -1 ||
+        !addChannel(fds[0], sd, fds[2], entry.control, 1))
+    {
+        lastError = "Cannot map shared memory from " + entry.path;
+        NETLOG_WARN("#{} {}", sd, lastError);
+        close(fds[0]);
+        close(fds[1]);
+        close(fds[2]);
+        removeSocket(entry.control);
+        return false;
+    }
+    close(fds[0]);
+    close(fds[1]);
+
+    NETLOG_INFO("#{} connected to {}", sd, entry.path);
+    return true;
+}
+
+//Finish doConnect() connections that were answered, fail late ones
+int netshm::checkConnects()
+{
+    map<sock_t, pendingConnect>::const_iterator iter;
+    vector<struct pollfd> answers(connWaiting.size());
+    vector<sock_t> connected, failed;
+    vector<sock_t>::const_iterator con_iter;
+    const uint64_t now = getTime();
+    size_t index;
+    sock_t sd;
+    int rv;
+
+    for (iter = connWaiting.begin(), index = 0; iter != connWaiting.end();
+         iter++, index++)
+    {
+        answers[index].fd = iter->second.control;
+        answers[index].events = POLLIN;
+        answers[index].revents = 0;
+    }
+
+    rv = poll(&answers[0], answers.size(), 0);
+    stats.selectCalls++;
+    if (rv == SOCKET_ERROR) {
+        NETLOG_ERROR("Connect poll error:{}", getSocketError());
+    }
+
+    //Answered (or closed) connects are done, either way
+    for (iter = connWaiting.begin(), index = 0; iter != connWaiting.end();
+         iter++, index++)
+    {
+        sd = iter->first;
+        if (rv > 0 && answers[index].revents != 0) {
+            if (answerConnect(sd, iter->second)) {
+                connected.push_back(sd);
+            } else {
+                failed.push_back(sd);
+            }
+        } else if (now >= iter->second.deadline) {
+            lastError = "No answer from " + iter->second.path;
+            NETLOG_WARN("#{} {}", sd, lastError);
+            removeSocket(iter->second.control);
+            failed.push_back(sd);
+        }
+    }
+    for (con_iter = connected.begin(); con_iter != connected.end();
+         con_iter++)
+    {
+        connWaiting.erase(*con_iter);
+        connPending.push_back(*con_iter);
+    }
+    for (con_iter = failed.begin(); con_iter != failed.end(); con_iter++) {
+        connWaiting.erase(*con_iter);
+    }
+
+    //Callbacks may connect again, so fire them after the scan.  Connect
+    //  callbacks come from fireConnects().
+    for (con_iter = failed.begin(); con_iter != failed.end(); con_iter++) {
+        close(*con_iter);
+        stats.connectFailures++;
+        failCB( *con_iter, failCBD);
+    }
+
+    return (int)(connected.size() + failed.size());
+}
+
+//Make the segment and eventfds for a new connection, and pass them on
+sock_t netshm::acceptChannel( sock_t control)
+{
+    struct msghdr msg;
+    struct iovec iov;
+    struct cmsghdr *header;
+    union {
+        struct cmsghdr align;
+        char space[CMSG_SPACE(3 * sizeof(int))];
+    } cmsg;
+    const long page = sysconf(_SC_PAGESIZE);
+    int fds[3];
+    char type = 'S';
+    int memfd, evIn, evOut;
+
+    if (channels.size() >= conMax) {
+        NETLOG_WARN("#{} Too many connections, maximum {}", control, conMax);
+        stats.acceptRejects++;
+        removeSocket(control);
+        return INVALID_SOCKET;
+    }
+
+    memfd = memfd_create("netshm", MFD_CLOEXEC);
+    evIn = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    evOut = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (memfd == -1 || evIn == -1 || evOut == -1 ||
+        ftruncate(memfd, page + 2 * ringSize) == -1 ||
+        !addChannel(memfd, evIn, evOut, control, 0))
+    {
+        NETLOG_ERROR("#{} Cannot make shared memory: {}", control,
+            getSocketError());
+        if (memfd != -1) close(memfd);
+        if (evIn != -1) close(evIn);
+        if (evOut != -1) close(evOut);
+        removeSocket(control);
+        return INVALID_SOCKET;
+    }
+
+    //The other side waits on our evOut, and wakes our evIn
+    fds[0] = memfd;
+    fds[1] = evOut;
+    fds[2] = evIn;
+
+    memset(&msg, 0, sizeof(msg));
+    memset(&cmsg, 0, sizeof(cmsg));
+    iov.iov_base = &type;
+    iov.iov_len = 1;
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = cmsg.space;
+    msg.msg_controllen = sizeof(cmsg.space);
+
+    header = CMSG_FIRSTHDR(&msg);
+    header->cmsg_level = SOL_SOCKET;
+    header->cmsg_type = SCM_RIGHTS;
+    header->cmsg_len = CMSG_LEN(sizeof(fds));
+    memcpy(CMSG_DATA(header), fds, sizeof(fds));
+
+    if (sendmsg(control, &msg, NETMM_SEND_FLAGS) != 1) {
+        NETLOG_ERROR("#{} Cannot pass shared memory: {}", control,
+            getSocketError());
+        close(memfd);
+        closeSocket(evIn);
+        return INVALID_SOCKET;
+    }
+    close(memfd);
+
+    NETLOG_INFO("#{} connected!  on {}", evIn, listenPath);
+    stats.accepts++;
+    conCB( evIn, conCBD);
+    return evIn;
+}
+
+//Map the header page, then each ring twice, back to back
+bool netshm::addChannel( int fd, int evIn, int evOut, sock_t control,
+                         int side)
+{
+    const size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    struct stat info;
+    shmHeader *shared;
+    shmChannel chan;
+    uint8_t *base, *rings;
+    size_t size, copy;
+
+    if (fstat(fd, &info) == -1 || (size_t)info.st_size <= page) {
+        return false;
+    }
+    size = ((size_t)info.st_size - page) / 2;
+    if (size < page || (size & (size - 1)) != 0) {
+        NETLOG_ERROR("#{} Bad shared memory size {}", evIn, size);
+        return false;
+    }
+
+    //Reserve the address range, then map the segment over it
+    chan.mapSize = page + 4 * size;
+    base = (uint8_t*)mmap(NULL, chan.mapSize, PROT_NONE,
+                          MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (base == (uint8_t*)MAP_FAILED) {
+        return false;
+    }
+    rings = base + page;
+    if (mmap(base, page, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED,
+             fd, 0) == MAP_FAILED)
+    {
+        munmap(base, chan.mapSize);
+        return false;
+    }
+    for (copy = 0; copy < 4; copy++) {
+        if (mmap(rings + copy * size, size, PROT_READ | PROT_WRITE,
+                 MAP_SHARED | MAP_FIXED, fd, page + (copy / 2) * size) ==
+            MAP_FAILED)
+        {
+            munmap(base, chan.mapSize);
+            return false;
+        }
+    }
+
+    //The offering side fills in the header, the other side checks it
+    shared = (shmHeader*)base;
+    if (side == 0) {
+        shared->magic = NETSHM_MAGIC;
+        shared->version = NETSHM_VERSION;
+        shared->size = size;
+    } else if (shared->magic != NETSHM_MAGIC ||
+               shared->version != NETSHM_VERSION || shared->size != size)
+    {
+        NETLOG_ERROR("#{} Not a netshm segment", evIn);
+        munmap(base, chan.mapSize);
+        return false;
+    }
+
+    //Ring 0 (at the first pair of copies) carries bytes from side 0
+    chan.base = base;
+    chan.out = &shared->rings[side];
+    chan.in = &shared->rings[1 - side];
+    chan.outData = rings + side * 2 * size;
+    chan.inData = rings + (1 - side) * 2 * size;
+    chan.mask = size - 1;
+    chan.seen = 0;
+    chan.evOut = evOut;
+    chan.control = control;
+    channels[evIn] = chan;
+
+    //A connection like any other from here on
+    allocBuffer(evIn);
+    conSet.insert(evIn);
+    if (sdMax < evIn) {
+        sdMax = evIn;
+    }
+    return true;
+}
+
+//Copy into the ring, or queue what doesn't fit
+bool netshm::writeBytes( sock_t sd, const uint8_t *data, size_t length)
+{
+    map<sock_t, shmChannel>::iterator chan_iter = channels.find(sd);
+    size_t sent;
+
+    if (chan_iter == channels.end()) {
+        NETLOG_WARN("#{} connection not found for sendPacket()?", sd);
+        return false;
+    }
+
+    sent = writeRing(sd, chan_iter->second, data, length);
+    if (sent < length) {
+        queueBytes(sd, data + sent, length - sent);
+        NETLOG_DEBUG("#{} ring full, queued {} bytes", sd, length - sent);
+    }
+
+    return true;
+}
+
+//Free space is the ring size less what the reader hasn't read
+size_t netshm::writeRing( sock_t sd, shmChannel& chan, const uint8_t *data,
+                          size_t length)
+{
+    const uint64_t tail = chan.out->tail;
+    const uint64_t head = __atomic_load_n(&chan.out->head, __ATOMIC_ACQUIRE);
+    size_t room;
+
+    if (tail - head > chan.mask + 1) {
+        ringBroken(sd, head, tail);
+        return 0;
+    }
+    room = (size_t)(chan.mask + 1 - (tail - head));
+    if (room > length) {
+        room = length;
+    }
+    if (room == 0) {
+        return 0;
+    }
+
+    //The second copy of the ring follows the first: no wrapping
+    memcpy(chan.outData + (tail & chan.mask), data, room);
+    __atomic_store_n(&chan.out->tail, tail + room, __ATOMIC_RELEASE);
+    stats.bytesOut += room;
+    conTable[sd].stats.bytesOut += room;
+
+    //Store tail before looking at the flag.  The reader sets the flag
+    //  before it looks at tail, so one of us sees the other.
+    __sync_synchronize();
+    if (chan.out->readerWaiting) {
+        wake(chan);
+    }
+
+    return room;
+}
+
+//Copy queued bytes as the other side makes room
+void netshm::flushQueues()
+{
+    map<sock_t, shmChannel>::iterator chan_iter;
+    netchain *queue;
+    size_t sent;
+    sock_t sd;
+
+    for (chan_iter = channels.begin(); chan_iter != channels.end();
+         chan_iter++)
+    {
+        sd = chan_iter->first;
+        shmChannel& chan = chan_iter->second;
+        queue = conTable[sd].sendQueue;
+        if (queue == NULL || queue->empty() || !conTable[sd].live) {
+            continue;
+        }
+
+        for (;;) {
+            do {
+                sent = writeRing(sd, chan, queue->head(), queue->headLength());
+                queue->consume(sent);
+            } while (sent > 0 && !queue->empty());
+
+            if (queue->empty()) {
+                chan.out->writerWaiting = 0;
+                writeCB( sd, writeCBD);
+                break;
+            }
+
+            //Ask to be woken for room, then look once more
+            if (chan.out->writerWaiting) {
+                break;
+            }
+            chan.out->writerWaiting = 1;
+            __sync_synchronize();
+        }
+    }
+}
+
+//The writer sets its flag before it looks at head
+void netshm::wakeWriter( shmChannel& chan)
+{
+    __sync_synchronize();
+    if (chan.in->writerWaiting) {
+        wake(chan);
+    }
+}
+
+//Add one to the other side's eventfd
+void netshm::wake( shmChannel& chan)
+{
+    const uint64_t one = 1;
+
+    if (write(chan.evOut, &one, sizeof(one)) != sizeof(one) &&
+        !isWouldBlock())
+    {
+        NETLOG_WARN("#{} eventfd write error: {}", chan.evOut,
+            getSocketError());
+    }
+    stats.sendCalls++;
+}
+
+//Poll the listener, every eventfd and every control socket
+int netshm::pollChannels( bool idle)
+{
+    map<sock_t, shmChannel>::iterator chan_iter;
+    map<sock_t, pendingConnect>::const_iterator wait_iter;
+    struct pollfd entry;
+    uint64_t started = 0, count;
+    size_t index;
+    int wait = 0, rv, wakeups = 0;
+    sock_t control;
+
+    shmPoll.clear();
+    shmPollOwner.clear();
+    entry.events = POLLIN;
+    entry.revents = 0;
+    if (sdListen != (sock_t)INVALID_SOCKET) {
+        entry.fd = sdListen;
+        shmPoll.push_back(entry);
+        shmPollOwner.push_back(INVALID_SOCKET);
+    }
+    for (chan_iter = channels.begin(); chan_iter != channels.end();
+         chan_iter++)
+    {
+        if (!conTable[chan_iter->first].live) {
+            continue;
+        }
+        entry.fd = chan_iter->first;
+        shmPoll.push_back(entry);
+        shmPollOwner.push_back(chan_iter->first);
+        entry.fd = chan_iter->second.control;
+        shmPoll.push_back(entry);
+        shmPollOwner.push_back(chan_iter->first);
+    }
+    for (wait_iter = connWaiting.begin(); wait_iter != connWaiting.end();
+         wait_iter++)
+    {
+        entry.fd = wait_iter->second.control;
+        shmPoll.push_back(entry);
+        shmPollOwner.push_back(wait_iter->first);
+    }
+    if (shmPoll.empty()) {
+        return 0;
+    }
+
+    //Tell the writers we may sleep, then make sure nothing came in since
+    if (idle && (timeout.tv_sec > 0 || timeout.tv_usec > 0)) {
+        wait = (timeout.tv_sec * 1000) + (timeout.tv_usec / 1000);
+        for (chan_iter = channels.begin(); chan_iter != channels.end();
+             chan_iter++)
+        {
+            chan_iter->second.in->readerWaiting = 1;
+        }
+        __sync_synchronize();
+        for (chan_iter = channels.begin(); chan_iter != channels.end();
+             chan_iter++)
+        {
+            if (chan_iter->second.in->tail != chan_iter->second.seen &&
+                chan_iter->second.in->tail != chan_iter->second.in->head)
+            {
+                wait = 0;
+            }
+        }
+    }
+
+    if (timing) {
+        started = getNanoTime();
+    }
+    rv = poll(&shmPoll[0], shmPoll.size(), wait);
+    stats.selectCalls++;
+    if (timing) {
+        loopHist[TIME_SELECT].record(getNanoTime() - started);
+    }
+
+    if (wait > 0) {
+        for (chan_iter = channels.begin(); chan_iter != channels.end();
+             chan_iter++)
+        {
+            chan_iter->second.in->readerWaiting = 0;
+        }
+    } else if (idle && rv == 0) {
+        //Spinning: let the other side have the CPU if it shares ours
+        sched_yield();
+    }
+
+    if (rv == SOCKET_ERROR) {
+        NETLOG_ERROR("Shared memory poll error:{}", getSocketError());
+        return 0;
+    }
+
+    for (index = 0; rv > 0 && index < shmPoll.size(); index++) {
+        if (shmPoll[index].revents == 0) {
+            continue;
+        }
+
+        //New connections
+        if (shmPollOwner[index] == (sock_t)INVALID_SOCKET) {
+            while ((control = accept(sdListen, NULL, NULL)) !=
+                   (sock_t)INVALID_SOCKET)
+            {
+                acceptChannel(control);
+            }
+            if (!isWouldBlock()) {
+                NETLOG_WARN("#{} accept error: {}", sdListen,
+                    getSocketError());
+                stats.acceptErrors++;
+            }
+            continue;
+        }
+
+        //An answer to doConnect(), for checkConnects()
+        if (connWaiting.count(shmPollOwner[index]) != 0) {
+            continue;
+        }
+
+        //Woken: reset the eventfd
+        if (shmPoll[index].fd == shmPollOwner[index]) {
+            if (read(shmPoll[index].fd, &count, sizeof(count)) > 0) {
+                stats.recvCalls++;
+            }
+            wakeups++;
+            continue;
+        }
+
+        //Nothing more comes over the control socket: the other side is gone
+        hangups.push_back(shmPollOwner[index]);
+    }
+
+    return wakeups;
+}
+
+//Close connections whose peer went away
+void netshm::dropHangups()
+{
+    vector<sock_t>::const_iterator con_iter;
+
+    for (con_iter = hangups.begin(); con_iter != hangups.end(); con_iter++) {
+        if (!isClosed(*con_iter)) {
+            NETLOG_INFO("#{} other side closed", *con_iter);
+            pendDisconnect(*con_iter);
+        }
+    }
+    hangups.clear();
+}
+
+//Once for each connection, until dropHangups()
+void netshm::ringBroken( sock_t sd, uint64_t head, uint64_t tail)
+{
+    if (std::find(hangups.begin(), hangups.end(), sd) == hangups.end()) {
+        NETLOG_ERROR("#{} Bad ring from other side, head {} tail {}", sd,
+            head, tail);
+        hangups.push_back(sd);
+    }
+}
+
+//Connect callbacks for doConnect(), from run() as for netclient
+void netshm::fireConnects()
+{
+    vector<sock_t> ready;
+    vector<sock_t>::const_iterator con_iter;
+
+    ready.swap(connPending);
+    for (con_iter = ready.begin(); con_iter != ready.end(); con_iter++) {
+        if (!isClosed(*con_iter)) {
+            stats.connects++;
+            conCB( *con_iter, conCBD);
+        }
+    }
+}
+
+//Check the rings and sockets, handle callbacks
+int netshm::run()
+{
+    return runWith( pktMap);
+}
+
+//Ring size for new connections
+void netshm::setRingSize( size_t size)
+{
+    const size_t page = (size_t)sysconf(_SC_PAGESIZE);
+
+    ringSize = page;
+    while (ringSize < size) {
+        ringSize <<= 1;
+    }
+}
+
+//Sleep in run() when idle
+void netshm::setTimeout( unsigned int milliseconds)
+{
+    timeout.tv_sec = milliseconds / 1000;
+    timeout.tv_usec = (milliseconds % 1000) * 1000;
+}
+
+//Unmap and close, then the base class cleans up
+int netshm::closeSocket( sock_t sd)
+{
+    map<sock_t, shmChannel>::iterator chan_iter = channels.find(sd);
+
+    if (chan_iter != channels.end()) {
+        munmap(chan_iter->second.base, chan_iter->second.mapSize);
+        close(chan_iter->second.evOut);
+        close(chan_iter->second.control);
+        channels.erase(chan_iter);
+    }
+
+    return netbase::closeSocket(sd);
+}
+
+//Counters, with bytes still in the rings
+netstats netshm::getStats() const
+{
+    netstats snapshot = netbase::getStats();
+    map<sock_t, shmChannel>::const_iterator chan_iter;
+
+    for (chan_iter = channels.begin(); chan_iter != channels.end();
+         chan_iter++)
+    {
+        snapshot.bufferedBytes +=
+            chan_iter->second.in->tail - chan_iter->second.in->head;
+        snapshot.bufferMemory += 2 * (chan_iter->second.mask + 1);
+    }
+
+    return snapshot;
+}
+
+#endif
@@ -0,0 +1,333 @@
+//netshm.h
+#ifndef NETSHM_H
+#define NETSHM_H
+
+//
+// Connections between processes on one host through shared memory, with
+//  the same callbacks, handles and stats as netserver and netclient.  Each
+//  connection is a pair of single producer, single consumer byte rings in
+//  a memfd segment, one ring each way.  Sending copies into the ring, and
+//  the packet callback reads straight out of the other one: no system
+//  calls while both sides keep running.  Each ring is mapped twice in a
+//  row, so a message never wraps around the end.
+//
+// A sleeping side is woken with an eventfd, and only when it said it was
+//  going to sleep.  Set a zero timeout (the default) to spin instead, for
+//  the lowest latency.  One side offers connections on a Unix socket with
+//  openUnix(), the other calls doConnect().  The segment and eventfds are
+//  passed over that socket, and it stays open, so a peer that exits or
+//  crashes is seen as a disconnect.  Linux only.
+//
+//  Messages must be smaller than the ring (setRingSize()): a partial
+//  message that fills the ring can never be completed.
+//
+
+#include "netbase.h"
+
+#ifdef NETMM_USE_SHM
+
+namespace net__ {
+    class netshm : public netbase {
+
+    public:
+        netshm( size_t maxConnections);
+        ~netshm();
+
+        //Offer connections on Unix socket *path*: a file, or "@name" in
+        //  the abstract namespace.  A socket file left by a process that
+        //  is gone is replaced; any other file, or a live socket, fails
+        //  with EADDRINUSE.  Return socket descriptor.
+        sock_t openUnix( const std::string& path);
+
+        //Stop offering connections.  Connections stay open.
+        void closePort();
+
+        //Start connecting to the netshm offering connections on *path*,
+        //  and return connection ID.  The connect callback fires from
+        //  run() once the other side's run() answers, or the connect fail
+        //  callback if it doesn't within *milliseconds*.
+        sock_t doConnect( const std::string& path,
+                          unsigned int milliseconds = 1000);
+
+        //Fire timers, take connections, read the rings, send the queues
+        int run();
+
+        //The same, sending every event to *handler* (see nethandler.h)
+        template <class H> int run( H& handler) {
+            handlerScope scope( *this, handler);
+            return runWith( handler);
+        };
+
+        //Bytes in each ring of connections made after this call.  Rounded
+        //  up to a power of two and a whole number of pages.
+        void setRingSize( size_t size);
+
+        //Wait up to *milliseconds* in run() when there is nothing to do.
+        //  0 (the default) never sleeps.
+        void setTimeout( unsigned int milliseconds);
+
+        //Counters, with unread ring bytes as buffered
+        netstats getStats() const;
+
+          //Default ring size, each way
+        static const size_t NETMM_SHM_SIZE = 0x100000;
+          //Check the sockets at least once every this many busy run()s
+        static const unsigned int NETMM_SHM_POLL_RUNS = 64;
+
+    protected:
+        //One direction, in the shared segment.  Each field is written by
+        //  one side only, on its own cache line.
+        struct shmRing {
+            volatile uint64_t head;             //Read up to, by consumer
+            char pad1[56];
+            volatile uint64_t tail;             //Written up to, by producer
+            char pad2[56];
+            volatile uint32_t readerWaiting;    //Consumer may sleep
+            char pad3[60];
+            volatile uint32_t writerWaiting;    //Producer wants room
+            char pad4[60];
+        };
+
+        //First page of the segment, the rings follow
+        struct shmHeader {
+            uint32_t magic;
+            uint32_t version;
+            uint64_t size;          //Bytes in each ring
+            char pad[48];
+            shmRing rings[2];       //0: offering side sends, 1: connecting
+        };
+
+        //One connection.  It is known by *evIn*, the eventfd it waits on.
+        struct shmChannel {
+            uint8_t *base;          //Mapping of the whole segment
+            size_t mapSize;
+            shmRing *in, *out;
+            uint8_t *inData, *outData;
+            uint64_t mask;          //Ring size - 1
+            uint64_t seen;          //Tail the handler last saw
+            int evOut;              //Wakes the other side
+            sock_t control;         //Unix socket to the other side
+        };
+        std::map<sock_t, shmChannel> channels;
+
+          //Sockets waited on, rebuilt each time, and their connections
+        std::vector<struct pollfd> shmPoll;
+        std::vector<sock_t> shmPollOwner;
+          //Connections whose other side went away
+        std::vector<sock_t> hangups;
+          //Listening Unix socket, and its path
+        sock_t sdListen;
+        std::string listenPath;
+          //Ring size for new connections
+        size_t ringSize;
+          //Busy run()s since the sockets were checked
+        unsigned int busyRuns;
+          //doConnect() connections waiting for their connect callback
+        std::vector<sock_t> connPending;
+
+          //doConnect() connections waiting for the other side to answer
+        struct pendingConnect {
+            sock_t control;         //Unix socket to the other side
+            std::string path;
+            uint64_t deadline;
+        };
+        std::map<sock_t, pendingConnect> connWaiting;
+
+        //One run() pass, packets go to handler.onData()
+        template <class H> int runWith( H& handler);
+
+        //Pass unread bytes of every ring to the handler
+        template <class H> int readRings( H& handler);
+
+        //Wait for connections, wakeups and hangups.  Sleep up to the
+        //  timeout if *idle* and no ring has anything to read.  Returns
+        //  the number of wakeups.
+        int pollChannels( bool idle);
+
+        //Disconnect the connections in hangups
+        void dropHangups();
+
+        //The other side stored ring indices more than a ring apart: drop
+        //  the connection instead of reading or writing past the ring
+        void ringBroken( sock_t sd, uint64_t head, uint64_t tail);
+
+        //Map what the other side answered to doConnect() *sd*
+        bool answerConnect( sock_t sd, const pendingConnect& entry);
+
+        //Finish answered doConnect() connections, fail the late ones
+        int checkConnects();
+
+        //Offer a new connection to the process on *control*
+        sock_t acceptChannel( sock_t control);
+
+        //Map segment *fd* and start using connection *evIn*.  *side* is
+        //  0 for the offering side, 1 for the connecting one.
+        bool addChannel( int fd, int evIn, int evOut, sock_t control,
+                         int side);
+
+        //sendPacket() copies into the ring of the connection.  What
+        //  doesn't fit is queued, and copied from run() as the other side
+        //  reads.
+        bool writeBytes( sock_t sd, const uint8_t *data, size_t length);
+
+        //Copy what fits of *data* into the ring.  Returns bytes copied.
+        size_t writeRing( sock_t sd, shmChannel& chan, const uint8_t *data,
+                          size_t length);
+
+        //Copy send queues into their rings, fire writable callbacks
+        void flushQueues();
+
+        //Mark *bytes* read
+        void consumeRing( shmChannel& chan, size_t bytes) {
+            __atomic_store_n(&chan.in->head, chan.in->head + bytes,
+                             __ATOMIC_RELEASE); };
+
+        //Wake the other side if it waits for room in the ring
+        void wakeWriter( shmChannel& chan);
+
+        //Wake the other side with its eventfd
+        void wake( shmChannel& chan);
+
+        //Fire connect callbacks for doConnect() connections
+        void fireConnects();
+
+        //Unmap the segment, close eventfds and control socket
+        int closeSocket( sock_t sd);
+    };
+
+    //Take connections, then read rings and pass bytes to handler
+    template <class H> int netshm::runWith( H& handler)
+    {
+        uint64_t started = 0;
+        int rv = 0;
+
+        try {
+            stats.loops++;
+            if (timing) {
+                started = getNanoTime();
+            }
+
+            //Timers that are due
+            if (!timers.empty()) {
+                fireTimers();
+            }
+
+            //doConnect() connections answered
+            if (!connWaiting.empty()) {
+                checkConnects();
+            }
+
+            //doConnect() connections are ready
+            if (!connPending.empty()) {
+                fireConnects();
+            }
+
+            //Rings first.  The sockets only matter when there is nothing
+            //  to read, or now and then.
+            rv = readRings( handler);
+            if (rv == 0 || !hangups.empty() ||
+                ++busyRuns >= NETMM_SHM_POLL_RUNS)
+            {
+                busyRuns = 0;
+
+                //What a closed peer wrote last is read before it goes
+                if (pollChannels( rv == 0) > 0 || !hangups.empty()) {
+                    rv += readRings( handler);
+                }
+                if (!hangups.empty()) {
+                    dropHangups();
+                }
+            }
+
+            //Send what didn't fit before, and what the callbacks sent
+            flushQueues();
+
+            fireDisconnects();
+            if (timing) {
+                loopHist[TIME_LOOP].record(getNanoTime() - started);
+            }
+        }
+        catch(...) {
+            NETLOG_ERROR("Unhandled exception!!");
+            rv = -1;
+        };
+
+        return rv;
+    }
+
+    //Run handler.onData() on the unread bytes of each ring, until it
+    //  stops reading
+    template <class H> int netshm::readRings( H& handler)
+    {
+        std::map<sock_t, shmChannel>::iterator chan_iter;
+        uint64_t head, tail, called = 0;
+        size_t unread, fresh, bytes_read;
+        sock_t con;
+        int rv = 0;
+
+        for (chan_iter = channels.begin(); chan_iter != channels.end();
+             chan_iter++)
+        {
+            shmChannel& chan = chan_iter->second;
+            con = chan_iter->first;
+            if (!conTable[con].live) {
+                continue;
+            }
+
+            //Bytes written before tail was published are visible now.
+            //  Like a socket, the handler only runs again for new bytes.
+            head = chan.in->head;
+            tail = __atomic_load_n(&chan.in->tail, __ATOMIC_ACQUIRE);
+            if (tail == head || tail == chan.seen) {
+                continue;
+            }
+            if (tail - head > chan.mask + 1) {
+                ringBroken( con, head, tail);
+                continue;
+            }
+            unread = (size_t)(tail - head);
+            fresh = (size_t)(tail - (chan.seen > head ? chan.seen : head));
+            stats.bytesIn += fresh;
+            conTable[con].stats.bytesIn += fresh;
+            chan.seen = tail;
+            conTable[con].time = getTime();
+            stats.packets++;
+            rv++;
+
+            //Keep running the handler until no more bytes are read
+            do {
+                netpacket pkt( unread, chan.inData + (head & chan.mask), 0);
+                pkt.ID = con;
+
+                if (timing) {
+                    called = getNanoTime();
+                }
+                bytes_read = handler.onData( con, &pkt);
+                if (timing) {
+                    loopHist[TIME_HANDLER].record(getNanoTime() - called);
+                }
+                stats.callbacks++;
+
+                //Disconnected in the callback: the mapping is still there
+                //  until fireDisconnects(), but nothing more is read
+                if (bytes_read == 0 || bytes_read > unread ||
+                    !conTable[con].live)
+                {
+                    break;
+                }
+                stats.messagesIn++;
+                conTable[con].stats.messagesIn++;
+                consumeRing( chan, bytes_read);
+                head += bytes_read;
+                unread -= bytes_read;
+            } while (unread > 0);
+
+            wakeWriter( chan);
+        }
+
+        return rv;
+    }
+}
+
+#endif
+#endif
@@ -0,0 +1,108 @@
+// netstats: Event loop and connection counters
+
+#include "netstats.h"
+
+//STL namespace
+using std::ostream;
+
+//net__ namespace
+using net__::netconstats;
+using net__::netstats;
+
+//Zero all counters
+void netconstats::clear()
+{
+    bytesIn = bytesOut = 0;
+    messagesIn = messagesOut = 0;
+    recvCalls = sendCalls = 0;
+    connectTime = 0;
+}
+
+//Zero all counters and gauges
+void netstats::clear()
+{
+    bytesIn = bytesOut = 0;
+    messagesIn = messagesOut = 0;
+    selectCalls = recvCalls = sendCalls = 0;
+    wouldBlock = 0;
+    bufferGrowths = bufferShrinks = 0;
+    accepts = acceptRejects = 0;
+    acceptErrors = acceptFdLimit = listenRestarts = 0;
+    connects = connectFailures = 0;
+    disconnects = 0;
+    loops = packets = callbacks = callbackTime = timersFired = 0;
+
+    connections = connecting = pendingDisconnects = 0;
+    bufferedBytes = bufferMemory = queuedBytes = timers = 0;
+    time = 0;
+}
+
+//Counters since *earlier*, for rates over the interval
+netstats netstats::since( const netstats& earlier) const
+{
+    netstats delta = *this;
+
+    delta.bytesIn -= earlier.bytesIn;
+    delta.bytesOut -= earlier.bytesOut;
+    delta.messagesIn -= earlier.messagesIn;
+    delta.messagesOut -= earlier.messagesOut;
+    delta.selectCalls -= earlier.selectCalls;
+    delta.recvCalls -= earlier.recvCalls;
+    delta.sendCalls -= earlier.sendCalls;
+    delta.wouldBlock -= earlier.wouldBlock;
+    delta.bufferGrowths -= earlier.bufferGrowths;
+    delta.bufferShrinks -= earlier.bufferShrinks;
+    delta.accepts -= earlier.accepts;
+    delta.acceptRejects -= earlier.acceptRejects;
+    delta.acceptErrors -= earlier.acceptErrors;
+    delta.acceptFdLimit -= earlier.acceptFdLimit;
+    delta.listenRestarts -= earlier.listenRestarts;
+    delta.connects -= earlier.connects;
+    delta.connectFailures -= earlier.connectFailures;
+    delta.disconnects -= earlier.disconnects;
+    delta.loops -= earlier.loops;
+    delta.packets -= earlier.packets;
+    delta.callbacks -= earlier.callbacks;
+    delta.callbackTime -= earlier.callbackTime;
+    delta.timersFired -= earlier.timersFired;
+
+    //Interval length in milliseconds
+    delta.time -= earlier.time;
+
+    return delta;
+}
+
+//Text export, one line per value
+void netstats::write( ostream& out, const char *prefix) const
+{
+    out << prefix << "bytes_in " << bytesIn << "\n"
+        << prefix << "bytes_out " << bytesOut << "\n"
+        << prefix << "messages_in " << messagesIn << "\n"
+        << prefix << "messages_out " << messagesOut << "\n"
+        << prefix << "select_calls " << selectCalls << "\n"
+        << prefix << "recv_calls " << recvCalls << "\n"
+        << prefix << "send_calls " << sendCalls << "\n"
+        << prefix << "would_block " << wouldBlock << "\n"
+        << prefix << "buffer_growths " << bufferGrowths << "\n"
+        << prefix << "buffer_shrinks " << bufferShrinks << "\n"
+        << prefix << "accepts " << accepts << "\n"
+        << prefix << "accept_rejects " << acceptRejects << "\n"
+        << prefix << "accept_errors " << acceptErrors << "\n"
+        << prefix << "accept_fd_limit " << acceptFdLimit << "\n"
+        << prefix << "listen_restarts " << listenRestarts << "\n"
+        << prefix << "connects " << connects << "\n"
+        << prefix << "connect_failures " << connectFailures << "\n"
+        << prefix << "disconnects " << disconnects << "\n"
+        << prefix << "loops " << loops << "\n"
+        << prefix << "packets " << packets << "\n"
+        << prefix << "callbacks " << callbacks << "\n"
+        << prefix << "callback_ns " << callbackTime << "\n"
+        << prefix << "timers_fired " << timersFired << "\n"
+        << prefix << "connections " << connections << "\n"
+        << prefix << "connecting " << connecting << "\n"
+        << prefix << "pending_disconnects " << pendingDisconnects << "\n"
+        << prefix << "buffered_bytes " << bufferedBytes << "\n"
+        << prefix << "buffer_memory " << bufferMemory << "\n"
+        << prefix << "queued_bytes " << queuedBytes << "\n"
+        << prefix << "timers " << timers << "\n";
+}
@@ -0,0 +1,79 @@
+//netstats.h
+#ifndef NETSTATS_H
+#define NETSTATS_H
+
+//
+// Performance counters.  Each netbase counts for its own event loop, with
+//  plain (non-atomic) increments, since one thread runs the loop.  Take a
+//  snapshot with getStats(), subtract an earlier one for rates, write() it
+//  out as "name value" lines.
+//
+
+#ifdef _MSC_VER
+    #include "ms_stdint.h"
+#else
+    #include <stdint.h>
+#endif
+
+#include <iostream>
+
+namespace net__ {
+
+    //Counters for one connection
+    struct netconstats {
+        uint64_t bytesIn, bytesOut;
+        uint64_t messagesIn, messagesOut;   //Bytes consumed by callback,
+                                            //  sendPacket() calls
+        uint64_t recvCalls, sendCalls;      //System calls
+        uint64_t connectTime;               //netbase::getTime() at connect
+
+        netconstats() { clear(); };
+        void clear();
+    };
+
+    //Counters for one event loop
+    struct netstats {
+          //Traffic
+        uint64_t bytesIn, bytesOut;
+        uint64_t messagesIn, messagesOut;
+          //System calls
+        uint64_t selectCalls, recvCalls, sendCalls;
+        uint64_t wouldBlock;        //Reads/writes/accepts that returned EAGAIN
+          //Receive buffers
+        uint64_t bufferGrowths, bufferShrinks;
+          //Connections
+        uint64_t accepts, acceptRejects;
+        uint64_t acceptErrors;      //Aborted before accept(), interrupted
+        uint64_t acceptFdLimit;     //Out of descriptors (EMFILE)
+        uint64_t listenRestarts;    //Listening socket failed, reopened
+        uint64_t connects, connectFailures;
+        uint64_t disconnects;
+          //Loop
+        uint64_t loops;             //readIncomingSockets() calls
+        uint64_t packets;           //Packets passed to fireCallbacks()
+        uint64_t callbacks;         //Packet callback calls
+        uint64_t callbackTime;      //Nanoseconds in fireCallbacks()
+        uint64_t timersFired;
+
+          //Gauges, filled in by getStats()
+        uint64_t connections;       //Open connections
+        uint64_t connecting;        //Connects in progress (netclient)
+        uint64_t pendingDisconnects;
+        uint64_t bufferedBytes;     //Received, not consumed yet
+        uint64_t bufferMemory;      //Allocated for receive buffers
+        uint64_t queuedBytes;       //Sent, waiting in send queues
+        uint64_t timers;            //Timers waiting to fire
+        uint64_t time;              //netbase::getTime() of snapshot
+
+        netstats() { clear(); };
+        void clear();
+
+        //Counters minus the *earlier* snapshot, gauges as they are now
+        netstats since( const netstats& earlier) const;
+
+        //Write one "<prefix>name value" line per field
+        void write( std::ostream& out, const char *prefix = "netmm_") const;
+    };
+}
+
+#endif
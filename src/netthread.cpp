@@ -0,0 +1,203 @@
+// netthread: Platform threads, mutexes and semaphores
+
+#include "netthread.h"
+
+#ifndef _WIN32
+    #include <sys/time.h>
+    #include <time.h>
+    #include <errno.h>
+#endif
+
+//net__ namespace
+using net__::netmutex;
+using net__::netsemaphore;
+using net__::netthread;
+
+//
+//  netmutex function implementations
+//
+
+netmutex::netmutex()
+{
+#ifdef _WIN32
+    InitializeCriticalSection(&mutex);
+#else
+    pthread_mutex_init(&mutex, NULL);
+#endif
+}
+
+netmutex::~netmutex()
+{
+#ifdef _WIN32
+    DeleteCriticalSection(&mutex);
+#else
+    pthread_mutex_destroy(&mutex);
+#endif
+}
+
+void netmutex::lock()
+{
+#ifdef _WIN32
+    EnterCriticalSection(&mutex);
+#else
+    pthread_mutex_lock(&mutex);
+#endif
+}
+
+void netmutex::unlock()
+{
+#ifdef _WIN32
+    LeaveCriticalSection(&mutex);
+#else
+    pthread_mutex_unlock(&mutex);
+#endif
+}
+
+//
+//  netsemaphore function implementations
+//
+
+netsemaphore::netsemaphore()
+{
+#ifdef _WIN32
+    semaphore = CreateSemaphore(NULL, 0, 0x7FFFFFFF, NULL);
+#else
+    count = 0;
+    pthread_mutex_init(&mutex, NULL);
+    pthread_cond_init(&cond, NULL);
+#endif
+}
+
+netsemaphore::~netsemaphore()
+{
+#ifdef _WIN32
+    CloseHandle(semaphore);
+#else
+    pthread_cond_destroy(&cond);
+    pthread_mutex_destroy(&mutex);
+#endif
+}
+
+void netsemaphore::post()
+{
+#ifdef _WIN32
+    ReleaseSemaphore(semaphore, 1, NULL);
+#else
+    pthread_mutex_lock(&mutex);
+    count++;
+    pthread_cond_signal(&cond);
+    pthread_mutex_unlock(&mutex);
+#endif
+}
+
+bool netsemaphore::wait( unsigned int milliseconds)
+{
+#ifdef _WIN32
+    return (WaitForSingleObject(semaphore, milliseconds) == WAIT_OBJECT_0);
+#else
+    struct timeval now;
+    struct timespec until;
+    int rv = 0;
+
+    //Absolute time to give up
+    gettimeofday(&now, NULL);
+    until.tv_sec = now.tv_sec + (milliseconds / 1000);
+    until.tv_nsec = (now.tv_usec * 1000) + ((milliseconds % 1000) * 1000000);
+    if (until.tv_nsec >= 1000000000) {
+        until.tv_sec++;
+        until.tv_nsec -= 1000000000;
+    }
+
+    pthread_mutex_lock(&mutex);
+    while (count == 0 && rv != ETIMEDOUT) {
+        rv = pthread_cond_timedwait(&cond, &mutex, &until);
+    }
+    if (count > 0) {
+        count--;
+        rv = 0;
+    }
+    pthread_mutex_unlock(&mutex);
+
+    return (rv == 0);
+#endif
+}
+
+void netsemaphore::wait()
+{
+#ifdef _WIN32
+    WaitForSingleObject(semaphore, INFINITE);
+#else
+    pthread_mutex_lock(&mutex);
+    while (count == 0) {
+        pthread_cond_wait(&cond, &mutex);
+    }
+    count--;
+    pthread_mutex_unlock(&mutex);
+#endif
+}
+
+//
+//  netthread function implementations
+//
+
+netthread::netthread(): running(false), threadFunc(NULL), threadData(NULL)
+{
+    ;
+}
+
+netthread::~netthread()
+{
+    join();
+}
+
+//Start thread running func(data)
+bool netthread::start( threadFP func, void *data)
+{
+    if (running) {
+        return false;
+    }
+    threadFunc = func;
+    threadData = data;
+
+#ifdef _WIN32
+    thread = CreateThread(NULL, 0, threadMain, this, 0, NULL);
+    running = (thread != NULL);
+#else
+    running = (pthread_create(&thread, NULL, threadMain, this) == 0);
+#endif
+
+    return running;
+}
+
+//Wait for thread to finish
+void netthread::join()
+{
+    if (!running) {
+        return;
+    }
+
+#ifdef _WIN32
+    WaitForSingleObject(thread, INFINITE);
+    CloseHandle(thread);
+#else
+    pthread_join(thread, NULL);
+#endif
+    running = false;
+}
+
+//Thread entry point, calls threadFunc
+#ifdef _WIN32
+DWORD WINAPI netthread::threadMain( LPVOID arg)
+{
+    netthread *self = (netthread*)arg;
+    self->threadFunc( self->threadData);
+    return 0;
+}
+#else
+void* netthread::threadMain( void *arg)
+{
+    netthread *self = (netthread*)arg;
+    self->threadFunc( self->threadData);
+    return NULL;
+}
+#endif
@@ -0,0 +1,124 @@
+//netthread.h
+#ifndef NETTHREAD_H
+#define NETTHREAD_H
+
+//
+// Minimal threads, mutexes and semaphores for background work
+//  (name resolution, logging).  The event loop itself stays single threaded.
+//
+
+#ifdef _WIN32
+    #include <winsock2.h>     //Before windows.h, or winsock.h gets in first
+    #include <windows.h>
+#else
+    #include <pthread.h>
+#endif
+
+namespace net__ {
+
+    //Mutual exclusion lock
+    class netmutex {
+
+    public:
+        netmutex();
+        ~netmutex();
+
+        void lock();
+        void unlock();
+
+    protected:
+#ifdef _WIN32
+        CRITICAL_SECTION mutex;
+#else
+        pthread_mutex_t mutex;
+#endif
+
+    private:
+        //Not copyable
+        netmutex( const netmutex&);
+        netmutex& operator=( const netmutex&);
+    };
+
+    //Lock a netmutex for the current scope
+    class netlock {
+
+    public:
+        netlock( netmutex& m): mutex(m) { mutex.lock(); };
+        ~netlock() { mutex.unlock(); };
+
+    protected:
+        netmutex& mutex;
+
+    private:
+        netlock( const netlock&);
+        netlock& operator=( const netlock&);
+    };
+
+    //Counting semaphore
+    class netsemaphore {
+
+    public:
+        netsemaphore();
+        ~netsemaphore();
+
+        //Increment count, wake one waiter
+        void post();
+
+        //Wait until count > 0 and decrement it.  Return false on timeout.
+        bool wait( unsigned int milliseconds);
+
+        //Wait forever
+        void wait();
+
+    protected:
+#ifdef _WIN32
+        HANDLE semaphore;
+#else
+        pthread_mutex_t mutex;
+        pthread_cond_t cond;
+        unsigned int count;
+#endif
+
+    private:
+        netsemaphore( const netsemaphore&);
+        netsemaphore& operator=( const netsemaphore&);
+    };
+
+    //Thread running a function
+    class netthread {
+
+    public:
+        //Thread function type
+        typedef void (*threadFP)( void *data);
+
+        netthread();
+        ~netthread();   //Joins the thread if still running
+
+        //Start thread running func(data)
+        bool start( threadFP func, void *data);
+
+        //Wait for thread to finish
+        void join();
+
+        //Was the thread started and not joined?
+        bool isRunning() const { return running; };
+
+    protected:
+        bool running;
+        threadFP threadFunc;
+        void *threadData;
+#ifdef _WIN32
+        HANDLE thread;
+        static DWORD WINAPI threadMain( LPVOID arg);
+#else
+        pthread_t thread;
+        static void* threadMain( void *arg);
+#endif
+
+    private:
+        netthread( const netthread&);
+        netthread& operator=( const netthread&);
+    };
+}
+
+#endif
@@ -16,7 +16,7 @@ using net__::netpacket;
 #ifdef _WIN32
     #include <windows.h>
 #else
-    #include <cunistd>
+    #include <unistd.h>
     #define Sleep(n) usleep( n * 1000 )
 #endif
 
@@ -26,6 +26,14 @@ const size_t timeouttime = 5000;
 
 //Callbacks
 size_t print_pkt( netpacket* pkt, void *cb_data);
+size_t send_request( int c, void *cb_data);
+size_t connect_failed( int c, void *cb_data);
+
+//Types
+typedef struct {
+    netclient *client;
+    netpacket *request;
+} clientRequest;
 
 //MAIN
 int main (int argc, char *argv[])
@@ -57,6 +65,11 @@ int main (int argc, char *argv[])
     strncpy((char*)(buffer + index),http_request.c_str(),http_request.length());
     netpacket http_get_pkt( http_request.length(), buffer + index);
 
+    //Send the request once connected
+    clientRequest request_data = { &Client, &http_get_pkt };
+    Client.setConnectCB( send_request, &request_data);
+    Client.setConnectFailCB( connect_failed, &Client);
+
     //Connect to server on port 80
     int connection;
     connection = Client.doConnect(server.c_str(), port, lport);
@@ -64,13 +77,6 @@ int main (int argc, char *argv[])
         cout << "Connection error: " << Client.lastError << endl;
         return 1;
     }
-    http_get_pkt.ID = connection;
-
-    //Set connection callback
-    Client.setConPktCB( connection, print_pkt, NULL);
-
-    //Send HTTP request... to Google!
-    Client.sendPacket( connection, http_get_pkt );
     
     //Loop until timeout
     size_t passedtime = 0;
@@ -98,6 +104,27 @@ int main (int argc, char *argv[])
     return 0;
 }
 
+//Connection callback: send HTTP request... to Google!
+size_t send_request( int c, void *cb_data)
+{
+    clientRequest *request = (clientRequest*)cb_data;
+    request->request->ID = c;
+
+    //Set connection callback
+    request->client->setConPktCB( c, print_pkt, NULL);
+    request->client->sendPacket( c, *(request->request) );
+
+    return 0;
+}
+
+//Connect failed callback
+size_t connect_failed( int c, void *cb_data)
+{
+    netclient *Client = (netclient*)cb_data;
+    cout << "Connection error: " << Client->lastError << endl;
+    return 0;
+}
+
 //Callback, return number of bytes printed from packet
 size_t print_pkt( netpacket* pkt, void *cb_data)
 {
@@ -17,7 +17,7 @@ using net__::netpacket;
 #ifdef _WIN32
     #include <windows.h>
 #else
-    #include <cunistd>
+    #include <unistd.h>
     #define Sleep(n) usleep( n * 1000 )
 #endif
 